@@ -0,0 +1,724 @@
+/*
+** $Id: lactorlib.c $
+** Actor Library: independent states running in their own OS threads
+** See Copyright Notice in lua.h
+*/
+
+#define lactorlib_c
+#define LUA_LIB
+
+#include "lprefix.h"
+
+
+#include <errno.h>
+#include <math.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "lua.h"
+
+#include "lauxlib.h"
+#include "lualib.h"
+
+
+#if LUA_USE_ACTORS
+
+#include <pthread.h>
+
+
+/*
+** Each actor is a separate state, with its own heap and collector,
+** running in its own OS thread. Actors share nothing; they talk only
+** through messages, which are lists of values (see 'lua_packmessage')
+** plus handles of actors. A message is packed by the sender directly
+** in the heap of the receiver, so receiving it does not copy strings
+** or array parts again.
+**
+** Each actor has a mailbox, a lock-free queue with many producers and
+** one consumer (D. Vyukov's intrusive MPSC queue). Senders never
+** block; a receiver with an empty mailbox sleeps on a condition
+** variable, which senders signal only when it is sleeping.
+**
+** A state that spawns actors waits for all of them to finish before
+** it closes.
+*/
+
+
+#define ACTORHANDLE	"actor"
+
+
+typedef struct Actor Actor;
+
+
+/* a handle of an actor inside a letter */
+typedef struct HandleRef {
+  int pos;  /* position of the handle among the values of the letter */
+  Actor *a;
+} HandleRef;
+
+
+typedef struct Letter {
+  struct Letter *next;
+  lua_Message *msg;  /* values of the letter (NULL in the stub) */
+  int nhandles;
+  HandleRef handles[1];
+} Letter;
+
+
+#define sizeletter(n)	(offsetof(Letter, handles) + (n) * sizeof(HandleRef))
+
+
+struct Actor {
+  int refs;  /* handles, letters, owners, and thread using this actor */
+  Letter *head;  /* last letter in the mailbox (where senders push) */
+  Letter *tail;  /* first letter in the mailbox (where receiver pops) */
+  Letter stub;
+  int sleeping;  /* true while receiver waits for a letter */
+  int finished;  /* true when receiver will not read its mailbox anymore */
+  pthread_mutex_t lock;
+  pthread_cond_t arrived;
+  lua_Alloc allocf;  /* allocation function for letters (see 'getself') */
+  void *ud;
+  lua_State *L;  /* state of a spawned actor, until its thread starts */
+  Letter *start;  /* chunk and arguments of a spawned actor */
+  int hasthread;
+  pthread_t thread;
+  pthread_mutex_t joinlock;
+  int joined;
+  char *error;  /* error that ended the actor (NULL if none) */
+  Actor *sibling;  /* next actor spawned by the same state */
+};
+
+
+/* what a state knows about actors */
+typedef struct Owner {
+  Actor *self;  /* mailbox of the state (NULL if never used) */
+  Actor *children;  /* list of actors spawned by the state */
+  Letter *pending;  /* letter being unpacked (kept if unpacking fails) */
+} Owner;
+
+
+/* keys in the registry */
+static const int OWNER = 0;
+static const int HANDLES = 0;  /* weak table of handles of each actor */
+
+
+/*
+** {======================================================
+** Mailboxes
+** =======================================================
+*/
+
+static void mbpush (Actor *a, Letter *l) {
+  Letter *prev;
+  __atomic_store_n(&l->next, NULL, __ATOMIC_RELAXED);
+  prev = __atomic_exchange_n(&a->head, l, __ATOMIC_ACQ_REL);
+  __atomic_store_n(&prev->next, l, __ATOMIC_RELEASE);
+}
+
+
+/*
+** Remove the first letter of the mailbox; return NULL if it is empty
+** or if a sender is still linking the first letter (that sender will
+** wake the receiver afterwards, if needed).
+*/
+static Letter *mbpop (Actor *a) {
+  Letter *tail = a->tail;
+  Letter *next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+  if (tail == &a->stub) {  /* skip stub */
+    if (next == NULL)
+      return NULL;
+    a->tail = tail = next;
+    next = __atomic_load_n(&next->next, __ATOMIC_ACQUIRE);
+  }
+  if (next == NULL) {  /* 'tail' may be the last letter */
+    if (tail != __atomic_load_n(&a->head, __ATOMIC_ACQUIRE))
+      return NULL;  /* no; a push is in progress */
+    mbpush(a, &a->stub);  /* put stub after it to take it out */
+    next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+    if (next == NULL)
+      return NULL;
+  }
+  a->tail = next;
+  return tail;
+}
+
+
+/* give a letter to an actor and wake it if it is waiting */
+static void deliver (Actor *a, Letter *l) {
+  mbpush(a, l);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&a->sleeping, __ATOMIC_RELAXED)) {
+    pthread_mutex_lock(&a->lock);
+    pthread_cond_signal(&a->arrived);
+    pthread_mutex_unlock(&a->lock);
+  }
+}
+
+
+/*
+** Wait for a letter until 'deadline' (forever if NULL); return NULL
+** if it times out.
+*/
+static Letter *waitletter (Actor *a, const struct timespec *deadline) {
+  Letter *l;
+  while ((l = mbpop(a)) == NULL) {
+    int res = 0;
+    pthread_mutex_lock(&a->lock);
+    __atomic_store_n(&a->sleeping, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if ((l = mbpop(a)) == NULL) {  /* still empty? */
+      if (deadline)
+        res = pthread_cond_timedwait(&a->arrived, &a->lock, deadline);
+      else
+        pthread_cond_wait(&a->arrived, &a->lock);
+    }
+    __atomic_store_n(&a->sleeping, 0, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&a->lock);
+    if (l != NULL || res == ETIMEDOUT)
+      break;
+  }
+  return l;
+}
+
+/* }====================================================== */
+
+
+
+/*
+** {======================================================
+** Actors
+** =======================================================
+*/
+
+static Actor *newactor (lua_Alloc f, void *ud) {
+  Actor *a = (Actor *)malloc(sizeof(Actor));
+  if (a == NULL)
+    return NULL;
+  a->refs = 1;
+  a->stub.next = NULL;
+  a->stub.msg = NULL;
+  a->stub.nhandles = 0;
+  a->head = a->tail = &a->stub;
+  a->sleeping = a->finished = 0;
+  pthread_mutex_init(&a->lock, NULL);
+  pthread_cond_init(&a->arrived, NULL);
+  a->allocf = f; a->ud = ud;
+  a->L = NULL;
+  a->start = NULL;
+  a->hasthread = 0;
+  pthread_mutex_init(&a->joinlock, NULL);
+  a->joined = 0;
+  a->error = NULL;
+  a->sibling = NULL;
+  return a;
+}
+
+
+static void retain (Actor *a) {
+  __atomic_add_fetch(&a->refs, 1, __ATOMIC_RELAXED);
+}
+
+
+static void release (Actor *a);
+
+
+static void freeletter (Letter *l) {
+  int i;
+  if (l->msg != NULL)
+    lua_freemessage(l->msg);
+  for (i = 0; i < l->nhandles; i++)
+    release(l->handles[i].a);
+  free(l);
+}
+
+
+/* discard all letters in the mailbox of an actor */
+static void drain (Actor *a) {
+  Letter *l;
+  while ((l = mbpop(a)) != NULL)
+    freeletter(l);
+}
+
+
+static void release (Actor *a) {
+  if (__atomic_sub_fetch(&a->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+    if (a->L != NULL)  /* thread never started? */
+      lua_close(a->L);
+    if (a->start != NULL)
+      freeletter(a->start);
+    drain(a);
+    pthread_mutex_destroy(&a->lock);
+    pthread_cond_destroy(&a->arrived);
+    pthread_mutex_destroy(&a->joinlock);
+    free(a->error);
+    free(a);
+  }
+}
+
+
+/* wait for the thread of an actor to end (only once) */
+static void joinactor (Actor *a) {
+  pthread_mutex_lock(&a->joinlock);
+  if (!a->joined) {
+    pthread_join(a->thread, NULL);
+    a->joined = 1;
+  }
+  pthread_mutex_unlock(&a->joinlock);
+}
+
+
+/* a state stops receiving letters */
+static void finish (Actor *a) {
+  __atomic_store_n(&a->finished, 1, __ATOMIC_SEQ_CST);
+  drain(a);
+}
+
+
+static int owner_gc (lua_State *L) {
+  Owner *o = (Owner *)lua_touserdata(L, 1);
+  if (o->pending != NULL) {
+    freeletter(o->pending);
+    o->pending = NULL;
+  }
+  if (o->self != NULL) {
+    finish(o->self);
+    release(o->self);
+    o->self = NULL;
+  }
+  while (o->children != NULL) {  /* wait for all spawned actors */
+    Actor *a = o->children;
+    o->children = a->sibling;
+    joinactor(a);
+    release(a);
+  }
+  return 0;
+}
+
+
+static Owner *getowner (lua_State *L) {
+  Owner *o;
+  if (lua_rawgetp(L, LUA_REGISTRYINDEX, &OWNER) == LUA_TNIL) {
+    lua_pop(L, 1);
+    o = (Owner *)lua_newuserdata(L, sizeof(Owner));
+    o->self = NULL;
+    o->children = NULL;
+    o->pending = NULL;
+    lua_createtable(L, 0, 1);  /* metatable */
+    lua_pushcfunction(L, owner_gc);
+    lua_setfield(L, -2, "__gc");
+    lua_setmetatable(L, -2);
+    lua_pushvalue(L, -1);
+    lua_rawsetp(L, LUA_REGISTRYINDEX, &OWNER);
+  }
+  o = (Owner *)lua_touserdata(L, -1);
+  lua_pop(L, 1);  /* still anchored in the registry */
+  return o;
+}
+
+
+/* push the (unique) handle of actor 'a' in state 'L' */
+static void pushhandle (lua_State *L, Actor *a) {
+  lua_rawgetp(L, LUA_REGISTRYINDEX, &HANDLES);
+  if (lua_rawgetp(L, -1, a) == LUA_TNIL) {
+    Actor **h;
+    lua_pop(L, 1);
+    h = (Actor **)lua_newuserdata(L, sizeof(Actor *));
+    *h = a;
+    retain(a);
+    luaL_setmetatable(L, ACTORHANDLE);
+    lua_pushvalue(L, -1);
+    lua_rawsetp(L, -3, a);
+  }
+  lua_remove(L, -2);  /* remove table of handles */
+}
+
+
+static Actor *checkactor (lua_State *L, int arg) {
+  return *(Actor **)luaL_checkudata(L, arg, ACTORHANDLE);
+}
+
+
+/*
+** Allocation function for letters to states whose own allocator may
+** not be called from other threads. (Such letters are copied when
+** unpacked, instead of adopted.)
+*/
+static void *letteralloc (void *ud, void *ptr, size_t osize,
+                          size_t nsize) {
+  (void)ud; (void)osize;  /* not used */
+  if (nsize == 0) {
+    free(ptr);
+    return NULL;
+  }
+  else
+    return realloc(ptr, nsize);
+}
+
+
+/*
+** Mailbox of the running state. Senders pack letters in their own
+** threads with the allocator of the mailbox, so an arena state (whose
+** allocator is not thread safe, see 'luaL_newslabstate') gets
+** 'letteralloc' instead of its own.
+*/
+static Actor *getself (lua_State *L) {
+  Owner *o = getowner(L);
+  if (o->self == NULL) {
+    void *ud = NULL;
+    lua_Alloc f = letteralloc;
+    if (!lua_gc(L, LUA_GCARENA, -1))  /* not an arena state? */
+      f = lua_getallocf(L, &ud);
+    if ((o->self = newactor(f, ud)) == NULL)
+      luaL_error(L, "not enough memory");
+  }
+  return o->self;
+}
+
+/* }====================================================== */
+
+
+
+/*
+** {======================================================
+** Letters
+** =======================================================
+*/
+
+/*
+** Pack the values from index 'first' up to the top in a letter for
+** actor 'a', and pop them. Handles of actors go in the letter apart
+** from the message.
+*/
+static Letter *packletter (lua_State *L, int first, Actor *a) {
+  int top = lua_gettop(L);
+  int nh = 0;
+  int i;
+  HandleRef *refs;
+  Letter *l;
+  lua_Message *m;
+  for (i = first; i <= top; i++) {
+    if (luaL_testudata(L, i, ACTORHANDLE))
+      nh++;
+  }
+  /* keep handle positions in a temporary userdata below the values */
+  refs = (HandleRef *)lua_newuserdata(L, nh * sizeof(HandleRef));
+  lua_insert(L, first++);
+  top++;
+  nh = 0;
+  for (i = first; i <= top; i++) {
+    if (luaL_testudata(L, i, ACTORHANDLE)) {
+      refs[nh].pos = i - first;
+      refs[nh++].a = checkactor(L, i);
+      lua_pushnil(L);
+      lua_replace(L, i);
+    }
+  }
+  m = lua_packmessage(L, top - first + 1, a->allocf, a->ud);
+  l = (Letter *)malloc(sizeletter(nh));
+  if (l == NULL) {
+    lua_freemessage(m);
+    luaL_error(L, "not enough memory");
+  }
+  l->msg = m;
+  l->nhandles = nh;
+  for (i = 0; i < nh; i++) {
+    l->handles[i] = refs[i];
+    retain(refs[i].a);
+  }
+  lua_pop(L, 1);  /* remove temporary userdata */
+  return l;
+}
+
+
+/*
+** Push the values of a letter (received by state 'L', with owner 'o')
+** and free it; return the number of values. While unpacking, the
+** letter stays in 'o', to be freed even if there are errors.
+*/
+static int unpackletter (lua_State *L, Owner *o, Letter *l) {
+  int i, n;
+  int base = lua_gettop(L) + 1;
+  lua_Message *m = l->msg;
+  if (o->pending != NULL)  /* left by a previous error? */
+    freeletter(o->pending);
+  o->pending = l;
+  l->msg = NULL;  /* 'lua_unpackmessage' frees it */
+  n = lua_unpackmessage(L, m);
+  for (i = 0; i < l->nhandles; i++) {
+    pushhandle(L, l->handles[i].a);
+    lua_replace(L, base + l->handles[i].pos);
+  }
+  o->pending = NULL;
+  freeletter(l);
+  return n;
+}
+
+/* }====================================================== */
+
+
+
+/*
+** {======================================================
+** Threads of actors
+** =======================================================
+*/
+
+/* body of an actor, called in protected mode in its own state */
+static int startactor (lua_State *L) {
+  Actor *a = (Actor *)lua_touserdata(L, 1);
+  Owner *o;
+  Letter *start = a->start;
+  int n;
+  size_t len;
+  const char *code;
+  lua_pop(L, 1);
+  luaL_openlibs(L);
+  o = getowner(L);
+  retain(a);
+  o->self = a;
+  a->start = NULL;
+  n = unpackletter(L, o, start);  /* chunk and its arguments */
+  code = lua_tolstring(L, 1, &len);
+  if (luaL_loadbuffer(L, code, len, code) != LUA_OK)
+    return lua_error(L);
+  lua_replace(L, 1);  /* replace code with the loaded chunk */
+  lua_call(L, n - 1, 0);
+  return 0;
+}
+
+
+static void *runactor (void *ud) {
+  Actor *a = (Actor *)ud;
+  lua_State *L = a->L;
+  a->L = NULL;
+  lua_pushcfunction(L, startactor);
+  lua_pushlightuserdata(L, a);
+  if (lua_pcall(L, 1, 0, 0) != LUA_OK) {
+    const char *msg = lua_tostring(L, -1);
+    if (msg == NULL)
+      msg = lua_pushfstring(L, "(error object is a %s value)",
+                               luaL_typename(L, -1));
+    a->error = (char *)malloc(strlen(msg) + 1);
+    if (a->error != NULL)
+      strcpy(a->error, msg);
+  }
+  lua_close(L);  /* also waits for actors spawned by this one */
+  finish(a);  /* in case the actor ended before owning its mailbox */
+  release(a);
+  return NULL;
+}
+
+/* }====================================================== */
+
+
+
+/*
+** {======================================================
+** Library functions
+** =======================================================
+*/
+
+static int writer (lua_State *L, const void *b, size_t size, void *B) {
+  (void)L;
+  luaL_addlstring((luaL_Buffer *)B, (const char *)b, size);
+  return 0;
+}
+
+
+/*
+** spawn(code, ...): start an actor running 'code' (a function, which
+** loses its upvalues, or a string with a chunk), with the other
+** arguments as its '...'. Return a handle of the new actor.
+*/
+static int actor_spawn (lua_State *L) {
+  Owner *o = getowner(L);
+  lua_State *L1;
+  Actor *a;
+  void *ud;
+  lua_Alloc f;
+  if (lua_type(L, 1) == LUA_TFUNCTION) {
+    luaL_Buffer b;
+    lua_pushvalue(L, 1);
+    luaL_buffinit(L, &b);
+    if (lua_dump(L, writer, &b, 0) != 0)
+      return luaL_error(L, "unable to dump given function");
+    luaL_pushresult(&b);
+    lua_replace(L, 1);
+    lua_pop(L, 1);  /* function */
+  }
+  else
+    luaL_checktype(L, 1, LUA_TSTRING);
+  L1 = luaL_newstate();
+  if (L1 == NULL)
+    return luaL_error(L, "cannot create state: not enough memory");
+  f = lua_getallocf(L1, &ud);
+  if ((a = newactor(f, ud)) == NULL) {
+    lua_close(L1);
+    return luaL_error(L, "not enough memory");
+  }
+  a->L = L1;
+  pushhandle(L, a);  /* handle collects 'a' (and 'L1') on errors */
+  release(a);  /* the handle is its only reference, for now */
+  lua_insert(L, 1);
+  a->start = packletter(L, 2, a);
+  retain(a);  /* for the thread */
+  a->hasthread = 1;
+  if (pthread_create(&a->thread, NULL, runactor, a) != 0) {
+    a->hasthread = 0;
+    release(a);
+    return luaL_error(L, "cannot create thread");
+  }
+  retain(a);  /* for the owner */
+  a->sibling = o->children;
+  o->children = a;
+  return 1;
+}
+
+
+static int auxsend (lua_State *L, Actor *a) {
+  Letter *l;
+  luaL_checkany(L, 2);
+  if (__atomic_load_n(&a->finished, __ATOMIC_SEQ_CST)) {
+    lua_pushboolean(L, 0);
+    return 1;
+  }
+  l = packletter(L, 2, a);
+  deliver(a, l);
+  lua_pushboolean(L, 1);
+  return 1;
+}
+
+
+/*
+** send(h, v1, ...): send the values to the actor with handle 'h';
+** return false if that actor no longer receives letters
+*/
+static int actor_send (lua_State *L) {
+  return auxsend(L, checkactor(L, 1));
+}
+
+
+/*
+** receive([timeout]): wait for a letter and return its values; return
+** nothing if 'timeout' seconds pass without letters
+*/
+static int actor_receive (lua_State *L) {
+  Owner *o = getowner(L);
+  Actor *a = getself(L);
+  Letter *l;
+  if (lua_isnoneornil(L, 1))
+    l = waitletter(a, NULL);
+  else {
+    lua_Number t = luaL_checknumber(L, 1);
+    if (t <= 0)
+      l = mbpop(a);
+    else {
+      struct timespec deadline;
+      lua_Number s = l_mathop(floor)(t);
+      clock_gettime(CLOCK_REALTIME, &deadline);
+      deadline.tv_sec += (time_t)s;
+      deadline.tv_nsec += (long)((t - s) * 1e9);
+      if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+      }
+      l = waitletter(a, &deadline);
+    }
+  }
+  lua_settop(L, 0);
+  if (l == NULL)
+    return 0;  /* timeout */
+  return unpackletter(L, o, l);
+}
+
+
+/* self(): handle of the running state */
+static int actor_self (lua_State *L) {
+  pushhandle(L, getself(L));
+  return 1;
+}
+
+
+/*
+** join(h): wait for the actor with handle 'h' to end; return true or
+** false plus the error that ended it
+*/
+static int actor_join (lua_State *L) {
+  Actor *a = checkactor(L, 1);
+  luaL_argcheck(L, a->hasthread, 1, "actor was not spawned");
+  luaL_argcheck(L, !pthread_equal(a->thread, pthread_self()), 1,
+                   "actor cannot join itself");
+  joinactor(a);
+  if (a->error == NULL) {
+    lua_pushboolean(L, 1);
+    return 1;
+  }
+  lua_pushboolean(L, 0);
+  lua_pushstring(L, a->error);
+  return 2;
+}
+
+
+static int handle_gc (lua_State *L) {
+  Actor **h = (Actor **)luaL_checkudata(L, 1, ACTORHANDLE);
+  if (*h != NULL) {
+    release(*h);
+    *h = NULL;
+  }
+  return 0;
+}
+
+
+static int handle_tostring (lua_State *L) {
+  lua_pushfstring(L, "actor: %p", (void *)checkactor(L, 1));
+  return 1;
+}
+
+
+static const luaL_Reg actor_funcs[] = {
+  {"spawn", actor_spawn},
+  {"send", actor_send},
+  {"receive", actor_receive},
+  {"self", actor_self},
+  {"join", actor_join},
+  {NULL, NULL}
+};
+
+
+static const luaL_Reg handle_meth[] = {
+  {"send", actor_send},
+  {"join", actor_join},
+  {"__gc", handle_gc},
+  {"__tostring", handle_tostring},
+  {"__index", NULL},  /* place holder */
+  {NULL, NULL}
+};
+
+
+static void createmeta (lua_State *L) {
+  luaL_newmetatable(L, ACTORHANDLE);
+  luaL_setfuncs(L, handle_meth, 0);
+  lua_pushvalue(L, -1);
+  lua_setfield(L, -2, "__index");  /* metatable.__index = metatable */
+  lua_pop(L, 1);
+  lua_createtable(L, 0, 0);  /* table of handles */
+  lua_createtable(L, 0, 1);
+  lua_pushliteral(L, "v");
+  lua_setfield(L, -2, "__mode");
+  lua_setmetatable(L, -2);
+  lua_rawsetp(L, LUA_REGISTRYINDEX, &HANDLES);
+}
+
+
+LUAMOD_API int luaopen_actor (lua_State *L) {
+  luaL_newlib(L, actor_funcs);
+  createmeta(L);
+  return 1;
+}
+
+/* }====================================================== */
+
+#endif
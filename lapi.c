@@ -22,6 +22,7 @@
 #include "lgc.h"
 #include "lmem.h"
 #include "lobject.h"
+#include "lopcodes.h"
 #include "lstate.h"
 #include "lstring.h"
 #include "ltable.h"
@@ -700,7 +701,7 @@ LUA_API void lua_createtable (lua_State *L, int narray, int nrec) {
   sethvalue2s(L, L->top, t);
   api_incr_top(L);
   if (narray > 0 || nrec > 0)
-    luaH_resize(L, t, narray, nrec);
+    luaH_presize(L, t, narray, nrec);
   luaC_checkGC(L);
   lua_unlock(L);
 }
@@ -783,7 +784,7 @@ LUA_API void lua_settable (lua_State *L, int idx) {
   lua_lock(L);
   api_checknelems(L, 2);
   t = index2value(L, idx);
-  if (luaV_fastget(L, t, s2v(L->top - 2), slot, luaH_get)) {
+  if (luaV_fastset(L, t, s2v(L->top - 2), slot, luaH_get)) {
     luaV_finishfastset(L, t, slot, s2v(L->top - 1));
   }
   else
@@ -805,7 +806,7 @@ LUA_API void lua_seti (lua_State *L, int idx, lua_Integer n) {
   lua_lock(L);
   api_checknelems(L, 1);
   t = index2value(L, idx);
-  if (luaV_fastgeti(L, t, n, slot)) {
+  if (luaV_fastseti(L, t, n, slot)) {
     luaV_finishfastset(L, t, slot, s2v(L->top - 1));
   }
   else {
@@ -820,15 +821,17 @@ LUA_API void lua_seti (lua_State *L, int idx, lua_Integer n) {
 
 LUA_API void lua_rawset (lua_State *L, int idx) {
   TValue *o;
-  TValue *slot;
+  TValue *key;
   lua_lock(L);
   api_checknelems(L, 2);
   o = index2value(L, idx);
   api_check(L, ttistable(o), "table expected");
-  slot = luaH_set(L, hvalue(o), s2v(L->top - 2));
-  setobj2t(L, slot, s2v(L->top - 1));
+  key = s2v(L->top - 2);
+  luaH_finishset(L, hvalue(o), key, luaH_get(hvalue(o), key),
+                 s2v(L->top - 1));
   invalidateTMcache(hvalue(o));
   luaC_barrierback(L, hvalue(o), s2v(L->top - 1));
+  luaV_chainbarrier(L, hvalue(o));
   L->top -= 2;
   lua_unlock(L);
 }
@@ -842,6 +845,7 @@ LUA_API void lua_rawseti (lua_State *L, int idx, lua_Integer n) {
   api_check(L, ttistable(o), "table expected");
   luaH_setint(L, hvalue(o), n, s2v(L->top - 1));
   luaC_barrierback(L, hvalue(o), s2v(L->top - 1));
+  luaV_chainbarrier(L, hvalue(o));
   L->top--;
   lua_unlock(L);
 }
@@ -858,6 +862,7 @@ LUA_API void lua_rawsetp (lua_State *L, int idx, const void *p) {
   slot = luaH_set(L, hvalue(o), &k);
   setobj2t(L, slot, s2v(L->top - 1));
   luaC_barrierback(L, hvalue(o), s2v(L->top - 1));
+  luaV_chainbarrier(L, hvalue(o));
   L->top--;
   lua_unlock(L);
 }
@@ -877,6 +882,7 @@ LUA_API int lua_setmetatable (lua_State *L, int objindex) {
   }
   switch (ttnov(obj)) {
     case LUA_TTABLE: {
+      luaV_chainbarrier(L, hvalue(obj));
       hvalue(obj)->metatable = mt;
       if (mt) {
         luaC_objbarrier(L, gcvalue(obj), mt);
@@ -1008,6 +1014,20 @@ LUA_API int lua_pcallk (lua_State *L, int nargs, int nresults, int errfunc,
 }
 
 
+/*
+** set global table as 1st upvalue of main function 'f' (may be LUA_ENV)
+*/
+static void setglobalenv (lua_State *L, LClosure *f) {
+  if (f->nupvalues >= 1) {  /* does it have an upvalue? */
+    /* get global table from registry */
+    Table *reg = hvalue(&G(L)->l_registry);
+    const TValue *gt = luaH_getint(reg, LUA_RIDX_GLOBALS);
+    setobj(L, f->upvals[0]->v, gt);
+    luaC_barrier(L, f->upvals[0], gt);
+  }
+}
+
+
 LUA_API int lua_load (lua_State *L, lua_Reader reader, void *data,
                       const char *chunkname, const char *mode) {
   ZIO z;
@@ -1016,17 +1036,8 @@ LUA_API int lua_load (lua_State *L, lua_Reader reader, void *data,
   if (!chunkname) chunkname = "?";
   luaZ_init(L, &z, reader, data);
   status = luaD_protectedparser(L, &z, chunkname, mode);
-  if (status == LUA_OK) {  /* no errors? */
-    LClosure *f = clLvalue(s2v(L->top - 1));  /* get newly created function */
-    if (f->nupvalues >= 1) {  /* does it have an upvalue? */
-      /* get global table from registry */
-      Table *reg = hvalue(&G(L)->l_registry);
-      const TValue *gt = luaH_getint(reg, LUA_RIDX_GLOBALS);
-      /* set global table as 1st upvalue of 'f' (may be LUA_ENV) */
-      setobj(L, f->upvals[0]->v, gt);
-      luaC_barrier(L, f->upvals[0], gt);
-    }
-  }
+  if (status == LUA_OK)  /* no errors? */
+    setglobalenv(L, clLvalue(s2v(L->top - 1)));  /* newly created function */
   lua_unlock(L);
   return status;
 }
@@ -1047,6 +1058,46 @@ LUA_API int lua_dump (lua_State *L, lua_Writer writer, void *data, int strip) {
 }
 
 
+/*
+** Create a shared chunk from the Lua function on the top of the stack
+** (see 'luaF_sharechunk')
+*/
+LUA_API lua_SharedChunk *lua_sharechunk (lua_State *L, lua_Alloc f, void *ud) {
+  lua_SharedChunk *c;
+  TValue *o;
+  lua_lock(L);
+  api_checknelems(L, 1);
+  o = s2v(L->top - 1);
+  api_check(L, isLfunction(o), "Lua function expected");
+  c = luaF_sharechunk(L, getproto(o), f, ud);
+  lua_unlock(L);
+  return c;
+}
+
+
+/*
+** Push a new main function for shared chunk 'c', as 'lua_load' would
+** for the chunk source
+*/
+LUA_API void lua_loadchunk (lua_State *L, lua_SharedChunk *c) {
+  LClosure *cl;
+  lua_lock(L);
+  cl = luaF_newLclosure(L, c->main->sizeupvalues);
+  setclLvalue2s(L, L->top, cl);
+  api_incr_top(L);
+  cl->p = luaF_newproto(L);
+  luaF_loadshared(L, cl->p, c->main, NULL);
+  luaF_initupvals(L, cl);
+  setglobalenv(L, cl);
+  lua_unlock(L);
+}
+
+
+LUA_API void lua_releasechunk (lua_SharedChunk *c) {
+  luaF_releasechunk(c);
+}
+
+
 LUA_API int lua_status (lua_State *L) {
   return L->status;
 }
@@ -1142,6 +1193,41 @@ LUA_API int lua_gc (lua_State *L, int what, ...) {
       luaC_changemode(L, KGC_INC);
       break;
     }
+    case LUA_GCPARALLEL: {
+      int n = va_arg(argp, int);
+      res = luaC_parallel(L, n);
+      break;
+    }
+    case LUA_GCPACE: {
+      int steptime = va_arg(argp, int);
+      int growth = va_arg(argp, int);
+      res = g->pacer.steptime;
+      if (growth != 0)
+        g->pacer.growth = growth;
+      if (steptime >= 0)
+        g->pacer.steptime = steptime;
+      g->pacer.goal = 0;  /* recompute it */
+      break;
+    }
+    case LUA_GCARENA: {
+      int on = va_arg(argp, int);
+      res = g->gcarena;
+      if (on >= 0)
+        g->gcarena = (on != 0);
+      if (g->gcarena)
+        luaC_bgsweep(L, 0);  /* (arena allocators need not be thread safe) */
+      break;
+    }
+    case LUA_GCSTATS: {
+      lua_GCStats *s = va_arg(argp, lua_GCStats *);
+      *s = g->gcstats;
+      break;
+    }
+    case LUA_GCBGSWEEP: {
+      int on = va_arg(argp, int);
+      res = luaC_bgsweep(L, on);
+      break;
+    }
     default: res = -1;  /* invalid option */
   }
   va_end(argp);
@@ -1337,3 +1423,50 @@ LUA_API void lua_upvaluejoin (lua_State *L, int fidx1, int n1,
 }
 
 
+/*
+** {======================================================
+** Opcode statistics (see LUA_USE_OPSTATS)
+** =======================================================
+*/
+
+LUA_API const char *lua_opname (lua_State *L, int op) {
+  UNUSED(L);
+  return (0 <= op && op < NUM_OPCODES) ? luaP_opnames[op] : NULL;
+}
+
+
+/*
+** Get in '*n' how many times opcode 'op' was executed (if 'next' is
+** negative) or how many times 'next' was executed right after 'op'.
+** Returns 0 if these counts are not available.
+*/
+LUA_API int lua_opcount (lua_State *L, int op, int next, lua_Unsigned *n) {
+#if defined(LUA_USE_OPSTATS)
+  int res = 0;
+  lua_lock(L);
+  if (0 <= op && op < NUM_OPCODES && next < NUM_OPCODES) {
+    OpStats *os = &G(L)->opstats;
+    *n = cast(lua_Unsigned, (next < 0) ? os->count[op] : os->pair[op][next]);
+    res = 1;
+  }
+  lua_unlock(L);
+  return res;
+#else
+  UNUSED(L); UNUSED(op); UNUSED(next); UNUSED(n);
+  return 0;
+#endif
+}
+
+
+LUA_API void lua_resetopcounts (lua_State *L) {
+#if defined(LUA_USE_OPSTATS)
+  lua_lock(L);
+  luaE_resetopstats(G(L));
+  lua_unlock(L);
+#else
+  UNUSED(L);
+#endif
+}
+
+/* }====================================================== */
+
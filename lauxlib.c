@@ -1030,6 +1030,235 @@ LUALIB_API lua_State *luaL_newstate (void) {
 }
 
 
+/*
+** Creates a copy of state 'L' (see 'lua_clonestate') using the
+** standard allocator
+*/
+LUALIB_API lua_State *luaL_clonestate (lua_State *L) {
+  return lua_clonestate(L, l_alloc, NULL);
+}
+
+
+/*
+** Creates a shared chunk (see 'lua_sharechunk') from the function on
+** the top of the stack using the standard allocator
+*/
+LUALIB_API lua_SharedChunk *luaL_sharechunk (lua_State *L) {
+  return lua_sharechunk(L, l_alloc, NULL);
+}
+
+
+/*
+** {======================================================
+** Slab allocator
+** =======================================================
+*/
+
+/* granularity (and alignment) of small blocks */
+#define SLABGRAIN	16
+
+/* larger blocks go to 'realloc'/'free' */
+#define SLABMAX		256
+
+/* size of each chunk carved into small blocks */
+#define SLABCHUNK	(64 * 1024)
+
+#define NSLABCLASSES	(SLABMAX / SLABGRAIN)
+
+/* class of a small block with 'sz' bytes ('sz' > 0) */
+#define slabclass(sz)	(((sz) - 1) / SLABGRAIN)
+
+
+/*
+** Large blocks have a header linking them in a list of their arena,
+** so that they can be released in bulk.
+*/
+typedef union LargeBlock {
+  struct {
+    union LargeBlock *next;
+    union LargeBlock *previous;
+  } l;
+  char align[SLABGRAIN];  /* keep the block itself aligned */
+} LargeBlock;
+
+
+/*
+** Each state created by 'luaL_newslabstate' has its own arena, so the
+** allocator needs no locks. Small blocks are kept in free lists by
+** size class; as Lua always gives the size of the blocks it frees or
+** reallocates, they need no headers. Memory of small blocks goes back
+** to the system only when the state is closed: freeing the state's
+** main block (its first allocation) releases the whole arena. The
+** state knows that (see LUA_GCARENA), so 'lua_close' does not free
+** each object.
+*/
+typedef struct SlabArena {
+  void *freeblocks[NSLABCLASSES];  /* free blocks of each class */
+  char *top;  /* free space in current chunk */
+  char *limit;  /* end of current chunk */
+  void *chunks;  /* list of all chunks */
+  LargeBlock large;  /* head of (circular) list of large blocks */
+  void *main;  /* main block of the state */
+  int live;  /* true after the state was built */
+} SlabArena;
+
+
+static void *slabget (SlabArena *a, size_t size) {
+  int c = slabclass(size);
+  void *block = a->freeblocks[c];
+  if (block != NULL)  /* is there a free block of that class? */
+    a->freeblocks[c] = *(void **)block;  /* remove it from the list */
+  else {  /* get a new block from current chunk */
+    size = (c + 1) * SLABGRAIN;
+    if ((size_t)(a->limit - a->top) < size) {  /* no space left? */
+      char *chunk = (char *)malloc(SLABCHUNK);
+      if (chunk == NULL)
+        return NULL;
+      *(void **)chunk = a->chunks;  /* link new chunk */
+      a->chunks = chunk;
+      a->top = chunk + SLABGRAIN;  /* keep blocks aligned */
+      a->limit = chunk + SLABCHUNK;
+    }
+    block = a->top;
+    a->top += size;
+  }
+  return block;
+}
+
+
+static void slabput (SlabArena *a, void *block, size_t size) {
+  int c = slabclass(size);
+  *(void **)block = a->freeblocks[c];
+  a->freeblocks[c] = block;
+}
+
+
+static void linklarge (SlabArena *a, LargeBlock *lb) {
+  lb->l.next = a->large.l.next;
+  lb->l.previous = &a->large;
+  lb->l.next->l.previous = lb;
+  a->large.l.next = lb;
+}
+
+
+static void unlinklarge (LargeBlock *lb) {
+  lb->l.previous->l.next = lb->l.next;
+  lb->l.next->l.previous = lb->l.previous;
+}
+
+
+/*
+** (Re)allocate a large block; 'ptr' may be NULL. The first large
+** block ever allocated is the main block of the state.
+*/
+static void *largerealloc (SlabArena *a, void *ptr, size_t nsize) {
+  LargeBlock *lb = (ptr != NULL) ? (LargeBlock *)ptr - 1 : NULL;
+  LargeBlock *newlb;
+  if (lb != NULL)
+    unlinklarge(lb);
+  newlb = (LargeBlock *)realloc(lb, sizeof(LargeBlock) + nsize);
+  if (newlb == NULL) {  /* failed? */
+    if (lb != NULL)
+      linklarge(a, lb);  /* old block is still valid */
+    return NULL;
+  }
+  linklarge(a, newlb);
+  if (a->main == NULL)
+    a->main = newlb + 1;
+  return newlb + 1;
+}
+
+
+static void largefree (void *ptr) {
+  LargeBlock *lb = (LargeBlock *)ptr - 1;
+  unlinklarge(lb);
+  free(lb);
+}
+
+
+static void slabdestroy (SlabArena *a) {
+  void *chunk = a->chunks;
+  LargeBlock *lb = a->large.l.next;
+  while (chunk != NULL) {
+    void *next = *(void **)chunk;
+    free(chunk);
+    chunk = next;
+  }
+  while (lb != &a->large) {
+    LargeBlock *next = lb->l.next;
+    free(lb);
+    lb = next;
+  }
+  free(a);
+}
+
+
+static void *slab_alloc (void *ud, void *ptr, size_t osize, size_t nsize) {
+  SlabArena *a = (SlabArena *)ud;
+  void *newblock;
+  if (ptr == NULL)
+    osize = 0;  /* 'osize' is the kind of the new object */
+  if (nsize == 0) {  /* free block */
+    if (ptr == a->main && a->live)  /* closing the state? */
+      slabdestroy(a);  /* release everything */
+    else if (osize > SLABMAX)
+      largefree(ptr);
+    else if (ptr != NULL)
+      slabput(a, ptr, osize);
+    return NULL;
+  }
+  else if (osize > SLABMAX && nsize > SLABMAX)  /* both large? */
+    newblock = largerealloc(a, ptr, nsize);
+  else if (osize > 0 && nsize <= SLABMAX &&
+           slabclass(osize) == slabclass(nsize))  /* same small class? */
+    newblock = ptr;
+  else {  /* move block to a different class */
+    newblock = (nsize <= SLABMAX) ? slabget(a, nsize)
+                                  : largerealloc(a, NULL, nsize);
+    if (newblock != NULL && ptr != NULL) {
+      memcpy(newblock, ptr, (osize < nsize) ? osize : nsize);
+      if (osize > SLABMAX)
+        largefree(ptr);
+      else
+        slabput(a, ptr, osize);
+    }
+  }
+  return newblock;
+}
+
+
+/*
+** Create a state that allocates memory with a slab allocator, in
+** arena mode. The allocator is not thread safe, so the state cannot
+** use background sweeping (see 'collectgarbage').
+*/
+LUALIB_API lua_State *luaL_newslabstate (void) {
+  SlabArena *a = (SlabArena *)malloc(sizeof(SlabArena));
+  lua_State *L;
+  int i;
+  if (a == NULL)
+    return NULL;
+  for (i = 0; i < NSLABCLASSES; i++)
+    a->freeblocks[i] = NULL;
+  a->top = a->limit = NULL;
+  a->chunks = NULL;
+  a->large.l.next = a->large.l.previous = &a->large;
+  a->main = NULL;
+  a->live = 0;
+  L = lua_newstate(slab_alloc, a);
+  if (L == NULL) {  /* state could not be built? */
+    slabdestroy(a);
+    return NULL;
+  }
+  a->live = 1;
+  lua_gc(L, LUA_GCARENA, 1);  /* closing frees memory in bulk */
+  lua_atpanic(L, &panic);
+  return L;
+}
+
+/* }====================================================== */
+
+
 LUALIB_API void luaL_checkversion_ (lua_State *L, lua_Number ver, size_t sz) {
   const lua_Number *v = lua_version(L);
   if (sz != LUAL_NUMSIZES)  /* check numeric types */
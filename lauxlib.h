@@ -94,6 +94,9 @@ LUALIB_API int (luaL_loadbufferx) (lua_State *L, const char *buff, size_t sz,
 LUALIB_API int (luaL_loadstring) (lua_State *L, const char *s);
 
 LUALIB_API lua_State *(luaL_newstate) (void);
+LUALIB_API lua_State *(luaL_newslabstate) (void);
+LUALIB_API lua_State *(luaL_clonestate) (lua_State *L);
+LUALIB_API lua_SharedChunk *(luaL_sharechunk) (lua_State *L);
 
 LUALIB_API lua_Integer (luaL_len) (lua_State *L, int idx);
 
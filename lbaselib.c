@@ -170,13 +170,48 @@ static int luaB_rawset (lua_State *L) {
 }
 
 
+static void setphasetimes (lua_State *L, const lua_Unsigned *t) {
+  static const char *const phases[LUA_GCNPHASES] = {"propagate", "atomic",
+    "sweep", "finalize"};
+  int i;
+  for (i = 0; i < LUA_GCNPHASES; i++) {
+    lua_pushnumber(L, (lua_Number)t[i] / 1e6);  /* in seconds */
+    lua_setfield(L, -2, phases[i]);
+  }
+}
+
+
+/*
+** Push a table with the statistics of the collector; times of each
+** phase are in seconds, totals in the table itself and those of the
+** last cycle (or generational collection) in field 'last'.
+*/
+static void pushgcstats (lua_State *L, const lua_GCStats *s) {
+  lua_createtable(L, 0, 5 + LUA_GCNPHASES);
+  lua_pushinteger(L, (lua_Integer)s->cycles);
+  lua_setfield(L, -2, "cycles");
+  lua_pushinteger(L, (lua_Integer)s->minor);
+  lua_setfield(L, -2, "minor");
+  lua_pushinteger(L, (lua_Integer)s->major);
+  lua_setfield(L, -2, "major");
+  lua_pushinteger(L, (lua_Integer)s->promoted);
+  lua_setfield(L, -2, "promoted");
+  setphasetimes(L, s->time);
+  lua_createtable(L, 0, LUA_GCNPHASES);
+  setphasetimes(L, s->lasttime);
+  lua_setfield(L, -2, "last");
+}
+
+
 static int luaB_collectgarbage (lua_State *L) {
   static const char *const opts[] = {"stop", "restart", "collect",
     "count", "step", "setpause", "setstepmul",
-    "isrunning", "generational", "incremental", NULL};
+    "isrunning", "generational", "incremental", "parallel",
+    "bgsweep", "pace", "stats", NULL};
   static const int optsnum[] = {LUA_GCSTOP, LUA_GCRESTART, LUA_GCCOLLECT,
     LUA_GCCOUNT, LUA_GCSTEP, LUA_GCSETPAUSE, LUA_GCSETSTEPMUL,
-    LUA_GCISRUNNING, LUA_GCGEN, LUA_GCINC};
+    LUA_GCISRUNNING, LUA_GCGEN, LUA_GCINC, LUA_GCPARALLEL,
+    LUA_GCBGSWEEP, LUA_GCPACE, LUA_GCSTATS};
   int o = optsnum[luaL_checkoption(L, 1, "collect", opts)];
   switch (o) {
     case LUA_GCCOUNT: {
@@ -191,6 +226,31 @@ static int luaB_collectgarbage (lua_State *L) {
       lua_pushboolean(L, res);
       return 1;
     }
+    case LUA_GCPARALLEL: {
+      int n = (int)luaL_optinteger(L, 2, -1);
+      int previous = lua_gc(L, o, n);
+      lua_pushinteger(L, previous);
+      return 1;
+    }
+    case LUA_GCPACE: {
+      int steptime = (int)luaL_optinteger(L, 2, -1);
+      int growth = (int)luaL_optinteger(L, 3, 0);
+      int previous = lua_gc(L, o, steptime, growth);
+      lua_pushinteger(L, previous);
+      return 1;
+    }
+    case LUA_GCSTATS: {
+      lua_GCStats s;
+      lua_gc(L, o, &s);
+      pushgcstats(L, &s);
+      return 1;
+    }
+    case LUA_GCBGSWEEP: {  /* scripts can only query it or turn it off */
+      int on = lua_isnoneornil(L, 2) ? -1 : lua_toboolean(L, 2);
+      luaL_argcheck(L, on <= 0, 2, "only the host can start the sweeper");
+      lua_pushboolean(L, lua_gc(L, o, on));
+      return 1;
+    }
     case LUA_GCSETPAUSE:
     case LUA_GCSETSTEPMUL: {
       int p = (int)luaL_optinteger(L, 2, 0);
@@ -0,0 +1,477 @@
+/*
+** $Id: lclone.c $
+** Clone a Lua state
+** See Copyright Notice in lua.h
+*/
+
+#define lclone_c
+#define LUA_CORE
+
+#include "lprefix.h"
+
+
+#include <string.h>
+
+#include "lua.h"
+
+#include "lapi.h"
+#include "ldo.h"
+#include "lfunc.h"
+#include "lgc.h"
+#include "lmem.h"
+#include "lobject.h"
+#include "lopcodes.h"
+#include "lstate.h"
+#include "lstring.h"
+#include "ltable.h"
+
+
+/*
+** A clone is built by copying every object reachable from the registry
+** and from the metatables of basic types of the original state. Each
+** copied object is first created empty and recorded in a map (from
+** original objects to their copies), so that sharing and cycles are
+** preserved; its contents are filled later, from a list of pending
+** objects, so that deep structures do not use the C stack.
+**
+** The new state does not run its collector while being built (its
+** map and pending list are not visible to the collector). The
+** original state is only read.
+*/
+
+
+typedef struct CloneEntry {
+  GCObject *from;  /* object in the original state (NULL for empty slots) */
+  GCObject *to;  /* its copy in the new state */
+} CloneEntry;
+
+
+typedef struct CloneState {
+  lua_State *L;  /* new state */
+  lua_State *from;  /* main thread of the original state */
+  CloneEntry *map;
+  int sizemap;  /* size of 'map' (a power of 2) */
+  int nmap;  /* number of entries in 'map' */
+  GCObject **pending;  /* copied objects still to be filled */
+  int sizepending;
+  int npending;
+} CloneState;
+
+
+static l_noret error (CloneState *C, const char *what) {
+  luaO_pushfstring(C->L, "cannot clone %s", what);
+  luaD_throw(C->L, LUA_ERRRUN);
+}
+
+
+#define hashobj(C,o)  \
+	((point2uint(o) >> 3) * 2654435769u & cast(unsigned int, C->sizemap - 1))
+
+
+static CloneEntry *findentry (CloneState *C, GCObject *o) {
+  unsigned int i = hashobj(C, o);
+  while (C->map[i].from != NULL && C->map[i].from != o)
+    i = (i + 1) & cast(unsigned int, C->sizemap - 1);
+  return &C->map[i];
+}
+
+
+/*
+** Double the size of the map (which is kept at most half full)
+*/
+static void growmap (CloneState *C) {
+  CloneEntry *old = C->map;
+  int oldsize = C->sizemap;
+  int i;
+  C->map = luaM_newvector(C->L, oldsize * 2, CloneEntry);
+  C->sizemap = oldsize * 2;
+  for (i = 0; i < C->sizemap; i++)
+    C->map[i].from = NULL;
+  for (i = 0; i < oldsize; i++) {
+    if (old[i].from != NULL)
+      *findentry(C, old[i].from) = old[i];
+  }
+  luaM_freearray(C->L, old, oldsize);
+}
+
+
+/*
+** Record that 'to' is the copy of 'from' and, if it has contents,
+** put it in the list of pending objects.
+*/
+static GCObject *newentry (CloneState *C, GCObject *from, GCObject *to,
+                                          int fill) {
+  CloneEntry *e;
+  if (2 * (C->nmap + 1) > C->sizemap)
+    growmap(C);
+  e = findentry(C, from);
+  e->from = from;
+  e->to = to;
+  C->nmap++;
+  if (fill) {
+    luaM_growvector(C->L, C->pending, C->npending, C->sizepending,
+                    GCObject *, MAX_INT, "objects");
+    C->pending[C->npending++] = from;
+  }
+  return to;
+}
+
+
+static GCObject *copyobj (CloneState *C, GCObject *o);
+
+
+static void copyvalue (CloneState *C, TValue *to, const TValue *from) {
+  if (iscollectable(from)) {
+    GCObject *o = copyobj(C, gcvalue(from));
+    setgcovalue(C->L, to, o);
+  }
+  else
+    setobj(C->L, to, from);
+}
+
+
+/*
+** Copies of objects of known types. (The result of 'copyobj' goes
+** through a variable because the 'gco2*' macros may evaluate their
+** arguments more than once.)
+*/
+static TString *copystring (CloneState *C, TString *ts) {
+  GCObject *o = (ts == NULL) ? NULL : copyobj(C, obj2gco(ts));
+  return (o == NULL) ? NULL : gco2ts(o);
+}
+
+
+static Table *copymetatable (CloneState *C, Table *mt) {
+  GCObject *o = (mt == NULL) ? NULL : copyobj(C, obj2gco(mt));
+  return (o == NULL) ? NULL : gco2t(o);
+}
+
+
+static Proto *copyproto (CloneState *C, Proto *f) {
+  GCObject *o = copyobj(C, obj2gco(f));
+  return gco2p(o);
+}
+
+
+/*
+** Create an (empty) copy of object 'o', unless it was already copied
+*/
+static GCObject *copyobj (CloneState *C, GCObject *o) {
+  lua_State *L = C->L;
+  CloneEntry *e = findentry(C, o);
+  if (e->from != NULL)  /* already copied? */
+    return e->to;
+  switch (o->tt) {
+    case LUA_TSHRSTR: {
+      TString *ts = gco2ts(o);
+      return newentry(C, o, obj2gco(luaS_newlstr(L, getstr(ts), ts->shrlen)),
+                            0);
+    }
+    case LUA_TLNGSTR: {
+      TString *ts = gco2ts(o);
+      TString *nts = luaS_createlngstrobj(L, ts->u.lnglen);
+      memcpy(getstr(nts), getstr(ts), ts->u.lnglen * sizeof(char));
+      return newentry(C, o, obj2gco(nts), 0);
+    }
+    case LUA_TTABLE:
+      return newentry(C, o, obj2gco(luaH_new(L)), 1);
+    case LUA_TLCL:
+      return newentry(C, o, obj2gco(luaF_newLclosure(L, gco2lcl(o)->nupvalues)),
+                            1);
+    case LUA_TCCL: {
+      CClosure *cl = gco2ccl(o);
+      CClosure *ncl = luaF_newCclosure(L, cl->nupvalues);
+      int i;
+      ncl->f = cl->f;
+      for (i = 0; i < cl->nupvalues; i++)
+        setnilvalue(&ncl->upvalue[i]);
+      return newentry(C, o, obj2gco(ncl), 1);
+    }
+    case LUA_TUSERDATA: {
+      Udata *u = gco2u(o);
+      Udata *nu = luaS_newudata(L, u->len);
+      memcpy(getudatamem(nu), getudatamem(u), u->len);
+      return newentry(C, o, obj2gco(nu), 1);
+    }
+    case LUA_TUPVAL: {
+      GCObject *no;
+      if (upisopen(gco2upv(o)))
+        error(C, "a running function");
+      no = luaC_newobj(L, LUA_TUPVAL, sizeof(UpVal));
+      gco2upv(no)->v = &gco2upv(no)->u.value;  /* make it closed */
+      setnilvalue(gco2upv(no)->v);
+      return newentry(C, o, no, 1);
+    }
+    case LUA_TPROTO:
+      return newentry(C, o, obj2gco(luaF_newproto(L)), 1);
+    case LUA_TTHREAD:  /* main thread was already mapped */
+      error(C, "a coroutine");
+    default: lua_assert(0); return NULL;
+  }
+}
+
+
+static void filltable (CloneState *C, Table *t, Table *nt) {
+  lua_State *L = C->L;
+  unsigned int i;
+  unsigned int nhash = 0;
+  unsigned int ntyped = istyped(t) ? tarray(t)->len : 0;
+  int nsize = cast_int(allocsizenode(t));
+  TValue k, v;
+  int j;
+  for (j = 0; j < nsize; j++) {
+    if (!ttisnil(gval(gnode(t, j))))
+      nhash++;
+  }
+  if (t->fields != NULL)
+    nhash += t->fields->shape->nkeys;
+  luaH_presize(L, nt, t->sizearray + ntyped, nhash);
+  nt->metatable = copymetatable(C, t->metatable);
+  if (t->fields != NULL) {  /* copy shape part keeping the order of keys */
+    Fields *fs = t->fields;
+    for (j = 0; j < fs->shape->nkeys; j++) {
+      if (!ttisnil(&fs->v[j])) {
+        setsvalue(L, &k, copystring(C, fs->shape->keys[j]));
+        copyvalue(C, &v, &fs->v[j]);
+        setobj2t(L, luaH_set(L, nt, &k), &v);
+      }
+    }
+  }
+  for (i = 0; i < ntyped; i++) {  /* typed array has only numbers */
+    gettyped(&v, tarray(t), i);
+    luaH_setint(L, nt, i + 1, &v);
+  }
+  for (i = 0; i < t->sizearray; i++) {
+    if (!ttisnil(&t->array[i])) {
+      copyvalue(C, &v, &t->array[i]);
+      luaH_setint(L, nt, i + 1, &v);
+    }
+  }
+  for (j = 0; j < nsize; j++) {
+    Node *n = gnode(t, j);
+    if (!ttisnil(gval(n))) {
+      getnodekey(cast(lua_State *, NULL), &k, n);  /* key of the original */
+      copyvalue(C, &k, &k);
+      copyvalue(C, &v, gval(n));
+      setobj2t(L, luaH_set(L, nt, &k), &v);
+    }
+  }
+  invalidateTMcache(nt);
+}
+
+
+static void fillproto (CloneState *C, Proto *f, Proto *nf) {
+  lua_State *L = C->L;
+  int i;
+  nf->source = copystring(C, f->source);
+  nf->linedefined = f->linedefined;
+  nf->lastlinedefined = f->lastlinedefined;
+  nf->numparams = f->numparams;
+  nf->is_vararg = f->is_vararg;
+  nf->maxstacksize = f->maxstacksize;
+  if (f->shared != NULL)  /* code and line information are shared? */
+    luaF_linkshared(nf, f->shared);
+  else {
+    nf->code = luaM_newvectorchecked(L, f->sizecode, Instruction);
+    nf->sizecode = f->sizecode;
+    for (i = 0; i < f->sizecode; i++) {  /* undo specializations */
+      Instruction inst = f->code[i];
+      if (isspecialized(GET_OPCODE(inst)))
+        SET_OPCODE(inst, GET_BASEOP(inst));
+      nf->code[i] = inst;
+    }
+    luaF_initcaches(L, nf);
+  }
+  nf->k = luaM_newvectorchecked(L, f->sizek, TValue);
+  nf->sizek = f->sizek;
+  for (i = 0; i < f->sizek; i++)
+    setnilvalue(&nf->k[i]);
+  for (i = 0; i < f->sizek; i++)
+    copyvalue(C, &nf->k[i], &f->k[i]);
+  nf->upvalues = luaM_newvectorchecked(L, f->sizeupvalues, Upvaldesc);
+  nf->sizeupvalues = f->sizeupvalues;
+  for (i = 0; i < f->sizeupvalues; i++) {
+    nf->upvalues[i] = f->upvalues[i];
+    nf->upvalues[i].name = NULL;
+  }
+  for (i = 0; i < f->sizeupvalues; i++)
+    nf->upvalues[i].name = copystring(C, f->upvalues[i].name);
+  nf->p = luaM_newvectorchecked(L, f->sizep, Proto *);
+  nf->sizep = f->sizep;
+  for (i = 0; i < f->sizep; i++)
+    nf->p[i] = NULL;
+  for (i = 0; i < f->sizep; i++)
+    nf->p[i] = copyproto(C, f->p[i]);
+  if (f->shared == NULL) {
+    nf->lineinfo = luaM_newvectorchecked(L, f->sizelineinfo, ls_byte);
+    nf->sizelineinfo = f->sizelineinfo;
+    memcpy(nf->lineinfo, f->lineinfo, f->sizelineinfo * sizeof(ls_byte));
+    nf->abslineinfo = luaM_newvectorchecked(L, f->sizeabslineinfo,
+                                            AbsLineInfo);
+    nf->sizeabslineinfo = f->sizeabslineinfo;
+    memcpy(nf->abslineinfo, f->abslineinfo,
+           f->sizeabslineinfo * sizeof(AbsLineInfo));
+  }
+  nf->locvars = luaM_newvectorchecked(L, f->sizelocvars, LocVar);
+  nf->sizelocvars = f->sizelocvars;
+  for (i = 0; i < f->sizelocvars; i++) {
+    nf->locvars[i] = f->locvars[i];
+    nf->locvars[i].varname = NULL;
+  }
+  for (i = 0; i < f->sizelocvars; i++)
+    nf->locvars[i].varname = copystring(C, f->locvars[i].varname);
+}
+
+
+/*
+** Fill the contents of the copy 'no' of object 'o'
+*/
+static void fillobj (CloneState *C, GCObject *o, GCObject *no) {
+  int i;
+  switch (o->tt) {
+    case LUA_TTABLE:
+      filltable(C, gco2t(o), gco2t(no));
+      break;
+    case LUA_TLCL: {
+      LClosure *cl = gco2lcl(o);
+      LClosure *ncl = gco2lcl(no);
+      ncl->p = copyproto(C, cl->p);
+      for (i = 0; i < cl->nupvalues; i++) {
+        if (cl->upvals[i] != NULL) {
+          GCObject *uv = copyobj(C, obj2gco(cl->upvals[i]));
+          ncl->upvals[i] = gco2upv(uv);
+        }
+      }
+      break;
+    }
+    case LUA_TCCL: {
+      CClosure *cl = gco2ccl(o);
+      for (i = 0; i < cl->nupvalues; i++)
+        copyvalue(C, &gco2ccl(no)->upvalue[i], &cl->upvalue[i]);
+      break;
+    }
+    case LUA_TUSERDATA: {
+      TValue uv;
+      getuservalue(C->L, gco2u(o), &uv);
+      copyvalue(C, &uv, &uv);
+      setuservalue(C->L, gco2u(no), &uv);
+      gco2u(no)->metatable = copymetatable(C, gco2u(o)->metatable);
+      break;
+    }
+    case LUA_TUPVAL:
+      copyvalue(C, gco2upv(no)->v, gco2upv(o)->v);
+      break;
+    case LUA_TPROTO:
+      fillproto(C, gco2p(o), gco2p(no));
+      break;
+    default: lua_assert(0);
+  }
+}
+
+
+/*
+** Tables with finalizers in the original state get finalizers in the
+** clone, too. Userdata do not: their copies share any external resource
+** (a file, for instance) with the originals, which keep the job of
+** releasing it. (This is done after all objects are filled, as it
+** needs complete metatables.)
+*/
+static void checkfinalizers (CloneState *C) {
+  int i;
+  for (i = 0; i < C->sizemap; i++) {
+    GCObject *o = C->map[i].from;
+    if (o != NULL && o->tt == LUA_TTABLE && tofinalize(o)) {
+      Table *nt = gco2t(C->map[i].to);
+      luaC_checkfinalizer(C->L, obj2gco(nt), nt->metatable);
+    }
+  }
+}
+
+
+static void f_clone (lua_State *L, void *ud) {
+  CloneState *C = cast(CloneState *, ud);
+  global_State *og = G(C->from);
+  global_State *g = G(L);
+  TValue reg;
+  int i;
+  C->map = luaM_newvector(L, 64, CloneEntry);
+  C->sizemap = 64;
+  for (i = 0; i < C->sizemap; i++)
+    C->map[i].from = NULL;
+  newentry(C, obj2gco(og->mainthread), obj2gco(g->mainthread), 0);
+  copyvalue(C, &reg, &og->l_registry);
+  for (i = 0; i < LUA_NUMTAGS; i++)
+    g->mt[i] = copymetatable(C, og->mt[i]);
+  while (C->npending > 0) {
+    GCObject *o = C->pending[--C->npending];
+    fillobj(C, o, findentry(C, o)->to);
+  }
+  sethvalue(L, &g->l_registry, hvalue(&reg));
+  checkfinalizers(C);
+}
+
+
+/*
+** Create a new state, with allocator 'f' and user data 'ud', that is
+** a copy of state 'L': same registry (and therefore same globals and
+** loaded modules), same metatables for basic types, and same collector
+** parameters. 'L' should not be running Lua code and should not have
+** coroutines reachable from its registry. Full userdata are copied
+** byte by byte, so any external resource they refer to is shared by
+** both states; their copies are never finalized (their '__gc' is not
+** called), so only 'L' releases those resources, which must outlive
+** the clone. In case of errors, returns NULL and pushes an error
+** message on 'L'.
+*/
+LUA_API lua_State *lua_clonestate (lua_State *L, lua_Alloc f, void *ud) {
+  CloneState C;
+  global_State *g;
+  lua_State *L1 = lua_newstate(f, ud);
+  int status;
+  lua_lock(L);
+  if (L1 == NULL) {
+    setsvalue2s(L, L->top, luaS_newliteral(L, MEMERRMSG));
+    api_incr_top(L);
+    lua_unlock(L);
+    return NULL;
+  }
+  g = G(L1);
+  C.L = L1;
+  C.from = G(L)->mainthread;
+  C.map = NULL; C.sizemap = C.nmap = 0;
+  C.pending = NULL; C.sizepending = C.npending = 0;
+  g->version = NULL;  /* no emergency collections while copying */
+  g->gcrunning = 0;
+  status = luaD_rawrunprotected(L1, f_clone, &C);
+  luaM_freearray(L1, C.map, C.sizemap);
+  luaM_freearray(L1, C.pending, C.sizepending);
+  g->version = lua_version(NULL);
+  g->gcrunning = 1;
+  if (status != LUA_OK) {
+    TString *msg;
+    if (status == LUA_ERRMEM)
+      msg = luaS_newliteral(L, MEMERRMSG);
+    else  /* error message is on the top of the new state */
+      msg = luaS_new(L, svalue(s2v(L1->top - 1)));
+    setsvalue2s(L, L->top, msg);
+    api_incr_top(L);
+    lua_close(L1);
+    L1 = NULL;
+  }
+  else {
+    global_State *og = G(L);
+    g->panic = og->panic;
+    g->gcpause = og->gcpause;
+    g->gcstepmul = og->gcstepmul;
+    g->gcstepsize = og->gcstepsize;
+    g->genminormul = og->genminormul;
+    g->genmajormul = og->genmajormul;
+    g->pacer.steptime = og->pacer.steptime;
+    g->pacer.growth = og->pacer.growth;
+    if (og->gckind == KGC_GEN)
+      luaC_changemode(L1, KGC_GEN);
+  }
+  lua_unlock(L);
+  return L1;
+}
+
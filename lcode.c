@@ -1613,16 +1613,52 @@ static int finaltarget (Instruction *code, int i) {
 }
 
 
+/*
+** Superinstruction for an instruction with opcode 'op' followed by one
+** with opcode 'next', or 'op' itself if there is none. (These are the
+** most frequent pairs in opcode-pair histograms of typical programs,
+** after the comparisons followed by jumps, which the interpreter already
+** executes together.)
+*/
+static OpCode fusedop (OpCode op, OpCode next) {
+  switch (op) {
+    case OP_MOVE:
+      return (next == OP_CALL) ? OP_MOVECALL : op;
+    case OP_SELF:
+      return (next == OP_CALL) ? OP_SELFCALL : op;
+    case OP_GETTABUP:
+      return (next == OP_GETFIELD) ? OP_TABUPFIELD : op;
+    case OP_GETFIELD: {
+      switch (next) {
+        case OP_GETFIELD: return OP_FIELDFIELD;
+        case OP_CALL: return OP_FIELDCALL;
+        case OP_EQK: return OP_FIELDEQK;
+        default: return op;
+      }
+    }
+    default: return op;
+  }
+}
+
+
 /*
 ** Do a final pass over the code of a function, doing small peephole
 ** optimizations and adjustments.
 */
 void luaK_finish (FuncState *fs) {
   int i;
+  int second = 0;  /* true if current instruction ends a superinstruction */
   Proto *p = fs->f;
   for (i = 0; i < fs->pc; i++) {
     Instruction *pc = &p->code[i];
     lua_assert(i == 0 || isOT(*(pc - 1)) == isIT(*pc));
+    if (!second && i + 1 < fs->pc) {  /* try to fuse with next one */
+      OpCode op = fusedop(GET_OPCODE(*pc), GET_OPCODE(*(pc + 1)));
+      second = (op != GET_OPCODE(*pc));
+      SET_OPCODE(*pc, op);
+    }
+    else
+      second = 0;  /* an instruction cannot be in two superinstructions */
     switch (GET_OPCODE(*pc)) {
       case OP_RETURN: case OP_RETURN0: case OP_RETURN1:
       case OP_TAILCALL: {
@@ -20,6 +20,12 @@
 #include "lualib.h"
 
 
+#if defined(LUA_USE_POSIX)
+#include <signal.h>
+#include <sys/time.h>
+#endif
+
+
 /*
 ** The hook table at registry[&HOOKKEY] maps threads to their current
 ** hook function. (We only need the unique address of 'HOOKKEY'.)
@@ -428,6 +434,205 @@ static int db_traceback (lua_State *L) {
 }
 
 
+/*
+** Returns a table with the execution count of each opcode and another
+** with the counts of pairs of consecutive opcodes (indexed by the names
+** of the previous and then the next opcode), skipping zeros. With a
+** true argument, also resets the counts. Returns nil if Lua was built
+** without opcode statistics.
+*/
+static int db_opstats (lua_State *L) {
+  int op, next;
+  lua_Unsigned n;
+  if (!lua_opcount(L, 0, -1, &n)) {
+    lua_pushnil(L);
+    return 1;
+  }
+  lua_newtable(L);  /* opcode counts */
+  lua_newtable(L);  /* pair counts */
+  for (op = 0; lua_opname(L, op) != NULL; op++) {
+    lua_opcount(L, op, -1, &n);
+    if (n == 0) continue;
+    lua_pushinteger(L, (lua_Integer)n);
+    lua_setfield(L, -3, lua_opname(L, op));
+    lua_newtable(L);  /* pairs starting with 'op' */
+    for (next = 0; lua_opname(L, next) != NULL; next++) {
+      lua_opcount(L, op, next, &n);
+      if (n == 0) continue;
+      lua_pushinteger(L, (lua_Integer)n);
+      lua_setfield(L, -2, lua_opname(L, next));
+    }
+    lua_setfield(L, -2, lua_opname(L, op));
+  }
+  if (lua_toboolean(L, 1))
+    lua_resetopcounts(L);
+  return 2;
+}
+
+
+/*
+** {======================================================
+** Sampling profiler
+** =======================================================
+*/
+
+/* default number of entries (one per frame) kept by the profiler */
+#if !defined(LUA_PROFSIZE)
+#define LUA_PROFSIZE	100000
+#endif
+
+
+static void profhook (lua_State *L, lua_Debug *ar) {
+  (void)ar;
+  lua_profsample(L);
+}
+
+
+#if defined(LUA_USE_POSIX)	/* { */
+
+/*
+** In timer mode, a SIGPROF signal sets a one-shot count hook in the
+** profiled thread (as 'lua.c' does for SIGINT), so that the program
+** runs without hooks between samples.
+*/
+
+static lua_State *profL = NULL;
+
+static void profonce (lua_State *L, lua_Debug *ar) {
+  lua_sethook(L, NULL, 0, 0);
+  profhook(L, ar);
+}
+
+static void profaction (int i) {
+  (void)i;
+  if (profL != NULL)
+    lua_sethook(profL, profonce, LUA_MASKCOUNT, 1);
+}
+
+static void settimer (double period) {
+  struct itimerval it;
+  it.it_interval.tv_sec = (time_t)period;
+  it.it_interval.tv_usec = (suseconds_t)((period - (double)(time_t)period)
+                                          * 1e6);
+  it.it_value = it.it_interval;
+  setitimer(ITIMER_PROF, &it, NULL);
+}
+
+static void sethandler (void (*handler) (int)) {
+  struct sigaction sa;
+  sa.sa_handler = handler;
+  sa.sa_flags = SA_RESTART;
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGPROF, &sa, NULL);
+}
+
+static void starttimer (lua_State *L, double period) {
+  luaL_argcheck(L, period >= 1e-6, 1, "period too small");
+  profL = L;
+  sethandler(profaction);
+  settimer(period);
+}
+
+static void stoptimer (void) {
+  settimer(0);
+  sethandler(SIG_IGN);  /* ignore any signal still pending */
+  profL = NULL;
+}
+
+/* default: one sample per millisecond of CPU time */
+#define pushperiod(L)	lua_pushnumber(L, 0.001)
+
+#else				/* }{ */
+
+static void starttimer (lua_State *L, double period) {
+  (void)period;
+  luaL_argerror(L, 1, "timer-based sampling not available");
+}
+
+static void stoptimer (void) { }
+
+/* default: one sample every 1000 instructions */
+#define pushperiod(L)	lua_pushinteger(L, 1000)
+
+#endif				/* } */
+
+
+/*
+** debug.profstart([period [, size]]): start sampling the call stack of
+** the running thread. An integer period samples every 'period'
+** instructions (with a count hook); a float one samples every 'period'
+** seconds of CPU time (with a timer), which adds almost no overhead
+** between samples. The profiler replaces any hook of the thread.
+*/
+static int db_profstart (lua_State *L) {
+  lua_Integer size = luaL_optinteger(L, 2, LUA_PROFSIZE);
+  luaL_argcheck(L, 2 <= size && size <= INT_MAX, 2, "invalid size");
+  stoptimer();
+  lua_sethook(L, NULL, 0, 0);
+  lua_profstart(L, (int)size);
+  lua_settop(L, 1);
+  if (lua_isnil(L, 1)) {
+    pushperiod(L);
+    lua_replace(L, 1);
+  }
+  if (lua_isinteger(L, 1)) {
+    lua_Integer count = lua_tointeger(L, 1);
+    luaL_argcheck(L, 0 < count && count <= INT_MAX, 1, "invalid period");
+    lua_sethook(L, profhook, LUA_MASKCOUNT, (int)count);
+  }
+  else
+    starttimer(L, (double)luaL_checknumber(L, 1));
+  return 0;
+}
+
+
+/*
+** debug.profstop(): stop the profiler and return its samples in
+** "folded" format (one line per distinct stack, with its frames
+** outermost first separated by ';', followed by the number of samples
+** with that stack) plus the total number of samples.
+*/
+static int db_profstop (lua_State *L) {
+  luaL_Buffer b;
+  int ns, i, nk = 0;
+  stoptimer();
+  lua_sethook(L, NULL, 0, 0);
+  lua_settop(L, 0);
+  ns = lua_profsamples(L);  /* 1: samples */
+  lua_profstop(L);
+  lua_newtable(L);  /* 2: count for each stack */
+  lua_newtable(L);  /* 3: stacks in order of first appearance */
+  for (i = 1; i <= ns; i++) {
+    lua_Integer n;
+    lua_rawgeti(L, -3, i);
+    lua_pushvalue(L, -1);
+    n = (lua_rawget(L, -4) == LUA_TNIL) ? 0 : lua_tointeger(L, -1);
+    lua_pop(L, 1);
+    if (n == 0) {  /* new stack? */
+      lua_pushvalue(L, -1);
+      lua_rawseti(L, -3, ++nk);
+    }
+    lua_pushinteger(L, n + 1);
+    lua_rawset(L, -4);
+  }
+  luaL_buffinit(L, &b);
+  for (i = 1; i <= nk; i++) {
+    lua_rawgeti(L, 3, i);  /* stack */
+    lua_pushvalue(L, -1);
+    lua_rawget(L, 2);  /* its count */
+    lua_pushfstring(L, "%s %I\n", lua_tostring(L, -2), lua_tointeger(L, -1));
+    lua_replace(L, -3);
+    lua_pop(L, 1);
+    luaL_addvalue(&b);
+  }
+  luaL_pushresult(&b);
+  lua_pushinteger(L, ns);
+  return 2;
+}
+
+/* }====================================================== */
+
+
 static const luaL_Reg dblib[] = {
   {"debug", db_debug},
   {"getuservalue", db_getuservalue},
@@ -437,6 +642,9 @@ static const luaL_Reg dblib[] = {
   {"getregistry", db_getregistry},
   {"getmetatable", db_getmetatable},
   {"getupvalue", db_getupvalue},
+  {"opstats", db_opstats},
+  {"profstart", db_profstart},
+  {"profstop", db_profstop},
   {"upvaluejoin", db_upvaluejoin},
   {"upvalueid", db_upvalueid},
   {"setuservalue", db_setuservalue},
@@ -438,7 +438,7 @@ static int findsetreg (Proto *p, int lastpc, int reg) {
   int jmptarget = 0;  /* any code before this address is conditional */
   for (pc = 0; pc < lastpc; pc++) {
     Instruction i = p->code[pc];
-    OpCode op = GET_OPCODE(i);
+    OpCode op = GET_BASEOP(i);
     int a = GETARG_A(i);
     int change;  /* true if current instruction changed 'reg' */
     switch (op) {
@@ -500,7 +500,7 @@ static const char *gxf (Proto *p, int pc, Instruction i, int isup) {
   pc = findsetreg(p, lastpc, reg);
   if (pc != -1) {  /* could find instruction? */
     Instruction i = p->code[pc];
-    OpCode op = GET_OPCODE(i);
+    OpCode op = GET_BASEOP(i);
     switch (op) {
       case OP_MOVE: {
         int b = GETARG_B(i);  /* move from 'b' to 'a' */
@@ -553,22 +553,15 @@ static const char *gxf (Proto *p, int pc, Instruction i, int isup) {
 
 
 /*
-** Try to find a name for a function based on the code that called it.
-** (Only works when function was called by a Lua function.)
-** Returns what the name is (e.g., "for iterator", "method",
-** "metamethod") and sets '*name' to point to the name.
+** Try to find a name for a function called by instruction 'pc' of
+** function 'p'. Returns what the name is (e.g., "for iterator",
+** "method", "metamethod") and sets '*name' to point to the name.
 */
-static const char *funcnamefromcode (lua_State *L, CallInfo *ci,
+static const char *funcnamefrominst (lua_State *L, Proto *p, int pc,
                                      const char **name) {
   TMS tm = (TMS)0;  /* (initial value avoids warnings) */
-  Proto *p = ci_func(ci)->p;  /* calling function */
-  int pc = currentpc(ci);  /* calling instruction index */
   Instruction i = p->code[pc];  /* calling instruction */
-  if (ci->callstatus & CIST_HOOKED) {  /* was it called inside a hook? */
-    *name = "?";
-    return "hook";
-  }
-  switch (GET_OPCODE(i)) {
+  switch (GET_BASEOP(i)) {
     case OP_CALL:
     case OP_TAILCALL:
       return getobjname(p, pc, GETARG_A(i), name);  /* get function name */
@@ -587,14 +580,14 @@ static const char *funcnamefromcode (lua_State *L, CallInfo *ci,
     case OP_ADDI: case OP_SUBI: case OP_MULI: case OP_MODI:
     case OP_POWI: case OP_DIVI: case OP_IDIVI:
     case OP_BANDK: case OP_BORK: case OP_BXORK: {
-      int offset = GET_OPCODE(i) - OP_ADDI;  /* ORDER OP */
+      int offset = GET_BASEOP(i) - OP_ADDI;  /* ORDER OP */
       tm = cast(TMS, offset + TM_ADD);  /* ORDER TM */
       break;
     }
     case OP_ADD: case OP_SUB: case OP_MUL: case OP_MOD:
     case OP_POW: case OP_DIV: case OP_IDIV: case OP_BAND:
     case OP_BOR: case OP_BXOR: case OP_SHL: case OP_SHR: {
-      int offset = GET_OPCODE(i) - OP_ADD;  /* ORDER OP */
+      int offset = GET_BASEOP(i) - OP_ADD;  /* ORDER OP */
       tm = cast(TMS, offset + TM_ADD);  /* ORDER TM */
       break;
     }
@@ -616,6 +609,20 @@ static const char *funcnamefromcode (lua_State *L, CallInfo *ci,
   return "metamethod";
 }
 
+
+/*
+** Try to find a name for a function based on the code that called it.
+** (Only works when function was called by a Lua function.)
+*/
+static const char *funcnamefromcode (lua_State *L, CallInfo *ci,
+                                     const char **name) {
+  if (ci->callstatus & CIST_HOOKED) {  /* was it called inside a hook? */
+    *name = "?";
+    return "hook";
+  }
+  return funcnamefrominst(L, ci_func(ci)->p, currentpc(ci), name);
+}
+
 /* }====================================================== */
 
 
@@ -796,3 +803,175 @@ void luaG_traceexec (lua_State *L) {
   }
 }
 
+
+
+/*
+** {======================================================
+** Sampling profiler
+** =======================================================
+*/
+
+/* maximum number of frames kept in a sample (the innermost ones) */
+#define MAXPROFDEPTH	200
+
+#define sizeprofiler(n)	(offsetof(Profiler, ring) + (n) * sizeof(ProfFrame))
+
+#define ringentry(prof,i)	(&(prof)->ring[((prof)->first + (i)) % (prof)->size])
+
+
+void luaG_freeprofiler (lua_State *L) {
+  global_State *g = G(L);
+  if (g->prof != NULL) {
+    luaM_freemem(L, g->prof, sizeprofiler(g->prof->size));
+    g->prof = NULL;
+  }
+}
+
+
+LUA_API void lua_profstart (lua_State *L, int size) {
+  Profiler *prof;
+  int i;
+  lua_lock(L);
+  api_check(L, size >= 2, "invalid profiler size");
+  luaG_freeprofiler(L);
+  prof = cast(Profiler *, luaM_malloc_(L, sizeprofiler(size), 0));
+  prof->size = size;
+  prof->first = prof->used = prof->nsamples = 0;
+  for (i = 0; i < size; i++)
+    prof->ring[i].p = NULL;
+  G(L)->prof = prof;
+  lua_unlock(L);
+}
+
+
+LUA_API void lua_profstop (lua_State *L) {
+  lua_lock(L);
+  luaG_freeprofiler(L);
+  lua_unlock(L);
+}
+
+
+static void addentry (Profiler *prof, Proto *p, int pc, int named) {
+  ProfFrame *f = ringentry(prof, prof->used);
+  f->p = p;
+  f->pc = pc;
+  f->named = cast_byte(named);
+  prof->used++;
+}
+
+
+/*
+** Record the current call stack of 'L'. It does not allocate memory,
+** so it can be called from any hook; when the ring is full, the oldest
+** samples are discarded.
+*/
+LUA_API void lua_profsample (lua_State *L) {
+  Profiler *prof;
+  lua_lock(L);
+  prof = G(L)->prof;
+  if (prof != NULL) {
+    CallInfo *ci;
+    int n = 0;
+    for (ci = L->ci; ci != &L->base_ci && n < MAXPROFDEPTH; ci = ci->previous)
+      n++;
+    if (n >= prof->size)
+      n = prof->size - 1;
+    while (prof->used + n + 1 > prof->size) {  /* no space? */
+      int len = -prof->ring[prof->first].pc;  /* drop oldest sample */
+      prof->first = (prof->first + len) % prof->size;
+      prof->used -= len;
+      prof->nsamples--;
+    }
+    addentry(prof, NULL, -(n + 1), 0);  /* header */
+    for (ci = L->ci; n > 0; ci = ci->previous, n--) {
+      int named = !(ci->callstatus & (CIST_TAIL | CIST_FIN)) &&
+                  isLua(ci->previous) &&
+                  !(ci->previous->callstatus & CIST_HOOKED);
+      if (isLua(ci))
+        addentry(prof, ci_func(ci)->p, currentpc(ci), named);
+      else
+        addentry(prof, NULL, 0, named);
+    }
+    prof->nsamples++;
+  }
+  lua_unlock(L);
+}
+
+
+/*
+** Push the label for frame 'f', whose caller is 'caller' (NULL if
+** not recorded).
+*/
+static void pushframe (lua_State *L, const ProfFrame *f,
+                       const ProfFrame *caller, const char *sep) {
+  const char *name = NULL;
+  if (f->named && caller != NULL && caller->p != NULL)
+    funcnamefrominst(L, caller->p, caller->pc, &name);
+  if (name == NULL) name = "?";
+  if (f->p == NULL)
+    luaO_pushfstring(L, "%s@[C]%s", name, sep);
+  else {
+    char buff[LUA_IDSIZE];
+    if (f->p->source)
+      luaO_chunkid(buff, getstr(f->p->source), LUA_IDSIZE);
+    else
+      strcpy(buff, "?");
+    if (f->p->linedefined == 0)
+      luaO_pushfstring(L, "main@%s%s", buff, sep);
+    else
+      luaO_pushfstring(L, "%s@%s:%d%s", name, buff, f->p->linedefined, sep);
+  }
+}
+
+
+/*
+** Push a string with the sample starting at entry 'i' in "folded"
+** format: the labels of its frames, outermost first, separated by ';'.
+*/
+static void pushsample (lua_State *L, Profiler *prof, int i) {
+  int n = -ringentry(prof, i)->pc - 1;  /* number of frames */
+  int k;
+  if (n == 0) {
+    luaO_pushfstring(L, "");
+    return;
+  }
+  for (k = n; k > 0; k--) {  /* from outermost frame */
+    const ProfFrame *caller = (k < n) ? ringentry(prof, i + k + 1) : NULL;
+    pushframe(L, ringentry(prof, i + k), caller, (k > 1) ? ";" : "");
+  }
+  if (n > 1)
+    luaV_concat(L, n);
+}
+
+
+/*
+** Push a sequence with the recorded samples, oldest first, each one
+** as a string in folded format; return the number of samples.
+*/
+LUA_API int lua_profsamples (lua_State *L) {
+  Profiler *prof;
+  Table *t;
+  int ns = 0;
+  lua_lock(L);
+  t = luaH_new(L);
+  sethvalue2s(L, L->top, t);
+  api_incr_top(L);
+  prof = G(L)->prof;
+  if (prof != NULL) {
+    int i = 0;
+    luaH_resize(L, t, prof->nsamples, 0);
+    while (i < prof->used) {
+      pushsample(L, prof, i);
+      luaH_setint(L, t, ++ns, s2v(L->top - 1));
+      luaC_barrierback(L, t, s2v(L->top - 1));
+      L->top--;
+      i -= ringentry(prof, i)->pc;
+    }
+    lua_assert(ns == prof->nsamples);
+  }
+  luaC_checkGC(L);
+  lua_unlock(L);
+  return ns;
+}
+
+/* }====================================================== */
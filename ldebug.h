@@ -21,6 +21,29 @@
 */
 #define ABSLINEINFO	(-0x80)
 
+
+/*
+** Entry in the ring buffer of the sampling profiler. Each sample is a
+** header entry ('p' == NULL, 'pc' == -(number of entries in the
+** sample)) followed by its frames, innermost first. A frame of a C
+** function has 'p' == NULL and 'pc' == 0. 'named' tells whether the
+** instruction at the frame below (the caller) names the function.
+*/
+typedef struct ProfFrame {
+  Proto *p;
+  int pc;
+  lu_byte named;
+} ProfFrame;
+
+
+typedef struct Profiler {
+  int size;  /* size of 'ring' */
+  int first;  /* index of the oldest entry */
+  int used;  /* number of entries in use */
+  int nsamples;  /* number of samples in the ring */
+  ProfFrame ring[1];
+} Profiler;
+
 LUAI_FUNC int luaG_getfuncline (Proto *f, int pc);
 LUAI_FUNC l_noret luaG_typeerror (lua_State *L, const TValue *o,
                                                 const char *opname);
@@ -38,6 +61,7 @@ LUAI_FUNC const char *luaG_addinfo (lua_State *L, const char *msg,
                                                   TString *src, int line);
 LUAI_FUNC l_noret luaG_errormsg (lua_State *L);
 LUAI_FUNC void luaG_traceexec (lua_State *L);
+LUAI_FUNC void luaG_freeprofiler (lua_State *L);
 
 
 #endif
@@ -15,6 +15,7 @@
 #include "lua.h"
 
 #include "lobject.h"
+#include "lopcodes.h"
 #include "lstate.h"
 #include "lundump.h"
 
@@ -97,9 +98,19 @@ static void DumpString (const TString *s, DumpState *D) {
 }
 
 
+/*
+** Dump code with generic opcodes only, undoing the specializations
+** made by the interpreter
+*/
 static void DumpCode (const Proto *f, DumpState *D) {
+  int pc;
   DumpInt(f->sizecode, D);
-  DumpVector(f->code, f->sizecode, D);
+  for (pc = 0; pc < f->sizecode; pc++) {
+    Instruction i = f->code[pc];
+    if (isspecialized(GET_OPCODE(i)))
+      SET_OPCODE(i, GET_BASEOP(i));
+    DumpVar(i, D);
+  }
 }
 
 
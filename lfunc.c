@@ -11,14 +11,19 @@
 
 
 #include <stddef.h>
+#include <string.h>
 
 #include "lua.h"
 
+#include "ldo.h"
 #include "lfunc.h"
 #include "lgc.h"
+#include "ljit.h"
 #include "lmem.h"
 #include "lobject.h"
+#include "lopcodes.h"
 #include "lstate.h"
+#include "lstring.h"
 
 
 
@@ -114,6 +119,10 @@ Proto *luaF_newproto (lua_State *L) {
   f->p = NULL;
   f->sizep = 0;
   f->code = NULL;
+  f->icache = NULL;
+  f->jit = NULL;
+  f->jithot = LUAI_JITHOT;
+  f->shared = NULL;
   f->cache = NULL;
   f->cachemiss = 0;
   f->sizecode = 0;
@@ -135,18 +144,327 @@ Proto *luaF_newproto (lua_State *L) {
 }
 
 
+/*
+** Create the inline caches for prototype 'f', which must already have
+** its final code. All caches start pointing to the first node of a
+** hash part, which is as good a guess as any. (See 'icachehit' in
+** lvm.c.) The entries of 'OP_NEWTABLE' instructions hold the profiles
+** of their tables, which start empty. (See 'luaH_presizesite'.)
+*/
+void luaF_initcaches (lua_State *L, Proto *f) {
+  int i;
+  f->icache = luaM_newvectorchecked(L, f->sizecode, int);
+  for (i = 0; i < f->sizecode; i++)
+    f->icache[i] = 0;
+}
+
+
 void luaF_freeproto (lua_State *L, Proto *f) {
-  luaM_freearray(L, f->code, f->sizecode);
+  luaJ_free(L, f);
+  if (f->icache != NULL)  /* caches are created only for complete code */
+    luaM_freearray(L, f->icache, f->sizecode);
+  if (f->shared == NULL) {  /* code and line information are its own? */
+    luaM_freearray(L, f->code, f->sizecode);
+    luaM_freearray(L, f->lineinfo, f->sizelineinfo);
+    luaM_freearray(L, f->abslineinfo, f->sizeabslineinfo);
+  }
+  else
+    luaF_releasechunk(f->shared->chunk);
   luaM_freearray(L, f->p, f->sizep);
   luaM_freearray(L, f->k, f->sizek);
-  luaM_freearray(L, f->lineinfo, f->sizelineinfo);
-  luaM_freearray(L, f->abslineinfo, f->sizeabslineinfo);
   luaM_freearray(L, f->locvars, f->sizelocvars);
   luaM_freearray(L, f->upvalues, f->sizeupvalues);
-  luaM_free(L, f);
+  luaC_freeobj(L, f);
+}
+
+
+/*
+** {======================================================
+** Shared prototypes
+** =======================================================
+*/
+
+/* arrays in the block of a shared prototype start with this alignment */
+typedef union { LUAI_MAXALIGN; } SharedAlign;
+
+#define alignblock(n)  \
+	(((n) + sizeof(SharedAlign) - 1) / sizeof(SharedAlign) * sizeof(SharedAlign))
+
+#define strsize(ts)	((ts) == NULL ? 0 : tsslen(ts))
+
+
+/*
+** Size of the block for a shared copy of 'f': a 'SharedProto', all its
+** arrays, and the contents of all its strings.
+*/
+static size_t sharedsize (const Proto *f, const TString *psource) {
+  size_t sz = alignblock(sizeof(SharedProto));
+  int i;
+  sz += alignblock(f->sizek * sizeof(TValue));
+  sz += alignblock(f->sizek * sizeof(SharedString));
+  sz += alignblock(f->sizep * sizeof(SharedProto *));
+  sz += alignblock(f->sizeupvalues * sizeof(Upvaldesc));
+  sz += alignblock(f->sizeupvalues * sizeof(SharedString));
+  sz += alignblock(f->sizelocvars * sizeof(LocVar));
+  sz += alignblock(f->sizelocvars * sizeof(SharedString));
+  sz += alignblock(f->sizeabslineinfo * sizeof(AbsLineInfo));
+  sz += alignblock(f->sizecode * sizeof(Instruction));
+  sz += f->sizelineinfo * sizeof(ls_byte);
+  if (f->source != psource)
+    sz += strsize(f->source);
+  for (i = 0; i < f->sizek; i++) {
+    if (ttisstring(&f->k[i]))
+      sz += tsslen(tsvalue(&f->k[i]));
+  }
+  for (i = 0; i < f->sizeupvalues; i++)
+    sz += strsize(f->upvalues[i].name);
+  for (i = 0; i < f->sizelocvars; i++)
+    sz += strsize(f->locvars[i].varname);
+  return sz;
 }
 
 
+/* reserve an array of 'n' elements of type 't' in a block */
+#define carve(pos,n,t)	cast(t *, carve_(pos, (n) * sizeof(t)))
+
+static void *carve_ (char **pos, size_t size) {
+  char *block = *pos;
+  *pos += alignblock(size);
+  return block;
+}
+
+
+static void sharestring (SharedString *ss, const TString *ts, char **pos) {
+  if (ts == NULL) {
+    ss->s = NULL;
+    ss->len = 0;
+  }
+  else {
+    ss->len = tsslen(ts);
+    memcpy(*pos, getstr(ts), ss->len * sizeof(char));
+    ss->s = *pos;
+    *pos += ss->len;
+  }
+}
+
+
+/*
+** Create a shared copy of prototype 'f' (and its nested prototypes),
+** anchoring it in '*psp' before anything else can fail, so that a
+** partial tree can always be freed. As in dumps, a source equal to
+** the one of the enclosing function ('psource') is not repeated.
+*/
+static void shareproto (lua_State *L, lua_SharedChunk *c, const Proto *f,
+                        const TString *psource, SharedProto **psp) {
+  size_t size = sharedsize(f, psource);
+  char *pos = cast(char *, (*c->frealloc)(c->ud, NULL, LUA_TPROTO, size));
+  SharedProto *sp = cast(SharedProto *, pos);
+  int i;
+  if (sp == NULL)
+    luaD_throw(L, LUA_ERRMEM);
+  *psp = sp;
+  sp->chunk = c;
+  sp->blocksize = size;
+  sp->numparams = f->numparams;
+  sp->is_vararg = f->is_vararg;
+  sp->maxstacksize = f->maxstacksize;
+  sp->linedefined = f->linedefined;
+  sp->lastlinedefined = f->lastlinedefined;
+  sp->sizek = f->sizek;
+  sp->sizep = f->sizep;
+  sp->sizeupvalues = f->sizeupvalues;
+  sp->sizelocvars = f->sizelocvars;
+  sp->sizeabslineinfo = f->sizeabslineinfo;
+  sp->sizecode = f->sizecode;
+  sp->sizelineinfo = f->sizelineinfo;
+  pos += alignblock(sizeof(SharedProto));
+  sp->k = carve(&pos, f->sizek, TValue);
+  sp->kstr = carve(&pos, f->sizek, SharedString);
+  sp->p = carve(&pos, f->sizep, SharedProto *);
+  sp->upvalues = carve(&pos, f->sizeupvalues, Upvaldesc);
+  sp->upvalnames = carve(&pos, f->sizeupvalues, SharedString);
+  sp->locvars = carve(&pos, f->sizelocvars, LocVar);
+  sp->locvarnames = carve(&pos, f->sizelocvars, SharedString);
+  sp->abslineinfo = carve(&pos, f->sizeabslineinfo, AbsLineInfo);
+  sp->code = carve(&pos, f->sizecode, Instruction);
+  sp->lineinfo = cast(ls_byte *, pos);
+  pos += f->sizelineinfo * sizeof(ls_byte);
+  for (i = 0; i < f->sizep; i++)
+    sp->p[i] = NULL;
+  sharestring(&sp->source, (f->source == psource) ? NULL : f->source, &pos);
+  for (i = 0; i < f->sizek; i++) {
+    if (ttisstring(&f->k[i])) {
+      setnilvalue(&sp->k[i]);
+      sharestring(&sp->kstr[i], tsvalue(&f->k[i]), &pos);
+    }
+    else {
+      setobj(L, &sp->k[i], &f->k[i]);
+      sharestring(&sp->kstr[i], NULL, &pos);
+    }
+  }
+  for (i = 0; i < f->sizeupvalues; i++) {
+    sp->upvalues[i] = f->upvalues[i];
+    sp->upvalues[i].name = NULL;
+    sharestring(&sp->upvalnames[i], f->upvalues[i].name, &pos);
+  }
+  for (i = 0; i < f->sizelocvars; i++) {
+    sp->locvars[i] = f->locvars[i];
+    sp->locvars[i].varname = NULL;
+    sharestring(&sp->locvarnames[i], f->locvars[i].varname, &pos);
+  }
+  lua_assert(pos == cast(char *, sp) + size);
+  for (i = 0; i < f->sizecode; i++) {  /* undo specializations */
+    Instruction inst = f->code[i];
+    if (isspecialized(GET_OPCODE(inst)))
+      SET_OPCODE(inst, GET_BASEOP(inst));
+    sp->code[i] = inst;
+  }
+  for (i = 0; i < f->sizelineinfo; i++)  /* (arrays may be NULL) */
+    sp->lineinfo[i] = f->lineinfo[i];
+  for (i = 0; i < f->sizeabslineinfo; i++)
+    sp->abslineinfo[i] = f->abslineinfo[i];
+  for (i = 0; i < f->sizep; i++)
+    shareproto(L, c, f->p[i], f->source, &sp->p[i]);
+}
+
+
+static void freeshared (lua_SharedChunk *c, SharedProto *sp) {
+  if (sp != NULL) {
+    int i;
+    for (i = 0; i < sp->sizep; i++)
+      freeshared(c, sp->p[i]);
+    (*c->frealloc)(c->ud, sp, sp->blocksize, 0);
+  }
+}
+
+
+static void freechunk (lua_SharedChunk *c) {
+  lua_Alloc frealloc = c->frealloc;
+  void *ud = c->ud;
+  freeshared(c, c->main);
+  (*frealloc)(ud, c, sizeof(lua_SharedChunk), 0);
+}
+
+
+typedef struct ShareS {
+  lua_SharedChunk *c;
+  Proto *f;
+} ShareS;
+
+
+static void f_share (lua_State *L, void *ud) {
+  ShareS *s = cast(ShareS *, ud);
+  shareproto(L, s->c, s->f, NULL, &s->c->main);
+}
+
+
+/*
+** Create a shared chunk from prototype 'f', allocating its memory
+** with 'frealloc'. The result has one reference, owned by the caller.
+*/
+lua_SharedChunk *luaF_sharechunk (lua_State *L, Proto *f,
+                                  lua_Alloc frealloc, void *ud) {
+  ShareS s;
+  int status;
+  s.c = cast(lua_SharedChunk *,
+             (*frealloc)(ud, NULL, 0, sizeof(lua_SharedChunk)));
+  if (s.c == NULL)
+    luaD_throw(L, LUA_ERRMEM);
+  s.c->frealloc = frealloc;
+  s.c->ud = ud;
+  s.c->nref = 1;
+  s.c->main = NULL;
+  s.f = f;
+  status = luaD_rawrunprotected(L, f_share, &s);
+  if (status != LUA_OK) {
+    freechunk(s.c);
+    luaD_throw(L, status);
+  }
+  return s.c;
+}
+
+
+/*
+** Make prototype 'f' use the code and line information of 'sp'. (Any
+** thread may do this concurrently with others on the same chunk.)
+*/
+void luaF_linkshared (Proto *f, SharedProto *sp) {
+  lua_assert(f->shared == NULL && f->code == NULL);
+  (void)__atomic_add_fetch(&sp->chunk->nref, 1, __ATOMIC_RELAXED);
+  f->shared = sp;
+  f->code = sp->code;
+  f->sizecode = sp->sizecode;
+  f->lineinfo = sp->lineinfo;
+  f->sizelineinfo = sp->sizelineinfo;
+  f->abslineinfo = sp->abslineinfo;
+  f->sizeabslineinfo = sp->sizeabslineinfo;
+}
+
+
+void luaF_releasechunk (lua_SharedChunk *c) {
+  if (__atomic_sub_fetch(&c->nref, 1, __ATOMIC_ACQ_REL) == 0)
+    freechunk(c);
+}
+
+
+static TString *loadstring (lua_State *L, const SharedString *ss) {
+  return (ss->s == NULL) ? NULL : luaS_newlstr(L, ss->s, ss->len);
+}
+
+
+/*
+** Fill the new prototype 'f' from the shared prototype 'sp'. (As in
+** 'luaU_undump', every new object is anchored in 'f' as soon as it is
+** created.) A missing source is the one of the enclosing function
+** ('psource').
+*/
+void luaF_loadshared (lua_State *L, Proto *f, SharedProto *sp,
+                      TString *psource) {
+  int i;
+  luaF_linkshared(f, sp);  /* (caches are created when 'f' first runs) */
+  f->numparams = sp->numparams;
+  f->is_vararg = sp->is_vararg;
+  f->maxstacksize = sp->maxstacksize;
+  f->linedefined = sp->linedefined;
+  f->lastlinedefined = sp->lastlinedefined;
+  f->source = (sp->source.s == NULL) ? psource : loadstring(L, &sp->source);
+  f->k = luaM_newvectorchecked(L, sp->sizek, TValue);
+  f->sizek = sp->sizek;
+  for (i = 0; i < sp->sizek; i++)
+    setnilvalue(&f->k[i]);
+  for (i = 0; i < sp->sizek; i++) {
+    if (sp->kstr[i].s != NULL) {
+      TString *ts = loadstring(L, &sp->kstr[i]);
+      setsvalue2n(L, &f->k[i], ts);
+    }
+    else
+      setobj(L, &f->k[i], &sp->k[i]);
+  }
+  f->upvalues = luaM_newvectorchecked(L, sp->sizeupvalues, Upvaldesc);
+  f->sizeupvalues = sp->sizeupvalues;
+  for (i = 0; i < sp->sizeupvalues; i++)  /* names are still NULL */
+    f->upvalues[i] = sp->upvalues[i];
+  for (i = 0; i < sp->sizeupvalues; i++)
+    f->upvalues[i].name = loadstring(L, &sp->upvalnames[i]);
+  f->locvars = luaM_newvectorchecked(L, sp->sizelocvars, LocVar);
+  f->sizelocvars = sp->sizelocvars;
+  for (i = 0; i < sp->sizelocvars; i++)  /* names are still NULL */
+    f->locvars[i] = sp->locvars[i];
+  for (i = 0; i < sp->sizelocvars; i++)
+    f->locvars[i].varname = loadstring(L, &sp->locvarnames[i]);
+  f->p = luaM_newvectorchecked(L, sp->sizep, Proto *);
+  f->sizep = sp->sizep;
+  for (i = 0; i < sp->sizep; i++)
+    f->p[i] = NULL;
+  for (i = 0; i < sp->sizep; i++) {
+    f->p[i] = luaF_newproto(L);
+    luaF_loadshared(L, f->p[i], sp->p[i], f->source);
+  }
+}
+
+/* }====================================================== */
+
+
 /*
 ** Look for n-th local variable at line 'line' in function 'func'.
 ** Returns NULL if not found.
@@ -42,6 +42,62 @@
 #define MAXMISS		10
 
 
+/*
+** A shared chunk keeps the prototypes of a compiled function outside
+** any state, so that many states can create closures for it. Each
+** state still has its own 'Proto' objects, with its own constants and
+** debug names (strings must be interned in each state) and inline
+** caches (created only when the function first runs), but their code
+** and line information point to the arrays in the shared prototype.
+** The chunk lives while there are handles or prototypes referring to
+** it. Shared code is read only; in particular, the interpreter does
+** not specialize it.
+*/
+
+/* a string in a shared prototype (not a collectable object) */
+typedef struct SharedString {
+  const char *s;  /* contents (NULL for absent strings) */
+  size_t len;
+} SharedString;
+
+
+typedef struct SharedProto {
+  struct lua_SharedChunk *chunk;  /* chunk containing this prototype */
+  size_t blocksize;  /* size of the block holding this prototype */
+  lu_byte numparams;
+  lu_byte is_vararg;
+  lu_byte maxstacksize;
+  int sizeupvalues;
+  int sizek;
+  int sizecode;
+  int sizelineinfo;
+  int sizep;
+  int sizelocvars;
+  int sizeabslineinfo;
+  int linedefined;
+  int lastlinedefined;
+  TValue *k;  /* constants (string constants are nil here) */
+  SharedString *kstr;  /* string constants */
+  Instruction *code;  /* code, with generic opcodes only */
+  struct SharedProto **p;
+  Upvaldesc *upvalues;  /* upvalue information (without names) */
+  SharedString *upvalnames;
+  ls_byte *lineinfo;
+  AbsLineInfo *abslineinfo;
+  LocVar *locvars;  /* local variables (without names) */
+  SharedString *locvarnames;
+  SharedString source;
+} SharedProto;
+
+
+struct lua_SharedChunk {
+  lua_Alloc frealloc;  /* function to (re)allocate the chunk memory */
+  void *ud;  /* auxiliary data to 'frealloc' */
+  int nref;  /* number of handles and prototypes using the chunk */
+  SharedProto *main;  /* prototype of the main function */
+};
+
+
 LUAI_FUNC Proto *luaF_newproto (lua_State *L);
 LUAI_FUNC CClosure *luaF_newCclosure (lua_State *L, int nelems);
 LUAI_FUNC LClosure *luaF_newLclosure (lua_State *L, int nelems);
@@ -49,7 +105,14 @@ LUAI_FUNC void luaF_initupvals (lua_State *L, LClosure *cl);
 LUAI_FUNC UpVal *luaF_findupval (lua_State *L, StkId level);
 LUAI_FUNC void luaF_close (lua_State *L, StkId level);
 LUAI_FUNC void luaF_unlinkupval (UpVal *uv);
+LUAI_FUNC void luaF_initcaches (lua_State *L, Proto *f);
 LUAI_FUNC void luaF_freeproto (lua_State *L, Proto *f);
+LUAI_FUNC lua_SharedChunk *luaF_sharechunk (lua_State *L, Proto *f,
+                                            lua_Alloc frealloc, void *ud);
+LUAI_FUNC void luaF_loadshared (lua_State *L, Proto *f, SharedProto *sp,
+                                TString *psource);
+LUAI_FUNC void luaF_linkshared (Proto *f, SharedProto *sp);
+LUAI_FUNC void luaF_releasechunk (lua_SharedChunk *c);
 LUAI_FUNC const char *luaF_getlocalname (const Proto *func, int local_number,
                                          int pc);
 
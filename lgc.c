@@ -11,6 +11,7 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
 
 #include "lua.h"
 
@@ -18,12 +19,18 @@
 #include "ldo.h"
 #include "lfunc.h"
 #include "lgc.h"
+#include "ljit.h"
 #include "lmem.h"
 #include "lobject.h"
 #include "lstate.h"
 #include "lstring.h"
 #include "ltable.h"
 #include "ltm.h"
+#include "lvm.h"
+
+#if LUA_USE_PARMARK || LUA_USE_BGSWEEP
+#include <pthread.h>
+#endif
 
 
 /*
@@ -59,16 +66,26 @@
 #define PAUSEADJ		100
 
 
+/*
+** Processor time, in microseconds, used by the time-based pacer and
+** by the statistics of the collector
+*/
+#if !defined(l_gcclock)
+#define l_gcclock()  \
+	cast(l_mem, cast(double, clock()) * (1000000.0 / CLOCKS_PER_SEC))
+#endif
+
+
 /* mask to erase all color bits (plus gen. related stuff) */
 #define maskcolors	(~(bitmask(BLACKBIT) | WHITEBITS | AGEBITS))
 
 
 /* macro to erase all color bits then sets only the current white bit */
 #define makewhite(g,x)	\
- (x->marked = cast_byte((x->marked & maskcolors) | luaC_white(g)))
+ (gcmarked(x) = cast_byte((gcmarked(x) & maskcolors) | luaC_white(g)))
 
-#define white2gray(x)	resetbits(x->marked, WHITEBITS)
-#define black2gray(x)	resetbit(x->marked, BLACKBIT)
+#define white2gray(x)	resetbits(gcmarked(x), WHITEBITS)
+#define black2gray(x)	resetbit(gcmarked(x), BLACKBIT)
 
 
 #define valiswhite(x)   (iscollectable(x) && iswhite(gcvalue(x)))
@@ -95,6 +112,9 @@
 
 static void reallymarkobject (global_State *g, GCObject *o);
 static lu_mem atomic (lua_State *L);
+#if LUA_USE_PARMARK
+static lu_mem parpropagateall (global_State *g);
+#endif
 
 
 /*
@@ -120,7 +140,7 @@ static lu_mem atomic (lua_State *L);
 ** Clear keys for empty entries in tables. If entry is empty
 ** and its key is not marked, mark its entry as dead. This allows the
 ** collection of the key, but keeps its entry in the table (its removal
-** could break a chain). Other places never manipulate dead keys,
+** could break a probe sequence). Other places never manipulate dead keys,
 ** because its associated nil value is enough to signal that the entry
 ** is logically empty.
 */
@@ -209,6 +229,7 @@ LUAI_FUNC void luaC_protobarrier_ (lua_State *L, Proto *p) {
 void luaC_fix (lua_State *L, GCObject *o) {
   global_State *g = G(L);
   lua_assert(g->allgc == o);  /* object must be 1st in 'allgc' list! */
+  lua_assert(!ispagedtt(o->tt));
   white2gray(o);  /* they will be gray forever */
   setage(o, G_OLD);  /* and old forever */
   g->allgc = o->next;  /* remove object from 'allgc' list */
@@ -217,13 +238,98 @@ void luaC_fix (lua_State *L, GCObject *o) {
 }
 
 
+#if defined(LUA_USE_GCPAGES)
+
+#define sizepage(c)	(offsetof(GCPage, objs) + GCPAGESLOTS * classsize(c))
+
+
+/*
+** link page 'pg' in the list of pages with free slots of its class
+*/
+static void linkfree (global_State *g, GCPage *pg) {
+  GCPage **head = &g->freepages[pg->cls];
+  pg->prevfree = NULL;
+  pg->nextfree = *head;
+  if (*head != NULL)
+    (*head)->prevfree = pg;
+  *head = pg;
+}
+
+
+static void unlinkfree (global_State *g, GCPage *pg) {
+  if (pg->nextfree != NULL)
+    pg->nextfree->prevfree = pg->prevfree;
+  if (pg->prevfree != NULL)
+    pg->prevfree->nextfree = pg->nextfree;
+  else
+    g->freepages[pg->cls] = pg->nextfree;
+}
+
+
+/*
+** create a new object with type 'tt' in a free slot of a page of
+** its class, creating a new page if there is none. (A new page goes
+** to the front of the list of pages, so it is swept in the current
+** cycle only if the sweep has not started; its objects are all new.)
+*/
+static GCObject *newslot (lua_State *L, int tt, size_t sz) {
+  global_State *g = G(L);
+  int c = pageclass(tt);
+  GCPage *pg = g->freepages[c];
+  lu_byte *m;
+  GCObject *o;
+  lua_assert(sz == classsize(c));
+  UNUSED(sz);
+  if (pg == NULL) {  /* no free slots? */
+    pg = cast(GCPage *, luaM_malloc_(L, sizepage(c), 0));
+    pg->cls = cast_byte(c);
+    pg->nfree = GCPAGESLOTS;
+    memset(pg->marks, FREESLOT, GCPAGESLOTS);
+    pg->next = g->pages;
+    g->pages = pg;
+    linkfree(g, pg);
+  }
+  m = cast(lu_byte *, memchr(pg->marks, FREESLOT, GCPAGESLOTS));
+  lua_assert(m != NULL);
+  if (--pg->nfree == 0)  /* page is full? */
+    unlinkfree(g, pg);
+  *m = luaC_white(g);
+  o = gcpageobj(pg, m - pg->marks);
+  o->marked = cast_byte(m - pg->marks);  /* index in the page */
+  o->tt = tt;
+  o->next = NULL;
+  return o;
+}
+
+
+/*
+** Free the slot of paged object 'o'. (Empty pages are released only
+** by the sweep, so that it never loses its position.)
+*/
+void luaC_freeslot (lua_State *L, GCObject *o) {
+  global_State *g = G(L);
+  GCPage *pg = gcpageof(o);
+  lua_assert(pg->marks[o->marked] != FREESLOT);
+  pg->marks[o->marked] = FREESLOT;
+  if (pg->nfree++ == 0)  /* page was full? */
+    linkfree(g, pg);
+}
+
+#endif
+
+
 /*
 ** create a new collectable object (with given type and size) and link
-** it to 'allgc' list.
+** it to 'allgc' list. (Objects living in pages are not linked.)
 */
 GCObject *luaC_newobj (lua_State *L, int tt, size_t sz) {
   global_State *g = G(L);
-  GCObject *o = cast(GCObject *, luaM_newobject(L, novariant(tt), sz));
+  GCObject *o;
+#if defined(LUA_USE_GCPAGES)
+  if (ispagedtt(tt))
+    return newslot(L, tt, sz);
+#endif
+  o = cast(GCObject *, luaM_newobject(L, novariant(tt), sz));
   o->marked = luaC_white(g);
   o->tt = tt;
   o->next = g->allgc;
@@ -231,6 +337,77 @@ GCObject *luaC_newobj (lua_State *L, int tt, size_t sz) {
   return o;
 }
 
+
+/*
+** link to 'allgc' an object built outside the collector, in a block of
+** size 'sz' from the state's allocation function (see lmsg.c). Its
+** type tag must be already set.
+*/
+void luaC_adoptobj (lua_State *L, GCObject *o, size_t sz) {
+  global_State *g = G(L);
+  o->marked = luaC_white(g);
+  o->next = g->allgc;
+  g->allgc = o;
+  g->GCdebt += sz;
+}
+
+
+/*
+** Approximate size of an object with its parts (for statistics)
+*/
+static lu_mem objsize (GCObject *o) {
+  switch (o->tt) {
+    case LUA_TTABLE: {
+      Table *h = gco2t(o);
+      return sizeof(Table) + sizeof(TValue) * h->sizearray +
+             (istyped(h) ? sizeof(TypedValue) * tarray(h)->size : 0) +
+             sizeof(Node) * allocsizenode(h);
+    }
+    case LUA_TLCL: return sizeLclosure(gco2lcl(o)->nupvalues);
+    case LUA_TCCL: return sizeCclosure(gco2ccl(o)->nupvalues);
+    case LUA_TUSERDATA: return sizeudata(gco2u(o));
+    case LUA_TSHRSTR: return sizelstring(gco2ts(o)->shrlen);
+    case LUA_TLNGSTR: return sizelstring(gco2ts(o)->u.lnglen);
+    case LUA_TUPVAL: return sizeof(UpVal);
+    case LUA_TTHREAD: {
+      lua_State *th = gco2th(o);
+      return sizeof(lua_State) + sizeof(TValue) * th->stacksize +
+             sizeof(CallInfo) * th->nci;
+    }
+    case LUA_TPROTO: {
+      Proto *f = gco2p(o);
+      return sizeof(Proto) + sizeof(Instruction) * f->sizecode +
+             sizeof(TValue) * f->sizek + sizeof(Proto *) * f->sizep;
+    }
+    default: lua_assert(0); return 0;
+  }
+}
+
+
+/*
+** Add the time since 'start' to the time of 'phase' in the current
+** cycle; return current time.
+*/
+static l_mem chargetime (global_State *g, int phase, l_mem start) {
+  l_mem now = l_gcclock();
+  lu_mem t = (now > start) ? cast(lu_mem, now - start) : 0;
+  g->gccurtime[phase] += t;
+  g->gcstats.time[phase] += t;
+  return now;
+}
+
+
+/*
+** Close the statistics of a cycle (or a generational collection)
+*/
+static void endstatscycle (global_State *g) {
+  int i;
+  for (i = 0; i < LUA_GCNPHASES; i++) {
+    g->gcstats.lasttime[i] = g->gccurtime[i];
+    g->gccurtime[i] = 0;
+  }
+}
+
 /* }====================================================== */
 
 
@@ -311,6 +488,19 @@ static void markmt (global_State *g) {
 }
 
 
+/*
+** mark prototypes referred by samples of the profiler
+*/
+static void markprofiler (global_State *g) {
+  Profiler *prof = g->prof;
+  if (prof != NULL) {
+    int i;
+    for (i = 0; i < prof->size; i++)
+      markobjectN(g, prof->ring[i].p);
+  }
+}
+
+
 /*
 ** mark all objects in list of being-finalized
 */
@@ -364,6 +554,7 @@ static void restartcollection (global_State *g) {
   markobject(g, g->mainthread);
   markvalue(g, &g->l_registry);
   markmt(g);
+  markprofiler(g);
   markbeingfnz(g);  /* mark any finalizing object left from previous cycle */
 }
 
@@ -384,9 +575,9 @@ static void restartcollection (global_State *g) {
 */
 static void traverseweakvalue (global_State *g, Table *h) {
   Node *n, *limit = gnodelast(h);
-  /* if there is array part, assume it may have white values (it is not
-     worth traversing it now just to check) */
-  int hasclears = (h->sizearray > 0);
+  /* if there is array part or shape part, assume it may have white
+     values (it is not worth traversing them now just to check) */
+  int hasclears = (h->sizearray > 0 || h->fields != NULL);
   for (n = gnode(h, 0); n < limit; n++) {  /* traverse hash part */
     if (ttisnil(gval(n)))  /* entry is empty? */
       removeentry(n);  /* remove it */
@@ -428,6 +619,13 @@ static int traverseephemeron (global_State *g, Table *h) {
       reallymarkobject(g, gcvalue(&h->array[i]));
     }
   }
+  /* traverse shape part (whose keys are strings, and so never weak) */
+  for (i = 0; i < cast(unsigned int, nfields(h)); i++) {
+    if (valiswhite(&h->fields->v[i])) {
+      marked = 1;
+      reallymarkobject(g, gcvalue(&h->fields->v[i]));
+    }
+  }
   /* traverse hash part */
   for (n = gnode(h, 0); n < limit; n++) {
     if (ttisnil(gval(n)))  /* entry is empty? */
@@ -462,6 +660,8 @@ static void traversestrongtable (global_State *g, Table *h) {
   unsigned int i;
   for (i = 0; i < h->sizearray; i++)  /* traverse array part */
     markvalue(g, &h->array[i]);
+  for (i = 0; i < cast(unsigned int, nfields(h)); i++)  /* shape part */
+    markvalue(g, &h->fields->v[i]);
   for (n = gnode(h, 0); n < limit; n++) {  /* traverse hash part */
     if (ttisnil(gval(n)))  /* entry is empty? */
       removeentry(n);  /* remove it */
@@ -481,7 +681,10 @@ static void traversestrongtable (global_State *g, Table *h) {
 static lu_mem traversetable (global_State *g, Table *h) {
   const char *weakkey, *weakvalue;
   const TValue *mode = gfasttm(g, h->metatable, TM_MODE);
+  int i;
   markobjectN(g, h->metatable);
+  for (i = 0; i < nfields(h); i++)  /* keys in shape part are strong */
+    markobject(g, h->fields->shape->keys[i]);
   if (mode && ttisstring(mode) &&  /* is there a weak mode? */
       ((weakkey = strchr(svalue(mode), 'k')),
        (weakvalue = strchr(svalue(mode), 'v')),
@@ -496,7 +699,7 @@ static lu_mem traversetable (global_State *g, Table *h) {
   }
   else  /* not weak */
     traversestrongtable(g, h);
-  return 1 + h->sizearray + 2 * allocsizenode(h);
+  return 1 + h->sizearray + 2 * (allocsizenode(h) + nfields(h));
 }
 
 
@@ -592,8 +795,10 @@ static int traversethread (global_State *g, lua_State *th) {
       g->twups = th;
     }
   }
-  else if (!g->gcemergency)
+  else if (!g->gcemergency && !LUA_USE_GIL)
     luaD_shrinkstack(th); /* do not change stack in emergency cycle */
+  /* (with LUA_USE_GIL, the owner of 'th' may be reading its stack
+     without the lock, as in 'lua_gettop'; it shrinks it after errors) */
   return 1 + th->stacksize;
 }
 
@@ -640,6 +845,10 @@ static lu_mem propagatemark (global_State *g) {
 
 static lu_mem propagateall (global_State *g) {
   lu_mem tot = 0;
+#if LUA_USE_PARMARK
+  if (g->parmark != NULL && g->gckind == KGC_INC)
+    return parpropagateall(g);
+#endif
   while (g->gray)
     tot += propagatemark(g);
   return tot;
@@ -666,6 +875,701 @@ static void convergeephemerons (global_State *g) {
 /* }====================================================== */
 
 
+/*
+** {======================================================
+** Parallel marking
+** =======================================================
+*/
+
+#if LUA_USE_PARMARK
+
+/* maximum number of helper threads */
+#define MAXMARKERS	64
+
+/*
+** Number of gray objects a marker takes from the shared pool at
+** once; a marker with more than twice that many gray objects gives
+** half of them to the pool when some other marker is idle.
+*/
+#define MARKCHUNK	32
+
+/*
+** Number of objects traversed sequentially before a parallel round.
+** (Small graphs are not worth the threads' wake up.)
+*/
+#define PARMIN		64
+
+
+/*
+** The collector propagates marks with 'n' helper threads plus the
+** thread running the collector (the "markers"). Each marker keeps a
+** local list of gray objects, linked by their 'gclist' fields, and
+** markers share work through 'pool'. A marker claims a white object
+** by clearing its white bits atomically, so each object is traversed
+** by only one marker. Markers traverse only strong tables and
+** closures; other objects (threads, prototypes, and tables that may
+** be weak) go to 'deferred', to be traversed by the collector with
+** the usual functions after the round.
+*/
+typedef struct ParMark {
+  global_State *g;
+  pthread_mutex_t lock;
+  pthread_cond_t start;  /* signals a new round (or 'quit') */
+  pthread_cond_t wake;  /* signals new work in 'pool' (or 'done') */
+  pthread_cond_t finished;  /* signals the end of a helper's round */
+  GCObject *pool;  /* gray objects available to any marker */
+  GCObject *deferred;  /* gray objects left to the collector */
+  lu_mem work;  /* work done by helpers in current round */
+  unsigned int round;  /* number of current round */
+  int nhelpers;  /* number of helper threads */
+  int nidle;  /* number of markers waiting for work */
+  int running;  /* number of helpers still in current round */
+  int done;  /* true when current round has finished */
+  int quit;  /* true when helpers must exit */
+  pthread_t helper[1];
+} ParMark;
+
+
+typedef struct Marker {
+  ParMark *pm;
+  GCObject *gray;  /* local list of gray objects */
+  int ngray;  /* number of objects in 'gray' */
+  lu_mem work;  /* work done by this marker */
+} Marker;
+
+
+#define sizeparmark(n)	(offsetof(ParMark, helper) + (n) * sizeof(pthread_t))
+
+#define atomicload(x)	__atomic_load_n(&(x), __ATOMIC_RELAXED)
+#define atomicstore(x,v)	__atomic_store_n(&(x), (v), __ATOMIC_RELAXED)
+
+
+/*
+** Claim a white object: turn it gray and return true, unless another
+** marker got it first.
+*/
+static int parclaim (GCObject *o) {
+  lu_byte *m = &gcmarked(o);
+  return (testbits(atomicload(*m), WHITEBITS) &&
+          testbits(__atomic_fetch_and(m, cast_byte(~WHITEBITS),
+                                      __ATOMIC_RELAXED), WHITEBITS));
+}
+
+#define parblacken(o)	\
+	((void)__atomic_fetch_or(&gcmarked(o), bitmask(BLACKBIT), \
+	                         __ATOMIC_RELAXED))
+
+
+static GCObject **getgclist (GCObject *o) {
+  switch (o->tt) {
+    case LUA_TTABLE: return &gco2t(o)->gclist;
+    case LUA_TLCL: return &gco2lcl(o)->gclist;
+    case LUA_TCCL: return &gco2ccl(o)->gclist;
+    case LUA_TTHREAD: return &gco2th(o)->gclist;
+    case LUA_TPROTO: return &gco2p(o)->gclist;
+    default: lua_assert(0); return NULL;
+  }
+}
+
+
+static void parpush (Marker *m, GCObject *o) {
+  *getgclist(o) = m->gray;
+  m->gray = o;
+  m->ngray++;
+}
+
+
+static void pardefer (Marker *m, GCObject *o) {
+  ParMark *pm = m->pm;
+  pthread_mutex_lock(&pm->lock);
+  *getgclist(o) = pm->deferred;
+  pm->deferred = o;
+  pthread_mutex_unlock(&pm->lock);
+}
+
+
+/*
+** Parallel version of 'reallymarkobject'.
+*/
+static void parmark (Marker *m, GCObject *o) {
+ reentry:
+  if (!parclaim(o))
+    return;  /* already marked */
+  switch (o->tt) {
+    case LUA_TSHRSTR:
+    case LUA_TLNGSTR: {
+      parblacken(o);
+      break;
+    }
+    case LUA_TUSERDATA: {
+      TValue uvalue;
+      Table *mt = gco2u(o)->metatable;
+      if (mt != NULL)
+        parmark(m, obj2gco(mt));
+      parblacken(o);
+      getuservalue(m->pm->g->mainthread, gco2u(o), &uvalue);
+      if (iscollectable(&uvalue)) {
+        o = gcvalue(&uvalue);
+        goto reentry;
+      }
+      break;
+    }
+    case LUA_TUPVAL: {
+      UpVal *uv = gco2upv(o);
+      if (!upisopen(uv))  /* open upvalues are kept gray */
+        parblacken(o);
+      if (iscollectable(uv->v)) {
+        o = gcvalue(uv->v);
+        goto reentry;
+      }
+      break;
+    }
+    case LUA_TTABLE: case LUA_TLCL: case LUA_TCCL: {
+      parpush(m, o);
+      break;
+    }
+    default: {  /* threads and prototypes */
+      pardefer(m, o);
+      break;
+    }
+  }
+}
+
+
+#define parmarkvalue(m,v)  \
+	{ if (iscollectable(v)) parmark(m, gcvalue(v)); }
+
+
+/*
+** Traverse a table with no weak mode ('traversestrongtable'). The
+** 'removeentry' of an empty entry may race with other markers
+** marking its key; in that case the entry just keeps a dead key,
+** which is harmless.
+*/
+static lu_mem partraversetable (Marker *m, Table *h) {
+  Node *n, *limit = gnodelast(h);
+  unsigned int i;
+  if (h->metatable != NULL)
+    parmark(m, obj2gco(h->metatable));
+  for (i = 0; i < cast(unsigned int, nfields(h)); i++) {  /* shape part */
+    parmark(m, obj2gco(h->fields->shape->keys[i]));
+    parmarkvalue(m, &h->fields->v[i]);
+  }
+  for (i = 0; i < h->sizearray; i++)  /* array part */
+    parmarkvalue(m, &h->array[i]);
+  for (n = gnode(h, 0); n < limit; n++) {  /* hash part */
+    if (ttisnil(gval(n))) {  /* entry is empty? */
+      if (keyiscollectable(n) && iswhite(gckey(n)))
+        setdeadkey(n);  /* remove it */
+    }
+    else {
+      if (keyiscollectable(n))
+        parmark(m, gckey(n));
+      parmarkvalue(m, gval(n));
+    }
+  }
+  return 1 + h->sizearray + 2 * (allocsizenode(h) + nfields(h));
+}
+
+
+/*
+** Traverse gray object 'o', turning it black, or defer it to the
+** collector. Only tables whose metatables are known to have no
+** '__mode' field are traversed here.
+*/
+static void partraverse (Marker *m, GCObject *o) {
+  switch (o->tt) {
+    case LUA_TTABLE: {
+      Table *h = gco2t(o);
+      Table *mt = h->metatable;
+      if (mt != NULL && !(mt->flags & (1u << TM_MODE)))
+        pardefer(m, o);  /* it may be weak */
+      else {
+        parblacken(o);
+        m->work += partraversetable(m, h);
+      }
+      break;
+    }
+    case LUA_TLCL: {
+      LClosure *cl = gco2lcl(o);
+      int i;
+      parblacken(o);
+      if (cl->p != NULL)
+        parmark(m, obj2gco(cl->p));
+      for (i = 0; i < cl->nupvalues; i++) {
+        if (cl->upvals[i] != NULL)
+          parmark(m, obj2gco(cl->upvals[i]));
+      }
+      m->work += 1 + cl->nupvalues;
+      break;
+    }
+    case LUA_TCCL: {
+      CClosure *cl = gco2ccl(o);
+      int i;
+      parblacken(o);
+      for (i = 0; i < cl->nupvalues; i++)
+        parmarkvalue(m, &cl->upvalue[i]);
+      m->work += 1 + cl->nupvalues;
+      break;
+    }
+    default: {
+      pardefer(m, o);
+      break;
+    }
+  }
+}
+
+
+/*
+** Give half of the local gray objects of marker 'm' to the pool.
+*/
+static void sharework (Marker *m) {
+  ParMark *pm = m->pm;
+  GCObject *first = m->gray;
+  GCObject **last = &m->gray;
+  int n = m->ngray / 2;
+  int i;
+  for (i = 0; i < n; i++)
+    last = getgclist(*last);
+  m->gray = *last;
+  m->ngray -= n;
+  pthread_mutex_lock(&pm->lock);
+  *last = pm->pool;
+  pm->pool = first;
+  pthread_cond_broadcast(&pm->wake);
+  pthread_mutex_unlock(&pm->lock);
+}
+
+
+/*
+** Get some objects from the pool into the local list of marker 'm',
+** waiting for them if necessary. Returns false when the round is
+** over, that is, when the pool is empty and all other markers are
+** idle too.
+*/
+static int getwork (Marker *m) {
+  ParMark *pm = m->pm;
+  int i;
+  pthread_mutex_lock(&pm->lock);
+  while (pm->pool == NULL && !pm->done) {
+    if (pm->nidle == pm->nhelpers) {  /* all other markers idle? */
+      pm->done = 1;
+      pthread_cond_broadcast(&pm->wake);
+    }
+    else {
+      atomicstore(pm->nidle, pm->nidle + 1);
+      pthread_cond_wait(&pm->wake, &pm->lock);
+      atomicstore(pm->nidle, pm->nidle - 1);
+    }
+  }
+  for (i = 0; i < MARKCHUNK && pm->pool != NULL; i++) {
+    GCObject *o = pm->pool;
+    pm->pool = *getgclist(o);
+    parpush(m, o);
+  }
+  pthread_mutex_unlock(&pm->lock);
+  return (m->gray != NULL);
+}
+
+
+static void runmarker (Marker *m) {
+  ParMark *pm = m->pm;
+  while (m->gray != NULL || getwork(m)) {
+    GCObject *o = m->gray;
+    m->gray = *getgclist(o);
+    m->ngray--;
+    partraverse(m, o);
+    if (m->ngray > 2 * MARKCHUNK && atomicload(pm->nidle) > 0)
+      sharework(m);
+  }
+}
+
+
+static void *helpermain (void *ud) {
+  ParMark *pm = (ParMark *)ud;
+  unsigned int round = 0;
+  pthread_mutex_lock(&pm->lock);
+  for (;;) {
+    Marker m;
+    while (pm->round == round && !pm->quit)
+      pthread_cond_wait(&pm->start, &pm->lock);
+    if (pm->quit)
+      break;
+    round = pm->round;
+    pthread_mutex_unlock(&pm->lock);
+    m.pm = pm; m.gray = NULL; m.ngray = 0; m.work = 0;
+    runmarker(&m);
+    pthread_mutex_lock(&pm->lock);
+    pm->work += m.work;
+    if (--pm->running == 0)
+      pthread_cond_signal(&pm->finished);
+  }
+  pthread_mutex_unlock(&pm->lock);
+  return NULL;
+}
+
+
+/*
+** Propagate marks from all objects in the gray list with all markers.
+** Objects deferred by the markers go back to the gray list.
+*/
+static lu_mem parround (global_State *g) {
+  ParMark *pm = g->parmark;
+  Marker m;
+  lu_mem work;
+  pthread_mutex_lock(&pm->lock);
+  pm->pool = g->gray;
+  pm->deferred = NULL;
+  pm->work = 0;
+  pm->done = 0;
+  pm->running = pm->nhelpers;
+  pm->round++;
+  pthread_cond_broadcast(&pm->start);
+  pthread_mutex_unlock(&pm->lock);
+  g->gray = NULL;
+  m.pm = pm; m.gray = NULL; m.ngray = 0; m.work = 0;
+  runmarker(&m);
+  pthread_mutex_lock(&pm->lock);
+  while (pm->running > 0)
+    pthread_cond_wait(&pm->finished, &pm->lock);
+  work = m.work + pm->work;
+  g->gray = pm->deferred;
+  pthread_mutex_unlock(&pm->lock);
+  return work;
+}
+
+
+/*
+** Alternate parallel rounds with the sequential traversal of the
+** objects deferred by each round. (Those objects cannot simply stay
+** in the gray list for the next round, as the markers would defer
+** them again.) Traversing a table turns on the cache bit for '__mode'
+** in its metatable, so other tables sharing that metatable can be
+** traversed by the markers in the next rounds.
+*/
+static lu_mem parpropagateall (global_State *g) {
+  lu_mem tot = 0;
+  while (g->gray) {
+    int i;
+    for (i = 0; i < PARMIN && g->gray; i++)
+      tot += propagatemark(g);
+    if (g->gray) {
+      GCObject *deferred;
+      tot += parround(g);
+      deferred = g->gray;
+      g->gray = NULL;
+      while (deferred != NULL) {  /* traverse each deferred object */
+        GCObject *o = deferred;
+        GCObject **next = getgclist(o);
+        deferred = *next;
+        *next = g->gray;  /* put it in the gray list... */
+        g->gray = o;
+        tot += propagatemark(g);  /* ...and traverse it */
+      }
+    }
+  }
+  return tot;
+}
+
+
+static void stophelpers (lua_State *L, ParMark *pm) {
+  int i;
+  pthread_mutex_lock(&pm->lock);
+  pm->quit = 1;
+  pthread_cond_broadcast(&pm->start);
+  pthread_mutex_unlock(&pm->lock);
+  for (i = 0; i < pm->nhelpers; i++)
+    pthread_join(pm->helper[i], NULL);
+  pthread_cond_destroy(&pm->finished);
+  pthread_cond_destroy(&pm->wake);
+  pthread_cond_destroy(&pm->start);
+  pthread_mutex_destroy(&pm->lock);
+  luaM_freemem(L, pm, sizeparmark(pm->nhelpers));
+}
+
+
+static ParMark *starthelpers (lua_State *L, int n) {
+  ParMark *pm = (ParMark *)luaM_malloc_(L, sizeparmark(n), 0);
+  pm->g = G(L);
+  pm->pool = pm->deferred = NULL;
+  pm->round = 0;
+  pm->nidle = pm->running = pm->done = pm->quit = 0;
+  pthread_mutex_init(&pm->lock, NULL);
+  pthread_cond_init(&pm->start, NULL);
+  pthread_cond_init(&pm->wake, NULL);
+  pthread_cond_init(&pm->finished, NULL);
+  for (pm->nhelpers = 0; pm->nhelpers < n; pm->nhelpers++) {
+    if (pthread_create(&pm->helper[pm->nhelpers], NULL, helpermain, pm) != 0)
+      break;  /* cannot create more threads */
+  }
+  if (pm->nhelpers == 0) {  /* could not create any thread? */
+    stophelpers(L, pm);
+    return NULL;
+  }
+  return pm;
+}
+
+
+/*
+** Set the number of helper threads for marking to 'n' (when 'n' is
+** not negative) and return the previous number. The helpers are used
+** only by the incremental collector, when it propagates all gray
+** objects at once (in atomic steps and full collections).
+*/
+int luaC_parallel (lua_State *L, int n) {
+  global_State *g = G(L);
+  ParMark *pm = g->parmark;
+  int previous = (pm != NULL) ? pm->nhelpers : 0;
+  if (n >= 0 && n != previous) {
+    g->parmark = NULL;
+    if (pm != NULL)
+      stophelpers(L, pm);
+    if (n > 0)
+      g->parmark = starthelpers(L, (n < MAXMARKERS) ? n : MAXMARKERS);
+  }
+  return previous;
+}
+
+#else
+
+int luaC_parallel (lua_State *L, int n) {
+  UNUSED(L); UNUSED(n);
+  return 0;
+}
+
+#endif
+
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** Background sweeping
+** =======================================================
+*/
+
+#if LUA_USE_BGSWEEP
+
+/* number of blocks handed to the sweeper at once */
+#define FREEBATCH	256
+
+
+/*
+** A batch of blocks to be freed. Each batch records the allocation
+** function in use when it was created, as that is the one the
+** collector would have used to free its blocks.
+*/
+typedef struct FreeBatch {
+  struct FreeBatch *next;
+  lua_Alloc frealloc;
+  void *ud;
+  int n;  /* number of blocks in 'item' */
+  struct {
+    void *block;
+    size_t size;
+  } item[FREEBATCH];
+} FreeBatch;
+
+
+/*
+** While the incremental collector sweeps, 'luaM_free_' hands the
+** blocks of dead objects to 'luaC_deferfree', which collects them into
+** batches for the sweeper thread. The collector still does all the
+** work on the objects themselves (unlinking them, removing strings
+** from the string table, etc.) and still discounts their sizes from
+** the debt; only the calls to the allocation function go to the
+** sweeper.
+*/
+typedef struct Sweeper {
+  pthread_mutex_t lock;
+  pthread_cond_t wake;  /* signals new batches in 'queue' (or 'quit') */
+  pthread_cond_t idle;  /* signals that the sweeper has nothing to do */
+  FreeBatch *queue;  /* batches waiting to be freed */
+  FreeBatch *batch;  /* batch being filled by the collector */
+  int busy;  /* true while the sweeper is freeing some batches */
+  int quit;  /* true when the sweeper must exit */
+  pthread_t thread;
+} Sweeper;
+
+
+static void freebatches (FreeBatch *b) {
+  while (b != NULL) {
+    FreeBatch *next = b->next;
+    int i;
+    for (i = 0; i < b->n; i++)
+      (*b->frealloc)(b->ud, b->item[i].block, b->item[i].size, 0);
+    (*b->frealloc)(b->ud, b, sizeof(FreeBatch), 0);
+    b = next;
+  }
+}
+
+
+static void *sweepermain (void *ud) {
+  Sweeper *sw = (Sweeper *)ud;
+  pthread_mutex_lock(&sw->lock);
+  for (;;) {
+    FreeBatch *b;
+    while (sw->queue == NULL && !sw->quit)
+      pthread_cond_wait(&sw->wake, &sw->lock);
+    if (sw->queue == NULL)  /* 'quit' and nothing left to free? */
+      break;
+    b = sw->queue;
+    sw->queue = NULL;
+    sw->busy = 1;
+    pthread_mutex_unlock(&sw->lock);
+    freebatches(b);
+    pthread_mutex_lock(&sw->lock);
+    sw->busy = 0;
+    if (sw->queue == NULL)
+      pthread_cond_broadcast(&sw->idle);
+  }
+  pthread_mutex_unlock(&sw->lock);
+  return NULL;
+}
+
+
+/*
+** Hand the current batch to the sweeper.
+*/
+static void flushfrees (Sweeper *sw) {
+  FreeBatch *b = sw->batch;
+  if (b != NULL) {
+    sw->batch = NULL;
+    pthread_mutex_lock(&sw->lock);
+    b->next = sw->queue;
+    sw->queue = b;
+    pthread_cond_signal(&sw->wake);
+    pthread_mutex_unlock(&sw->lock);
+  }
+}
+
+
+/*
+** Wait until the sweeper has freed all blocks handed to it (e.g., in
+** an emergency collection, which needs that memory right now).
+*/
+static void waitsweeper (global_State *g) {
+  Sweeper *sw = g->sweeper;
+  if (sw != NULL) {
+    flushfrees(sw);
+    pthread_mutex_lock(&sw->lock);
+    while (sw->queue != NULL || sw->busy)
+      pthread_cond_wait(&sw->idle, &sw->lock);
+    pthread_mutex_unlock(&sw->lock);
+  }
+}
+
+
+/*
+** Add a block to the current batch. Returns false when there is no
+** memory for a new batch, so that the caller frees the block itself.
+*/
+int luaC_deferfree (global_State *g, void *block, size_t osize) {
+  Sweeper *sw = g->sweeper;
+  FreeBatch *b = sw->batch;
+  if (b == NULL) {  /* no current batch? */
+    b = (FreeBatch *)(*g->frealloc)(g->ud, NULL, 0, sizeof(FreeBatch));
+    if (b == NULL)
+      return 0;
+    b->frealloc = g->frealloc;
+    b->ud = g->ud;
+    b->n = 0;
+    sw->batch = b;
+  }
+  b->item[b->n].block = block;
+  b->item[b->n].size = osize;
+  if (++b->n == FREEBATCH)  /* batch is full? */
+    flushfrees(sw);
+  return 1;
+}
+
+
+static void stopsweeper (global_State *g) {
+  Sweeper *sw = g->sweeper;
+  g->sweeper = NULL;
+  flushfrees(sw);
+  pthread_mutex_lock(&sw->lock);
+  sw->quit = 1;
+  pthread_cond_signal(&sw->wake);
+  pthread_mutex_unlock(&sw->lock);
+  pthread_join(sw->thread, NULL);  /* sweeper frees all pending batches */
+  pthread_cond_destroy(&sw->idle);
+  pthread_cond_destroy(&sw->wake);
+  pthread_mutex_destroy(&sw->lock);
+  (*g->frealloc)(g->ud, sw, sizeof(Sweeper), 0);
+}
+
+
+static Sweeper *startsweeper (global_State *g) {
+  Sweeper *sw = (Sweeper *)(*g->frealloc)(g->ud, NULL, 0, sizeof(Sweeper));
+  if (sw == NULL)
+    return NULL;
+  sw->queue = sw->batch = NULL;
+  sw->busy = sw->quit = 0;
+  pthread_mutex_init(&sw->lock, NULL);
+  pthread_cond_init(&sw->wake, NULL);
+  pthread_cond_init(&sw->idle, NULL);
+  if (pthread_create(&sw->thread, NULL, sweepermain, sw) != 0) {
+    pthread_cond_destroy(&sw->idle);
+    pthread_cond_destroy(&sw->wake);
+    pthread_mutex_destroy(&sw->lock);
+    (*g->frealloc)(g->ud, sw, sizeof(Sweeper), 0);
+    return NULL;
+  }
+  return sw;
+}
+
+
+/*
+** Turn background sweeping on or off (when 'on' is not negative) and
+** return whether it was on. Arena states (see LUA_GCARENA) never sweep
+** in the background, as their allocators need not be thread safe.
+*/
+int luaC_bgsweep (lua_State *L, int on) {
+  global_State *g = G(L);
+  int previous = (g->sweeper != NULL);
+  if (on > 0 && g->gcarena)
+    on = 0;  /* refuse it */
+  if (on >= 0 && on != previous) {
+    if (on)
+      g->sweeper = startsweeper(g);
+    else
+      stopsweeper(g);
+  }
+  return previous;
+}
+
+
+static void flushsweeper (global_State *g) {
+  if (g->sweeper != NULL)
+    flushfrees(g->sweeper);
+}
+
+
+/* frees of dead objects go to the sweeper while sweeping */
+#define deferfrees(g,on)	((g)->gcdeferfree = ((on) && (g)->sweeper != NULL))
+
+#else
+
+#define flushsweeper(g)		((void)0)
+#define waitsweeper(g)		((void)0)
+#define deferfrees(g,on)	((void)0)
+
+int luaC_deferfree (global_State *g, void *block, size_t osize) {
+  UNUSED(g); UNUSED(block); UNUSED(osize);
+  return 0;
+}
+
+int luaC_bgsweep (lua_State *L, int on) {
+  UNUSED(L); UNUSED(on);
+  return 0;
+}
+
+#endif
+
+/* }====================================================== */
+
+
 /*
 ** {======================================================
 ** Sweep Functions
@@ -717,6 +1621,11 @@ static void clearvalues (global_State *g, GCObject *l, GCObject *f) {
       if (iscleared(g, gcvalueN(o)))  /* value was collected? */
         setnilvalue(o);  /* remove value */
     }
+    for (i = 0; i < cast(unsigned int, nfields(h)); i++) {
+      TValue *o = &h->fields->v[i];
+      if (iscleared(g, gcvalueN(o)))  /* value was collected? */
+        setnilvalue(o);  /* remove value */
+    }
     for (n = gnode(h, 0); n < limit; n++) {
       if (iscleared(g, gcvalueN(gval(n))))  /* unmarked value? */
         setnilvalue(gval(n));  /* clear value */
@@ -730,7 +1639,7 @@ static void clearvalues (global_State *g, GCObject *l, GCObject *f) {
 static void freeupval (lua_State *L, UpVal *uv) {
   if (upisopen(uv))
     luaF_unlinkupval(uv);
-  luaM_free(L, uv);
+  luaC_freeobj(L, uv);
 }
 
 
@@ -784,13 +1693,13 @@ static GCObject **sweeplist (lua_State *L, GCObject **p, int countin,
   int white = luaC_white(g);  /* current white */
   for (i = 0; *p != NULL && i < countin; i++) {
     GCObject *curr = *p;
-    int marked = curr->marked;
+    int marked = gcmarked(curr);
     if (isdeadm(ow, marked)) {  /* is 'curr' dead? */
       *p = curr->next;  /* remove 'curr' from list */
       freeobj(L, curr);  /* erase 'curr' */
     }
     else {  /* change mark to 'white' */
-      curr->marked = cast_byte((marked & maskcolors) | white);
+      gcmarked(curr) = cast_byte((marked & maskcolors) | white);
       p = &curr->next;  /* go to next element */
     }
   }
@@ -811,6 +1720,83 @@ static GCObject **sweeptolive (lua_State *L, GCObject **p) {
   return p;
 }
 
+
+#if defined(LUA_USE_GCPAGES)
+
+/*
+** If page '*p' is empty, release it. Return where to continue the
+** traversal of the list of pages.
+*/
+static GCPage **checkemptypage (lua_State *L, GCPage **p) {
+  GCPage *pg = *p;
+  if (pg->nfree == GCPAGESLOTS) {  /* empty page? */
+    *p = pg->next;  /* remove it from the list */
+    unlinkfree(G(L), pg);
+    luaM_freemem(L, pg, sizepage(pg->cls));
+    return p;
+  }
+  else
+    return &pg->next;
+}
+
+
+/*
+** sweep pages from '*p', like 'sweeplist', until sweeping at least
+** 'countin' objects. It reads only the arrays of marks, plus the dead
+** objects being freed. Objects with finalizers are skipped, as they
+** are swept with the list where they are linked.
+*/
+static GCPage **sweeppages (lua_State *L, GCPage **p, int countin,
+                            int *countout) {
+  global_State *g = G(L);
+  int ow = otherwhite(g);
+  int white = luaC_white(g);
+  int count = 0;
+  while (*p != NULL && count < countin) {
+    GCPage *pg = *p;
+    int i;
+    for (i = 0; i < GCPAGESLOTS; i++) {
+      int marked = pg->marks[i];
+      if (marked == FREESLOT || testbit(marked, FINALIZEDBIT))
+        continue;  /* free slot or object swept with a list */
+      count++;
+      if (isdeadm(ow, marked))  /* is object dead? */
+        freeobj(L, gcpageobj(pg, i));  /* erase it */
+      else  /* change mark to 'white' */
+        pg->marks[i] = cast_byte((marked & maskcolors) | white);
+    }
+    count++;  /* the page itself */
+    p = checkemptypage(L, p);
+  }
+  *countout = count;
+  return (*p == NULL) ? NULL : p;
+}
+
+
+/*
+** Free all objects in pages and then all pages. (Objects go before
+** threads, as open upvalues unlink themselves from their threads.)
+*/
+static void deletepages (lua_State *L) {
+  global_State *g = G(L);
+  GCPage *pg;
+  int i;
+  for (pg = g->pages; pg != NULL; pg = pg->next) {
+    for (i = 0; i < GCPAGESLOTS; i++) {
+      if (pg->marks[i] != FREESLOT)
+        freeobj(L, gcpageobj(pg, i));
+    }
+  }
+  while ((pg = g->pages) != NULL) {
+    g->pages = pg->next;
+    luaM_freemem(L, pg, sizepage(pg->cls));
+  }
+  for (i = 0; i < NPAGECLASSES; i++)
+    g->freepages[i] = NULL;
+}
+
+#endif
+
 /* }====================================================== */
 
 
@@ -841,9 +1827,11 @@ static GCObject *udata2finalize (global_State *g) {
   GCObject *o = g->tobefnz;  /* get first element */
   lua_assert(tofinalize(o));
   g->tobefnz = o->next;  /* remove it from 'tobefnz' list */
-  o->next = g->allgc;  /* return it to 'allgc' list */
-  g->allgc = o;
-  resetbit(o->marked, FINALIZEDBIT);  /* object is "normal" again */
+  if (!ispagedtt(o->tt)) {  /* objects in pages are in no list */
+    o->next = g->allgc;  /* return it to 'allgc' list */
+    g->allgc = o;
+  }
+  resetbit(gcmarked(o), FINALIZEDBIT);  /* object is "normal" again */
   if (issweepphase(g))
     makewhite(g, o);  /* "sweep" object */
   return o;
@@ -973,12 +1961,14 @@ void luaC_checkfinalizer (lua_State *L, GCObject *o, Table *mt) {
       if (o == g->reallyold)
         g->reallyold = o->next;
     }
-    /* search for pointer pointing to 'o' */
-    for (p = &g->allgc; *p != o; p = &(*p)->next) { /* empty */ }
-    *p = o->next;  /* remove 'o' from 'allgc' list */
+    if (!ispagedtt(o->tt)) {  /* objects in pages are in no list */
+      /* search for pointer pointing to 'o' */
+      for (p = &g->allgc; *p != o; p = &(*p)->next) { /* empty */ }
+      *p = o->next;  /* remove 'o' from 'allgc' list */
+    }
     o->next = g->finobj;  /* link it in 'finobj' list */
     g->finobj = o;
-    l_setbit(o->marked, FINALIZEDBIT);  /* mark it as such */
+    l_setbit(gcmarked(o), FINALIZEDBIT);  /* mark it as such */
   }
 }
 
@@ -1023,17 +2013,18 @@ static void sweep2old (lua_State *L, GCObject **p) {
 ** non-dead objects, advance their ages and clear the color of
 ** new objects. (Old objects keep their colors.)
 */
+static const lu_byte nextage[] = {
+  G_SURVIVAL,  /* from G_NEW */
+  G_OLD1,      /* from G_SURVIVAL */
+  G_OLD1,      /* from G_OLD0 */
+  G_OLD,       /* from G_OLD1 */
+  G_OLD,       /* from G_OLD (do not change) */
+  G_TOUCHED1,  /* from G_TOUCHED1 (do not change) */
+  G_TOUCHED2   /* from G_TOUCHED2 (do not change) */
+};
+
 static GCObject **sweepgen (lua_State *L, global_State *g, GCObject **p,
                             GCObject *limit) {
-  static lu_byte nextage[] = {
-    G_SURVIVAL,  /* from G_NEW */
-    G_OLD1,      /* from G_SURVIVAL */
-    G_OLD1,      /* from G_OLD0 */
-    G_OLD,       /* from G_OLD1 */
-    G_OLD,       /* from G_OLD (do not change) */
-    G_TOUCHED1,  /* from G_TOUCHED1 (do not change) */
-    G_TOUCHED2   /* from G_TOUCHED2 (do not change) */
-  };
   int white = luaC_white(g);
   GCObject *curr;
   while ((curr = *p) != limit) {
@@ -1044,7 +2035,9 @@ static GCObject **sweepgen (lua_State *L, global_State *g, GCObject **p,
     }
     else {  /* correct mark and age */
       if (getage(curr) == G_NEW)
-        curr->marked = cast_byte((curr->marked & maskgencolors) | white);
+        gcmarked(curr) = cast_byte((gcmarked(curr) & maskgencolors) | white);
+      else if (getage(curr) == G_SURVIVAL)  /* will be old? */
+        g->gcstats.promoted += objsize(curr);
       setage(curr, nextage[getage(curr)]);
       p = &curr->next;  /* go to next element */
     }
@@ -1060,7 +2053,7 @@ static GCObject **sweepgen (lua_State *L, global_State *g, GCObject **p,
 static void whitelist (global_State *g, GCObject *p) {
   int white = luaC_white(g);
   for (; p != NULL; p = p->next)
-    p->marked = cast_byte((p->marked & maskcolors) | white);
+    gcmarked(p) = cast_byte((gcmarked(p) & maskcolors) | white);
 }
 
 
@@ -1144,6 +2137,81 @@ static void markold (global_State *g, GCObject *from, GCObject *to) {
 }
 
 
+#if defined(LUA_USE_GCPAGES)
+
+/*
+** Generational versions of the functions above for objects in pages
+** (except those with finalizers, which are in lists): 'sweepgenpages'
+** works like 'sweepgen' or, if 'toold' is true, like 'sweep2old';
+** 'whitepages' works like 'whitelist'; 'markoldpages' like 'markold'.
+** As with lists, dead objects are always white.
+*/
+static void sweepgenpages (lua_State *L, global_State *g, int toold) {
+  int white = luaC_white(g);
+  GCPage **p = &g->pages;
+  while (*p != NULL) {
+    GCPage *pg = *p;
+    int i;
+    for (i = 0; i < GCPAGESLOTS; i++) {
+      int marked = pg->marks[i];
+      if (marked == FREESLOT || testbit(marked, FINALIZEDBIT))
+        continue;
+      if (testbits(marked, WHITEBITS)) {  /* dead? */
+        lua_assert(!isold(gcpageobj(pg, i)));
+        freeobj(L, gcpageobj(pg, i));
+      }
+      else if (toold)
+        pg->marks[i] = cast_byte((marked & ~AGEBITS) | G_OLD);
+      else {
+        if ((marked & AGEBITS) == G_NEW)
+          marked = (marked & maskgencolors) | white;
+        else if ((marked & AGEBITS) == G_SURVIVAL)  /* will be old? */
+          g->gcstats.promoted += objsize(gcpageobj(pg, i));
+        pg->marks[i] = cast_byte((marked & ~AGEBITS) |
+                                 nextage[marked & AGEBITS]);
+      }
+    }
+    p = checkemptypage(L, p);
+  }
+}
+
+
+static void whitepages (global_State *g) {
+  int white = luaC_white(g);
+  GCPage *pg;
+  int i;
+  for (pg = g->pages; pg != NULL; pg = pg->next) {
+    for (i = 0; i < GCPAGESLOTS; i++) {
+      int marked = pg->marks[i];
+      if (marked != FREESLOT && !testbit(marked, FINALIZEDBIT))
+        pg->marks[i] = cast_byte((marked & maskcolors) | white);
+    }
+  }
+}
+
+
+static void markoldpages (global_State *g) {
+  GCPage *pg;
+  int i;
+  for (pg = g->pages; pg != NULL; pg = pg->next) {
+    for (i = 0; i < GCPAGESLOTS; i++) {
+      int marked = pg->marks[i];
+      if (marked != FREESLOT && !testbit(marked, FINALIZEDBIT) &&
+          (marked & AGEBITS) == G_OLD1) {
+        GCObject *o = gcpageobj(pg, i);
+        lua_assert(!iswhite(o));
+        if (isblack(o)) {
+          black2gray(o);
+          reallymarkobject(g, o);
+        }
+      }
+    }
+  }
+}
+
+#endif
+
+
 /*
 ** Finish a young-generation collection.
 */
@@ -1164,10 +2232,15 @@ static void finishgencycle (lua_State *L, global_State *g) {
 */
 static void youngcollection (lua_State *L, global_State *g) {
   GCObject **psurvival;  /* to point to first non-dead survival object */
+  l_mem start = l_gcclock();
   lua_assert(g->gcstate == GCSpropagate);
   markold(g, g->survival, g->reallyold);
   markold(g, g->finobj, g->finobjrold);
+#if defined(LUA_USE_GCPAGES)
+  markoldpages(g);
+#endif
   atomic(L);
+  start = chargetime(g, LUA_GCPATOMIC, start);
 
   /* sweep nursery and get a pointer to its last live element */
   psurvival = sweepgen(L, g, &g->allgc, g->survival);
@@ -1186,8 +2259,13 @@ static void youngcollection (lua_State *L, global_State *g) {
   g->finobjsur = g->finobj;  /* all news are survivals */
 
   sweepgen(L, g, &g->tobefnz, NULL);
+#if defined(LUA_USE_GCPAGES)
+  sweepgenpages(L, g, 0);
+#endif
+  start = chargetime(g, LUA_GCPSWEEP, start);
 
   finishgencycle(L, g);
+  chargetime(g, LUA_GCPFINALIZE, start);
 }
 
 
@@ -1197,9 +2275,12 @@ static void youngcollection (lua_State *L, global_State *g) {
 ** objects into old and finishes the collection.
 */
 static void entergen (lua_State *L, global_State *g) {
+  l_mem start;
   luaC_runtilstate(L, bitmask(GCSpause));  /* prepare to start a new cycle */
   luaC_runtilstate(L, bitmask(GCSpropagate));  /* start new cycle */
+  start = l_gcclock();
   atomic(L);
+  start = chargetime(g, LUA_GCPATOMIC, start);
   /* sweep all elements making them old */
   sweep2old(L, &g->allgc);
   /* everything alive now is old */
@@ -1210,8 +2291,13 @@ static void entergen (lua_State *L, global_State *g) {
   g->finobjrold = g->finobjold = g->finobjsur = g->finobj;
 
   sweep2old(L, &g->tobefnz);
+#if defined(LUA_USE_GCPAGES)
+  sweepgenpages(L, g, 1);
+#endif
+  start = chargetime(g, LUA_GCPSWEEP, start);
 
   finishgencycle(L, g);
+  chargetime(g, LUA_GCPFINALIZE, start);
   g->gckind = KGC_GEN;
   g->GCestimate = gettotalbytes(g);  /* base for memory control */
 }
@@ -1228,6 +2314,9 @@ static void enterinc (global_State *g) {
   whitelist(g, g->finobj);
   g->finobjrold = g->finobjold = g->finobjsur = NULL;
   lua_assert(g->tobefnz == NULL);  /* no need to sweep */
+#if defined(LUA_USE_GCPAGES)
+  whitepages(g);
+#endif
   g->gcstate = GCSpause;
   g->gckind = KGC_INC;
 }
@@ -1253,6 +2342,8 @@ void luaC_changemode (lua_State *L, int newmode) {
 static void fullgen (lua_State *L, global_State *g) {
   enterinc(g);
   entergen(L, g);
+  g->gcstats.major++;
+  endstatscycle(g);
 }
 
 
@@ -1274,6 +2365,8 @@ static void genstep (lua_State *L, global_State *g) {
   else {
     lu_mem mem;
     youngcollection(L, g);
+    g->gcstats.minor++;
+    endstatscycle(g);
     mem = gettotalbytes(g);
     luaE_setdebt(g, -(cast(l_mem, (mem / 100)) * g->genminormul));
     g->GCestimate = majorbase;  /* preserve base value */
@@ -1290,6 +2383,24 @@ static void genstep (lua_State *L, global_State *g) {
 */
 
 
+/*
+** Threshold to start a new cycle with the time-based pacer. The
+** target heap size for the cycle ('goal') is 'growth' percent of the
+** live data; the cycle starts 'trigger' percent of the way up to it.
+*/
+#define pacedgoal(p,live)  \
+	(((live) / 100) * cast(lu_mem, ((p)->growth > 100) ? (p)->growth : 100))
+
+static l_mem pacedthreshold (global_State *g) {
+  GCPacer *p = &g->pacer;
+  lu_mem estimate = g->GCestimate;
+  p->goal = pacedgoal(p, estimate);
+  p->peak = 0;
+  p->work = 0;
+  return cast(l_mem, estimate + (p->goal - estimate) / 100 * p->trigger);
+}
+
+
 /*
 ** Set the "time" to wait before starting a new GC cycle; cycle will
 ** start when memory use hits the threshold of ('estimate' * pause /
@@ -1301,9 +2412,12 @@ static void setpause (global_State *g) {
   int pause = getgcparam(g->gcpause);
   l_mem estimate = g->GCestimate / PAUSEADJ;  /* adjust 'estimate' */
   lua_assert(estimate > 0);
-  threshold = (pause < MAX_LMEM / estimate)  /* overflow? */
-            ? estimate * pause  /* no overflow */
-            : MAX_LMEM;  /* overflow; truncate to maximum */
+  if (g->pacer.steptime > 0)  /* time-based pacing? */
+    threshold = pacedthreshold(g);
+  else
+    threshold = (pause < MAX_LMEM / estimate)  /* overflow? */
+              ? estimate * pause  /* no overflow */
+              : MAX_LMEM;  /* overflow; truncate to maximum */
   debt = gettotalbytes(g) - threshold;
   if (debt > 0) debt = 0;
   luaE_setdebt(g, debt);
@@ -1321,6 +2435,9 @@ static void entersweep (lua_State *L) {
   global_State *g = G(L);
   g->gcstate = GCSswpallgc;
   lua_assert(g->sweepgc == NULL);
+#if defined(LUA_USE_GCPAGES)
+  g->sweeppage = &g->pages;
+#endif
   g->sweepgc = sweeptolive(L, &g->allgc);
 }
 
@@ -1338,16 +2455,61 @@ static void deletelist (lua_State *L, GCObject *p, GCObject *limit) {
 }
 
 
+/*
+** Release the shared chunk used by prototype 'o', if any.
+*/
+static void releasechunk (GCObject *o) {
+  if (o->tt == LUA_TPROTO && gco2p(o)->shared != NULL)
+    luaF_releasechunk(gco2p(o)->shared->chunk);
+}
+
+
+/*
+** Release the shared chunks used by all prototypes in the state. Arena
+** states do not free their objects one by one, but these chunks live
+** outside the arena, and other states may still be using them.
+*/
+static void releaseallchunks (global_State *g) {
+  GCObject *o;
+#if defined(LUA_USE_GCPAGES)
+  GCPage *pg;
+  for (pg = g->pages; pg != NULL; pg = pg->next) {
+    int i;
+    if (pg->cls != pageclass(LUA_TPROTO))
+      continue;
+    for (i = 0; i < GCPAGESLOTS; i++) {
+      if (pg->marks[i] != FREESLOT)
+        releasechunk(gcpageobj(pg, i));
+    }
+  }
+#endif
+  for (o = g->allgc; o != NULL; o = o->next)
+    releasechunk(o);
+  for (o = g->fixedgc; o != NULL; o = o->next)
+    releasechunk(o);
+}
+
+
 /*
 ** Call all finalizers of the objects in the given Lua state, and
 ** then free all objects, except for the main thread.
 */
 void luaC_freeallobjects (lua_State *L) {
   global_State *g = G(L);
+  luaC_parallel(L, 0);  /* stop helper threads */
+  luaC_bgsweep(L, 0);  /* stop sweeper (after it frees pending blocks) */
   luaC_changemode(L, KGC_INC);
   separatetobefnz(g, 1);  /* separate all objects with finalizers */
   lua_assert(g->finobj == NULL);
   callallpendingfinalizers(L);
+  if (g->gcarena) {  /* memory will be released in bulk? */
+    luaJ_freeall(L);  /* release what lives outside that memory */
+    releaseallchunks(g);
+    return;
+  }
+#if defined(LUA_USE_GCPAGES)
+  deletepages(L);
+#endif
   deletelist(L, g->allgc, obj2gco(g->mainthread));
   deletelist(L, g->finobj, NULL);
   deletelist(L, g->fixedgc, NULL);  /* collect fixed objects */
@@ -1368,6 +2530,7 @@ static lu_mem atomic (lua_State *L) {
   /* registry and global metatables may be changed by API */
   markvalue(g, &g->l_registry);
   markmt(g);  /* mark global metatables */
+  markprofiler(g);
   /* remark occasional upvalues of (maybe) dead threads */
   work += remarkupvals(g);
   work += propagateall(g);  /* propagate changes */
@@ -1391,6 +2554,8 @@ static lu_mem atomic (lua_State *L) {
   clearvalues(g, g->weak, origweak);
   clearvalues(g, g->allweak, origall);
   luaS_clearcache(g);
+  luaV_clearidxcache(g);  /* cached slots may be in dead objects */
+  luaH_clearsites(g);  /* dead tables give their final sizes */
   clearprotolist(g);
   g->currentwhite = cast_byte(otherwhite(g));  /* flip current white */
   lua_assert(g->gray == NULL);
@@ -1398,12 +2563,29 @@ static lu_mem atomic (lua_State *L) {
 }
 
 
+#if defined(LUA_USE_GCPAGES)
+
+static int sweeppagestep (lua_State *L, global_State *g) {
+  l_mem olddebt = g->GCdebt;
+  int count;
+  deferfrees(g, 1);
+  g->sweeppage = sweeppages(L, g->sweeppage, GCSWEEPMAX, &count);
+  deferfrees(g, 0);
+  g->GCestimate += g->GCdebt - olddebt;  /* update estimate */
+  return count;
+}
+
+#endif
+
+
 static int sweepstep (lua_State *L, global_State *g,
                       int nextstate, GCObject **nextlist) {
   if (g->sweepgc) {
     l_mem olddebt = g->GCdebt;
     int count;
+    deferfrees(g, 1);
     g->sweepgc = sweeplist(L, g->sweepgc, GCSWEEPMAX, &count);
+    deferfrees(g, 0);
     g->GCestimate += g->GCdebt - olddebt;  /* update estimate */
     return count;
   }
@@ -1439,6 +2621,10 @@ static lu_mem singlestep (lua_State *L) {
       return work;
     }
     case GCSswpallgc: {  /* sweep "regular" objects */
+#if defined(LUA_USE_GCPAGES)
+      if (g->sweeppage != NULL)  /* pages first */
+        return sweeppagestep(L, g);
+#endif
       return sweepstep(L, g, GCSswpfinobj, &g->finobj);
     }
     case GCSswpfinobj: {  /* sweep objects with finalizers */
@@ -1448,6 +2634,7 @@ static lu_mem singlestep (lua_State *L) {
       return sweepstep(L, g, GCSswpend, NULL);
     }
     case GCSswpend: {  /* finish sweeps */
+      flushsweeper(g);  /* hand remaining frees to the sweeper */
       checkSizes(L, g);
       g->gcstate = GCScallfin;
       return 0;
@@ -1467,14 +2654,47 @@ static lu_mem singlestep (lua_State *L) {
 }
 
 
+/* phase (for statistics) of each state of the collector */
+#define gcphase(s)  \
+	((s) == GCSpropagate || (s) == GCSpause ? LUA_GCPPROPAGATE : \
+	 (s) <= GCSatomic ? LUA_GCPATOMIC : \
+	 (s) == GCScallfin ? LUA_GCPFINALIZE : LUA_GCPSWEEP)
+
+
+/*
+** Perform a single step, charging its time to the phase where it
+** started. To avoid reading the clock at each step, '*start' keeps
+** the time when the current phase started (in this sequence of
+** steps), and the clock is read only when the phase changes. After
+** the last step, 'stoptimer' charges the time of the current phase.
+*/
+static lu_mem timedstep (lua_State *L, l_mem *start) {
+  global_State *g = G(L);
+  int phase = gcphase(g->gcstate);
+  lu_mem work = singlestep(L);
+  if (gcphase(g->gcstate) != phase) {  /* entered a new phase? */
+    *start = chargetime(g, phase, *start);
+    if (g->gcstate == GCSpause) {  /* finished a cycle? */
+      g->gcstats.cycles++;
+      endstatscycle(g);
+    }
+  }
+  return work;
+}
+
+#define stoptimer(g,start)	chargetime(g, gcphase((g)->gcstate), start)
+
+
 /*
 ** advances the garbage collector until it reaches a state allowed
 ** by 'statemask'
 */
 void luaC_runtilstate (lua_State *L, int statesmask) {
   global_State *g = G(L);
+  l_mem start = l_gcclock();
   while (!testbit(statesmask, g->gcstate))
-    singlestep(L);
+    timedstep(L, &start);
+  stoptimer(g, start);
 }
 
 
@@ -1491,10 +2711,12 @@ static void incstep (lua_State *L, global_State *g) {
   l_mem stepsize = (g->gcstepsize <= log2maxs(l_mem))
                  ? ((cast(l_mem, 1) << g->gcstepsize) / WORK2MEM) * stepmul
                  : MAX_LMEM;  /* overflow; keep maximum value */
+  l_mem start = l_gcclock();
   do {  /* repeat until pause or enough "credit" (negative debt) */
-    lu_mem work = singlestep(L);  /* perform one single step */
+    lu_mem work = timedstep(L, &start);  /* perform one single step */
     debt -= work;
   } while (debt > -stepsize && g->gcstate != GCSpause);
+  stoptimer(g, start);
   if (g->gcstate == GCSpause)
     setpause(g);  /* pause until next cycle */
   else {
@@ -1503,16 +2725,68 @@ static void incstep (lua_State *L, global_State *g) {
   }
 }
 
+/*
+** Performs a step for the time-based pacer. The step does as much
+** work as the measured rate of the current phase (marking or sweeping)
+** allows in 'steptime' microseconds. Then it schedules the next step
+** so that the remaining work of the cycle (estimated by the work of
+** the previous cycle) finishes before the heap reaches 'goal'. Each
+** cycle that reaches its goal makes the next ones start a little
+** later, and each cycle that overshoots it makes them start earlier.
+*/
+static void pacedstep (lua_State *L, global_State *g) {
+  GCPacer *p = &g->pacer;
+  int phase = (g->gcstate == GCSpause || keepinvariant(g)) ? 0 : 1;
+  lu_mem budget = p->rate[phase] * p->steptime / 1000 + 1;
+  lu_mem work = 0;
+  lu_mem measured, total;
+  l_mem elapsed;
+  l_mem start = l_gcclock();
+  l_mem timer = start;
+  if (p->goal == 0)  /* pacer just turned on? */
+    p->goal = pacedgoal(p, gettotalbytes(g));
+  do {  /* repeat until pause or budget spent */
+    work += timedstep(L, &timer);
+  } while (work < budget && g->gcstate != GCSpause);
+  stoptimer(g, timer);
+  elapsed = l_gcclock() - start;
+  measured = work * 1000 / ((elapsed > 0) ? cast(lu_mem, elapsed) : 1);
+  if (measured > 2 * p->rate[phase])  /* limit effect of clock jitter */
+    measured = 2 * p->rate[phase];
+  p->rate[phase] = (3 * p->rate[phase] + measured) / 4 + 1;
+  total = gettotalbytes(g);
+  if (total > p->peak)
+    p->peak = total;
+  p->work += work;
+  if (g->gcstate == GCSpause) {  /* end of cycle? */
+    if (p->peak > p->goal)
+      p->trigger = (p->trigger > 10) ? p->trigger - 10 : 0;
+    else if (p->trigger < 95)
+      p->trigger += 5;
+    p->lastwork = p->work;
+    setpause(g);  /* pause until next cycle */
+  }
+  else {
+    lu_mem cyclework = (p->lastwork > 0) ? p->lastwork : total / WORK2MEM;
+    lu_mem left = (cyclework > p->work) ? cyclework - p->work : budget;
+    lu_mem room = (p->goal > total) ? p->goal - total : 0;
+    luaE_setdebt(g, -cast(l_mem, room / (left / budget + 1)));
+  }
+}
+
+
 /*
 ** performs a basic GC step if collector is running
 */
 void luaC_step (lua_State *L) {
   global_State *g = G(L);
   if (g->gcrunning) {  /* running? */
-    if (g->gckind == KGC_INC)
-      incstep(L, g);
-    else
+    if (g->gckind == KGC_GEN)
       genstep(L, g);
+    else if (g->pacer.steptime > 0)
+      pacedstep(L, g);
+    else
+      incstep(L, g);
   }
 }
 
@@ -1525,10 +2799,15 @@ void luaC_step (lua_State *L) {
 ** changed, nothing will be collected).
 */
 static void fullinc (lua_State *L, global_State *g) {
+  l_mem start;
   if (keepinvariant(g))  /* black objects? */
     entersweep(L); /* sweep everything to turn them back to white */
   /* finish any pending sweep phase to start a new cycle */
   luaC_runtilstate(L, bitmask(GCSpause));
+  luaC_runtilstate(L, bitmask(GCSpropagate));  /* start new collection */
+  start = l_gcclock();
+  propagateall(g);  /* propagate all marks at once */
+  chargetime(g, LUA_GCPPROPAGATE, start);
   luaC_runtilstate(L, bitmask(GCScallfin));  /* run up to finalizers */
   /* estimate must be correct after a full GC cycle */
   lua_assert(g->GCestimate == gettotalbytes(g));
@@ -1550,6 +2829,8 @@ void luaC_fullgc (lua_State *L, int isemergency) {
     fullinc(L, g);
   else
     fullgen(L, g);
+  if (isemergency)
+    waitsweeper(g);  /* memory freed by the collector must be available */
   g->gcemergency = 0;
 }
 
@@ -81,19 +81,74 @@
 #define WHITEBITS	bit2mask(WHITE0BIT, WHITE1BIT)
 
 
-#define iswhite(x)      testbits((x)->marked, WHITEBITS)
-#define isblack(x)      testbit((x)->marked, BLACKBIT)
+#if defined(LUA_USE_GCPAGES)
+
+/*
+** Tables, upvalues, and prototypes (all with a fixed size) live in
+** pages segregated by size, with GCPAGESLOTS objects per page. The
+** 'marked' byte of each of these objects lives in the array 'marks'
+** of its page, so that the sweep scans only that array and never
+** touches live objects. The 'marked' field in the object itself keeps
+** its index in the page (which, with the object size, gives the page
+** address). Objects with finalizers are also linked in the 'finobj'
+** and 'tobefnz' lists, through their 'next' field, and are swept by
+** the sweep of these lists.
+*/
+
+#define GCPAGESLOTS	256
+
+/* mark of a free slot (a combination impossible in a live object) */
+#define FREESLOT	(WHITEBITS | bitmask(BLACKBIT))
+
+#define ispagedtt(t)	((t) == LUA_TTABLE || (t) == LUA_TUPVAL || (t) == LUA_TPROTO)
+
+/* size class of each paged type (NPAGECLASSES in lstate.h) */
+#define pageclass(t)	((t) == LUA_TTABLE ? 0 : (t) == LUA_TUPVAL ? 1 : 2)
+#define classsize(c)  \
+	((c) == 0 ? sizeof(Table) : (c) == 1 ? sizeof(UpVal) : sizeof(Proto))
+
+typedef struct GCPage {
+  struct GCPage *next;  /* next page in the list of all pages */
+  struct GCPage *nextfree;  /* list of pages (of this class) with */
+  struct GCPage *prevfree;  /*   free slots */
+  unsigned short nfree;  /* number of free slots */
+  lu_byte cls;  /* size class */
+  lu_byte marks[GCPAGESLOTS];
+  union {
+    LUAI_MAXALIGN;  /* ensures maximum alignment for objects */
+  } objs[1];
+} GCPage;
+
+#define gcpageobj(pg,i)  \
+	cast(GCObject *, cast(char *, (pg)->objs) + (i) * classsize((pg)->cls))
+
+#define gcpageof(o)  cast(GCPage *, cast(char *, o) - offsetof(GCPage, objs) \
+	- (o)->marked * classsize(pageclass((o)->tt)))
+
+#define gcmarked(o)  \
+	(*(ispagedtt((o)->tt) ? &gcpageof(o)->marks[(o)->marked] : &(o)->marked))
+
+#else
+
+#define ispagedtt(t)	0
+#define gcmarked(o)	((o)->marked)
+
+#endif
+
+
+#define iswhite(x)      testbits(gcmarked(x), WHITEBITS)
+#define isblack(x)      testbit(gcmarked(x), BLACKBIT)
 #define isgray(x)  /* neither white nor black */  \
-	(!testbits((x)->marked, WHITEBITS | bitmask(BLACKBIT)))
+	(!testbits(gcmarked(x), WHITEBITS | bitmask(BLACKBIT)))
 
-#define tofinalize(x)	testbit((x)->marked, FINALIZEDBIT)
+#define tofinalize(x)	testbit(gcmarked(x), FINALIZEDBIT)
 
 #define otherwhite(g)	((g)->currentwhite ^ WHITEBITS)
 #define isdeadm(ow,m)	((m) & (ow))
-#define isdead(g,v)	isdeadm(otherwhite(g), (v)->marked)
+#define isdead(g,v)	isdeadm(otherwhite(g), gcmarked(v))
 
-#define changewhite(x)	((x)->marked ^= WHITEBITS)
-#define gray2black(x)	l_setbit((x)->marked, BLACKBIT)
+#define changewhite(x)	(gcmarked(x) ^= WHITEBITS)
+#define gray2black(x)	l_setbit(gcmarked(x), BLACKBIT)
 
 #define luaC_white(g)	cast(lu_byte, (g)->currentwhite & WHITEBITS)
 
@@ -109,12 +164,12 @@
 
 #define AGEBITS		7  /* all age bits (111) */
 
-#define getage(o)	((o)->marked & AGEBITS)
-#define setage(o,a)  ((o)->marked = cast_byte(((o)->marked & (~AGEBITS)) | a))
+#define getage(o)	(gcmarked(o) & AGEBITS)
+#define setage(o,a)  (gcmarked(o) = cast_byte((gcmarked(o) & (~AGEBITS)) | a))
 #define isold(o)	(getage(o) > G_SURVIVAL)
 
 #define changeage(o,f,t)  \
-	check_exp(getage(o) == (f), (o)->marked ^= ((f)^(t)))
+	check_exp(getage(o) == (f), gcmarked(o) ^= ((f)^(t)))
 
 
 /* Default Values for GC parameters */
@@ -136,6 +191,15 @@
 /* how much to allocate before next GC step (log2) */
 #define LUAI_GCSTEPSIZE 13      /* 8 KB */
 
+/* time-based pacer: let heap grow up to twice the live data */
+#define LUAI_GCGROWTH   200     /* 200% */
+
+/* time-based pacer: start cycles half way up to the target heap size */
+#define LUAI_GCTRIGGER  50      /* 50% */
+
+/* time-based pacer: initial guess of units of work per millisecond */
+#define LUAI_GCRATE     20000
+
 
 /*
 ** Does one step of collection when debt becomes positive. 'pre'/'pos'
@@ -172,11 +236,23 @@ LUAI_FUNC void luaC_step (lua_State *L);
 LUAI_FUNC void luaC_runtilstate (lua_State *L, int statesmask);
 LUAI_FUNC void luaC_fullgc (lua_State *L, int isemergency);
 LUAI_FUNC GCObject *luaC_newobj (lua_State *L, int tt, size_t sz);
+LUAI_FUNC void luaC_adoptobj (lua_State *L, GCObject *o, size_t sz);
 LUAI_FUNC void luaC_barrier_ (lua_State *L, GCObject *o, GCObject *v);
 LUAI_FUNC void luaC_barrierback_ (lua_State *L, Table *o);
 LUAI_FUNC void luaC_protobarrier_ (lua_State *L, Proto *p);
+
+/* free the block of a table, an upvalue, or a prototype */
+#if defined(LUA_USE_GCPAGES)
+LUAI_FUNC void luaC_freeslot (lua_State *L, GCObject *o);
+#define luaC_freeobj(L,o)	luaC_freeslot(L, obj2gco(o))
+#else
+#define luaC_freeobj(L,o)	luaM_free(L, o)
+#endif
 LUAI_FUNC void luaC_checkfinalizer (lua_State *L, GCObject *o, Table *mt);
 LUAI_FUNC void luaC_changemode (lua_State *L, int newmode);
+LUAI_FUNC int luaC_parallel (lua_State *L, int n);
+LUAI_FUNC int luaC_bgsweep (lua_State *L, int on);
+LUAI_FUNC int luaC_deferfree (global_State *g, void *block, size_t osize);
 
 
 #endif
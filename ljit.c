@@ -0,0 +1,1128 @@
+/*
+** $Id: ljit.c $
+** Baseline compiler from Lua bytecode to machine code
+** See Copyright Notice in lua.h
+*/
+
+#define ljit_c
+#define LUA_CORE
+
+/* 'MAP_ANONYMOUS' is not in POSIX 2001 */
+#if !defined(_DEFAULT_SOURCE)
+#define _DEFAULT_SOURCE
+#endif
+#if !defined(_DARWIN_C_SOURCE)
+#define _DARWIN_C_SOURCE
+#endif
+
+#include "lprefix.h"
+
+
+#include <stddef.h>
+#include <string.h>
+
+#include "lua.h"
+
+#include "lgc.h"
+#include "ljit.h"
+#include "lobject.h"
+#include "lopcodes.h"
+#include "lstate.h"
+#include "ltable.h"
+
+
+#if LUA_USE_JIT
+
+
+/*
+** This is a template compiler for x86-64 (System V ABI): each
+** instruction is translated in isolation to a fixed sequence of machine
+** instructions, keeping all Lua values in the stack (with the same layout
+** used by the interpreter). Only the fast paths of a subset of opcodes
+** (moves, loads, arithmetic and comparisons on numbers, numerical loops,
+** jumps, and integer indexing of array parts) are compiled. Any other
+** instruction, or any case outside a fast path (e.g., a type that is not
+** a number, a metamethod, a possible error), leaves the machine code
+** *before* executing the instruction, returning its index to
+** 'luaV_execute', which goes on interpreting from there. Compiled code
+** never calls functions, allocates memory, or raises errors, so it
+** does not need to keep 'savedpc' or 'L->top' updated. Backward jumps
+** check 'trap', so that hooks and signals can stop loops.
+*/
+
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+
+/* type of the entry trampoline of compiled code */
+typedef int (*JitFunction) (StkId base, const TValue *k, CallInfo *ci,
+                            LClosure *cl, const void *target);
+
+/*
+** Macro to convert pointer-to-void* to pointer-to-function. This cast
+** is undefined according to ISO C, but POSIX assumes that it works.
+** (The '__extension__' in gnu compilers is only to avoid warnings.)
+*/
+#define cast_jitf(p)	(__extension__ (JitFunction)(p))
+
+
+/* x86-64 registers */
+enum { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+       R8, R9, R10, R11, R12, R13, R14, R15 };
+
+/* registers holding the arguments of the compiled function */
+#define RBASE	RBX
+#define RKST	R12
+#define RCI	R13
+#define RCL	R14
+
+/* condition codes */
+#define CC_B	0x2
+#define CC_AE	0x3
+#define CC_E	0x4
+#define CC_NE	0x5
+#define CC_A	0x7
+#define CC_P	0xA
+#define CC_L	0xC
+#define CC_LE	0xE
+#define CC_G	0xF
+
+/* integer opcodes ('op r/m64, r64' form) */
+#define OPADD	0x01
+#define OPOR	0x09
+#define OPAND	0x21
+#define OPSUB	0x29
+#define OPXOR	0x31
+#define OPCMP	0x39
+#define OPIMUL	0xAF  /* two-byte 'imul r64, r/m64' */
+
+/* extensions for 'op r/m64, imm32' (opcode 0x81) */
+#define EXTADD	0
+#define EXTSUB	5
+#define EXTCMP	7
+
+/* SSE2 opcodes (after prefix 0xF2 and 0x0F) */
+#define SSEADD	0x58
+#define SSEMUL	0x59
+#define SSESUB	0x5C
+#define SSEDIV	0x5E
+
+
+/* maximum size of the code for one instruction */
+#define MAXINSTSIZE	256
+
+/* size of an exit stub ('mov eax, imm32; jmp rel32') */
+#define EXITSIZE	10
+
+/* maximum number of jumps to patch for one instruction */
+#define MAXINSTFIX	16
+
+
+#define VALOFS		cast_int(offsetof(TValue, value_))
+#define TAGOFS		cast_int(offsetof(TValue, tt_))
+
+/* (base register, offset) of register 'r' and of constant 'c' */
+#define vR(r)		RBASE, cast_int((r) * sizeof(StackValue))
+#define vK(c)		RKST, cast_int((c) * sizeof(TValue))
+
+
+typedef struct Fixup {
+  int pos;  /* position of a 'rel32' to be patched */
+  int target;  /* index of target instruction */
+  int isexit;  /* true if jump goes to the exit stub of 'target' */
+} Fixup;
+
+
+typedef struct JitState {
+  Proto *p;
+  lu_byte *buff;  /* buffer for the code */
+  int n;  /* current position in 'buff' */
+  int *label;  /* position of each instruction in 'buff' */
+  int *exitlabel;  /* position of each exit stub (or -1) */
+  Fixup *fix;
+  int nfix;
+  int epilogue;  /* position of the epilogue */
+} JitState;
+
+
+/*
+** {======================================================
+** Machine-code emission
+** =======================================================
+*/
+
+static void b1 (JitState *J, int c) {
+  J->buff[J->n++] = cast_byte(c);
+}
+
+
+static void put4 (lu_byte *p, int v) {
+  unsigned int u = cast(unsigned int, v);
+  p[0] = cast_byte(u); p[1] = cast_byte(u >> 8);
+  p[2] = cast_byte(u >> 16); p[3] = cast_byte(u >> 24);
+}
+
+
+static void b4 (JitState *J, int v) {
+  put4(J->buff + J->n, v);
+  J->n += 4;
+}
+
+
+static void rex (JitState *J, int w, int r, int b) {
+  int x = 0x40 | (w << 3) | ((r & 8) >> 1) | ((b & 8) >> 3);
+  if (x != 0x40)
+    b1(J, x);
+}
+
+
+/* ModRM for memory operand '[b + disp32]' */
+static void modrmM (JitState *J, int r, int b, int disp) {
+  b1(J, 0x80 | ((r & 7) << 3) | (b & 7));
+  if ((b & 7) == RSP)  /* 'rsp' and 'r12' need a SIB byte */
+    b1(J, 0x24);
+  b4(J, disp);
+}
+
+
+/* ModRM for register operand */
+static void modrmR (JitState *J, int r, int b) {
+  b1(J, 0xC0 | ((r & 7) << 3) | (b & 7));
+}
+
+
+/* 'op r, [b + disp]' */
+static void opM (JitState *J, int w, int op, int r, int b, int disp) {
+  rex(J, w, r, b);
+  b1(J, op);
+  modrmM(J, r, b, disp);
+}
+
+
+/* two-byte opcode (with optional mandatory prefix), memory operand */
+static void op2M (JitState *J, int pfx, int w, int op, int r, int b,
+                                                           int disp) {
+  if (pfx) b1(J, pfx);
+  rex(J, w, r, b);
+  b1(J, 0x0F); b1(J, op);
+  modrmM(J, r, b, disp);
+}
+
+
+/* two-byte opcode (with optional mandatory prefix), register operand */
+static void op2R (JitState *J, int pfx, int w, int op, int r, int b) {
+  if (pfx) b1(J, pfx);
+  rex(J, w, r, b);
+  b1(J, 0x0F); b1(J, op);
+  modrmR(J, r, b);
+}
+
+
+/* 'op dst, src' for integer operations */
+static void aluR (JitState *J, int op, int dst, int src) {
+  if (op == OPIMUL)
+    op2R(J, 0, 1, OPIMUL, dst, src);
+  else {
+    rex(J, 1, src, dst);
+    b1(J, op);
+    modrmR(J, src, dst);
+  }
+}
+
+
+/* 'op dst, imm32' for integer operations (extension 'ext') */
+static void aluI (JitState *J, int ext, int dst, int imm) {
+  rex(J, 1, 0, dst);
+  b1(J, 0x81);
+  modrmR(J, ext, dst);
+  b4(J, imm);
+}
+
+
+static void imulI (JitState *J, int dst, int imm) {
+  rex(J, 1, dst, dst);
+  b1(J, 0x69);
+  modrmR(J, dst, dst);
+  b4(J, imm);
+}
+
+
+/* 'mov r, imm32' (sign extended to 64 bits) */
+static void movI (JitState *J, int r, int imm) {
+  rex(J, 1, 0, r);
+  b1(J, 0xC7);
+  modrmR(J, 0, r);
+  b4(J, imm);
+}
+
+
+static void load64 (JitState *J, int r, int b, int disp) {
+  opM(J, 1, 0x8B, r, b, disp);
+}
+
+
+static void store64 (JitState *J, int b, int disp, int r) {
+  opM(J, 1, 0x89, r, b, disp);
+}
+
+
+/* load value field of TValue at (b, d) */
+static void ldval (JitState *J, int r, int b, int d) {
+  load64(J, r, b, d + VALOFS);
+}
+
+
+/* store value field of TValue at (b, d) */
+static void stval (JitState *J, int b, int d, int r) {
+  store64(J, b, d + VALOFS, r);
+}
+
+
+/* 'mov byte [b + disp + TAGOFS], tag' */
+static void settag (JitState *J, int b, int disp, int tag) {
+  opM(J, 0, 0xC6, 0, b, disp + TAGOFS);
+  b1(J, tag);
+}
+
+
+/* 'cmp byte [b + disp + TAGOFS], tag' */
+static void cmptag (JitState *J, int b, int disp, int tag) {
+  opM(J, 0, 0x80, 7, b, disp + TAGOFS);
+  b1(J, tag);
+}
+
+
+/* 'test byte [b + disp], mask' */
+static void testbyte (JitState *J, int b, int disp, int mask) {
+  opM(J, 0, 0xF6, 0, b, disp);
+  b1(J, mask);
+}
+
+
+/* copy TValue at (sb, sd) to (db, dd), using 'rdx' and 'r8' */
+static void copytv (JitState *J, int db, int dd, int sb, int sd) {
+  ldval(J, RDX, sb, sd);
+  op2M(J, 0, 0, 0xB6, R8, sb, sd + TAGOFS);  /* movzx r8d, tag */
+  stval(J, db, dd, RDX);
+  opM(J, 0, 0x88, R8, db, dd + TAGOFS);  /* mov tag, r8b */
+}
+
+
+static void setint (JitState *J, int b, int disp, int r) {
+  stval(J, b, disp, r);
+  settag(J, b, disp, LUA_TNUMINT);
+}
+
+
+static void setflt (JitState *J, int b, int disp, int x) {
+  op2M(J, 0xF2, 0, 0x11, x, b, disp + VALOFS);  /* movsd [], xmm */
+  settag(J, b, disp, LUA_TNUMFLT);
+}
+
+
+static void ldflt (JitState *J, int x, int b, int disp) {
+  op2M(J, 0xF2, 0, 0x10, x, b, disp + VALOFS);  /* movsd xmm, [] */
+}
+
+
+/* 'cvtsi2sd x, r' */
+static void int2flt (JitState *J, int x, int r) {
+  op2R(J, 0xF2, 1, 0x2A, x, r);
+}
+
+
+/* 'ucomisd x1, x2' */
+static void fltcmp (JitState *J, int x1, int x2) {
+  op2R(J, 0x66, 0, 0x2E, x1, x2);
+}
+
+
+/* emits a conditional jump and returns the position of its offset */
+static int jcc (JitState *J, int cc) {
+  b1(J, 0x0F); b1(J, 0x80 | cc);
+  b4(J, 0);
+  return J->n - 4;
+}
+
+
+/* emits a jump and returns the position of its offset */
+static int jmp (JitState *J) {
+  b1(J, 0xE9);
+  b4(J, 0);
+  return J->n - 4;
+}
+
+
+static void patch (JitState *J, int pos, int target) {
+  put4(J->buff + pos, target - (pos + 4));
+}
+
+
+/* makes jump at 'pos' go to current position */
+#define here(J,pos)	patch(J, pos, (J)->n)
+
+
+static void addfix (JitState *J, int pos, int target, int isexit) {
+  Fixup *f = &J->fix[J->nfix++];
+  f->pos = pos;
+  f->target = target;
+  f->isexit = isexit;
+}
+
+
+/* jumps to the code of instruction 'pc' */
+#define jccinst(J,cc,pc)	addfix(J, jcc(J, cc), pc, 0)
+#define jmpinst(J,pc)		addfix(J, jmp(J), pc, 0)
+
+/* leave the machine code, to interpret instruction 'pc' */
+#define jccexit(J,cc,pc)	addfix(J, jcc(J, cc), pc, 1)
+#define jmpexit(J,pc)		addfix(J, jmp(J), pc, 1)
+
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** Translation of instructions
+** =======================================================
+*/
+
+/*
+** Load the number at (b, d) into 'x', converting integers to floats;
+** leave to instruction 'pc' if it is not a number.
+*/
+static void tonumber (JitState *J, int x, int b, int d, int pc) {
+  int l1, l2;
+  cmptag(J, b, d, LUA_TNUMFLT);
+  l1 = jcc(J, CC_NE);
+  ldflt(J, x, b, d);
+  l2 = jmp(J);
+  here(J, l1);
+  cmptag(J, b, d, LUA_TNUMINT);
+  jccexit(J, CC_NE, pc);
+  op2M(J, 0xF2, 1, 0x2A, x, b, d + VALOFS);  /* cvtsi2sd x, [] */
+  here(J, l2);
+}
+
+
+/*
+** R(A) := R(B) op R(C). 'iop' is the integer operation (or -1, for
+** operations that always produce floats); 'fop' is the float one.
+*/
+static void arithRR (JitState *J, int pc, Instruction i, int iop, int fop) {
+  int a = GETARG_A(i); int b = GETARG_B(i); int c = GETARG_C(i);
+  int ldone = -1;
+  if (iop >= 0) {
+    int l1, l2;
+    cmptag(J, vR(b), LUA_TNUMINT);
+    l1 = jcc(J, CC_NE);
+    cmptag(J, vR(c), LUA_TNUMINT);
+    l2 = jcc(J, CC_NE);
+    ldval(J, RAX, vR(b));
+    ldval(J, RCX, vR(c));
+    aluR(J, iop, RAX, RCX);
+    setint(J, vR(a), RAX);
+    ldone = jmp(J);
+    here(J, l1); here(J, l2);
+  }
+  tonumber(J, 0, vR(b), pc);
+  tonumber(J, 1, vR(c), pc);
+  op2R(J, 0xF2, 0, fop, 0, 1);
+  setflt(J, vR(a), 0);
+  if (ldone >= 0)
+    here(J, ldone);
+}
+
+
+/* R(A) := R(B) op sC */
+static void arithRI (JitState *J, int pc, Instruction i, int iop, int fop) {
+  int a = GETARG_A(i); int b = GETARG_B(i); int ic = GETARG_sC(i);
+  int ldone = -1;
+  if (iop >= 0) {
+    int l1;
+    cmptag(J, vR(b), LUA_TNUMINT);
+    l1 = jcc(J, CC_NE);
+    ldval(J, RAX, vR(b));
+    if (iop == OPIMUL)
+      imulI(J, RAX, ic);
+    else
+      aluI(J, (iop == OPADD) ? EXTADD : EXTSUB, RAX, ic);
+    setint(J, vR(a), RAX);
+    ldone = jmp(J);
+    here(J, l1);
+  }
+  tonumber(J, 0, vR(b), pc);
+  movI(J, RAX, ic);
+  int2flt(J, 1, RAX);
+  op2R(J, 0xF2, 0, fop, 0, 1);
+  setflt(J, vR(a), 0);
+  if (ldone >= 0)
+    here(J, ldone);
+}
+
+
+/*
+** R(A) := R(B) op R(C) (or K(C), which is always an integer), for
+** bitwise operations on integers
+*/
+static void bitwise (JitState *J, int pc, Instruction i, int op, int isk) {
+  int a = GETARG_A(i); int b = GETARG_B(i); int c = GETARG_C(i);
+  cmptag(J, vR(b), LUA_TNUMINT);
+  jccexit(J, CC_NE, pc);
+  if (isk)
+    ldval(J, RCX, vK(c));
+  else {
+    cmptag(J, vR(c), LUA_TNUMINT);
+    jccexit(J, CC_NE, pc);
+    ldval(J, RCX, vR(c));
+  }
+  ldval(J, RAX, vR(b));
+  aluR(J, op, RAX, RCX);
+  setint(J, vR(a), RAX);
+}
+
+
+static void unm (JitState *J, int pc, Instruction i) {
+  int a = GETARG_A(i); int b = GETARG_B(i);
+  int l1, l2;
+  ldval(J, RAX, vR(b));
+  cmptag(J, vR(b), LUA_TNUMINT);
+  l1 = jcc(J, CC_NE);
+  rex(J, 1, 0, RAX); b1(J, 0xF7); modrmR(J, 3, RAX);  /* neg rax */
+  setint(J, vR(a), RAX);
+  l2 = jmp(J);
+  here(J, l1);
+  cmptag(J, vR(b), LUA_TNUMFLT);
+  jccexit(J, CC_NE, pc);
+  op2R(J, 0, 1, 0xBA, 7, RAX); b1(J, 63);  /* btc rax, 63 (flip sign) */
+  stval(J, vR(a), RAX);
+  settag(J, vR(a), LUA_TNUMFLT);
+  here(J, l2);
+}
+
+
+/*
+** Target for the jump instruction at 'pc'. Backward jumps go through
+** the instruction itself, to check 'trap'.
+*/
+static int jumptarget (JitState *J, int pc) {
+  int target = pc + 1 + GETARG_sJ(J->p->code[pc]);
+  return (target <= pc) ? pc : target;
+}
+
+
+/*
+** Jumps for a test instruction at 'pc' whose condition holds when 'cc'
+** holds. As in the interpreter, the jump that follows the test is done
+** when the condition is equal to 'k'; otherwise it is skipped.
+*/
+static void condbranch (JitState *J, int pc, int cc) {
+  int jt = jumptarget(J, pc + 1);
+  if (GETARG_k(J->p->code[pc])) {
+    jccinst(J, cc, jt);
+    jmpinst(J, pc + 2);
+  }
+  else {
+    jccinst(J, cc, pc + 2);
+    jmpinst(J, jt);
+  }
+}
+
+
+/* jump for a test instruction at 'pc' whose condition is 'cond' */
+static void condconst (JitState *J, int pc, int cond) {
+  if (cond == GETARG_k(J->p->code[pc]))
+    jmpinst(J, jumptarget(J, pc + 1));
+  else
+    jmpinst(J, pc + 2);
+}
+
+
+/*
+** OP_LT/OP_LE/OP_EQ. 'icc' is the condition code for integers (after
+** 'cmp ra, rb'); 'fcc' is the one for floats (after 'ucomisd rb, ra'),
+** or -1 if floats must be interpreted.
+*/
+static void order (JitState *J, int pc, Instruction i, int icc, int fcc) {
+  int a = GETARG_A(i); int b = GETARG_B(i);
+  int l1, l2;
+  cmptag(J, vR(a), LUA_TNUMINT);
+  l1 = jcc(J, CC_NE);
+  cmptag(J, vR(b), LUA_TNUMINT);
+  l2 = jcc(J, CC_NE);
+  ldval(J, RAX, vR(a));
+  ldval(J, RCX, vR(b));
+  aluR(J, OPCMP, RAX, RCX);
+  condbranch(J, pc, icc);
+  here(J, l1); here(J, l2);
+  if (fcc < 0)
+    jmpexit(J, pc);
+  else {
+    cmptag(J, vR(a), LUA_TNUMFLT);
+    jccexit(J, CC_NE, pc);
+    cmptag(J, vR(b), LUA_TNUMFLT);
+    jccexit(J, CC_NE, pc);
+    ldflt(J, 0, vR(a));
+    ldflt(J, 1, vR(b));
+    fltcmp(J, 1, 0);
+    condbranch(J, pc, fcc);
+  }
+}
+
+
+/*
+** OP_LTI/OP_LEI/OP_EQI. Codes are as in 'order', with the float
+** comparison being 'ucomisd imm, ra'. (NaNs are interpreted.)
+*/
+static void orderI (JitState *J, int pc, Instruction i, int icc, int fcc) {
+  int a = GETARG_A(i); int im = GETARG_sB(i);
+  int l1;
+  cmptag(J, vR(a), LUA_TNUMINT);
+  l1 = jcc(J, CC_NE);
+  ldval(J, RAX, vR(a));
+  aluI(J, EXTCMP, RAX, im);
+  condbranch(J, pc, icc);
+  here(J, l1);
+  cmptag(J, vR(a), LUA_TNUMFLT);
+  if (fcc < 0) {  /* OP_EQI? */
+    jccexit(J, CC_E, pc);
+    condconst(J, pc, 0);  /* other types are never equal to a number */
+  }
+  else {
+    jccexit(J, CC_NE, pc);
+    ldflt(J, 0, vR(a));
+    fltcmp(J, 0, 0);
+    jccexit(J, CC_P, pc);  /* NaN? */
+    movI(J, RAX, im);
+    int2flt(J, 1, RAX);
+    fltcmp(J, 1, 0);
+    condbranch(J, pc, fcc);
+  }
+}
+
+
+static void test (JitState *J, int pc, Instruction i) {
+  int a = GETARG_A(i);
+  int lf1, lf2, lt;
+  cmptag(J, vR(a), LUA_TNIL);
+  lf1 = jcc(J, CC_E);
+  cmptag(J, vR(a), LUA_TBOOLEAN);
+  lt = jcc(J, CC_NE);
+  opM(J, 0, 0x83, 7, vR(a) + VALOFS); b1(J, 0);  /* cmp dword [], 0 */
+  lf2 = jcc(J, CC_E);
+  here(J, lt);
+  condconst(J, pc, 1);
+  here(J, lf1); here(J, lf2);
+  condconst(J, pc, 0);
+}
+
+
+/* leave to instruction 'pc' if 'trap' is set */
+static void checktrap (JitState *J, int pc) {
+  opM(J, 0, 0x83, 7, RCI, cast_int(offsetof(CallInfo, u.l.trap)));
+  b1(J, 0);  /* cmp dword [ci->u.l.trap], 0 */
+  jccexit(J, CC_NE, pc);
+}
+
+
+static void forprep (JitState *J, int pc, Instruction i, int isone) {
+  int a = GETARG_A(i);
+  cmptag(J, vR(a), LUA_TNUMINT);
+  jccexit(J, CC_NE, pc);
+  cmptag(J, vR(a + 1), LUA_TNUMINT);
+  jccexit(J, CC_NE, pc);
+  ldval(J, RAX, vR(a));
+  if (isone)
+    aluI(J, EXTSUB, RAX, 1);
+  else {
+    cmptag(J, vR(a + 2), LUA_TNUMINT);
+    jccexit(J, CC_NE, pc);
+    ldval(J, RCX, vR(a + 2));
+    aluR(J, OPSUB, RAX, RCX);
+  }
+  stval(J, vR(a), RAX);
+  jmpinst(J, pc + 1 + GETARG_Bx(i));
+}
+
+
+static void forloop (JitState *J, int pc, Instruction i, int isone) {
+  int a = GETARG_A(i);
+  int target = pc + 1 - GETARG_Bx(i);
+  int lflt = -1, lcont;
+  if (!isone) {
+    cmptag(J, vR(a), LUA_TNUMINT);
+    lflt = jcc(J, CC_NE);
+  }
+  ldval(J, RAX, vR(a));
+  ldval(J, RDX, vR(a + 1));  /* limit */
+  if (isone) {
+    aluI(J, EXTADD, RAX, 1);
+    aluR(J, OPCMP, RAX, RDX);
+    jccinst(J, CC_G, pc + 1);  /* idx > limit: loop is over */
+  }
+  else {
+    int lneg;
+    ldval(J, RCX, vR(a + 2));  /* step */
+    aluR(J, OPADD, RAX, RCX);
+    aluI(J, EXTCMP, RCX, 0);
+    lneg = jcc(J, CC_LE);
+    aluR(J, OPCMP, RAX, RDX);
+    jccinst(J, CC_G, pc + 1);  /* idx > limit: loop is over */
+    lcont = jmp(J);
+    here(J, lneg);
+    aluR(J, OPCMP, RDX, RAX);
+    jccinst(J, CC_G, pc + 1);  /* limit > idx: loop is over */
+    here(J, lcont);
+  }
+  stval(J, vR(a), RAX);  /* update internal index... */
+  setint(J, vR(a + 3), RAX);  /* ...and external index */
+  checktrap(J, target);
+  jmpinst(J, target);
+  if (!isone) {  /* floating loop */
+    int lpos;
+    here(J, lflt);
+    ldflt(J, 0, vR(a));
+    ldflt(J, 1, vR(a + 2));  /* step */
+    ldflt(J, 2, vR(a + 1));  /* limit */
+    op2R(J, 0xF2, 0, SSEADD, 0, 1);
+    op2R(J, 0x66, 0, 0x57, 3, 3);  /* xorpd xmm3, xmm3 */
+    fltcmp(J, 1, 3);
+    lpos = jcc(J, CC_A);  /* 0 < step? */
+    fltcmp(J, 0, 2);
+    jccinst(J, CC_B, pc + 1);  /* not (limit <= idx)? */
+    jccinst(J, CC_P, pc + 1);
+    lcont = jmp(J);
+    here(J, lpos);
+    fltcmp(J, 2, 0);
+    jccinst(J, CC_B, pc + 1);  /* not (idx <= limit)? */
+    jccinst(J, CC_P, pc + 1);
+    here(J, lcont);
+    op2M(J, 0xF2, 0, 0x11, 0, vR(a) + VALOFS);  /* update internal index */
+    setflt(J, vR(a + 3), 0);
+    checktrap(J, target);
+    jmpinst(J, target);
+  }
+}
+
+
+/*
+** Leaves in 'rcx' the address of the array slot 'key' of table 'rax',
+** where 'key' is in 'rcx'; leaves to instruction 'pc' if it is empty.
+** Returns the position of the jump taken (with 'key - 1' in 'rcx')
+** when 'key' is outside the array part.
+*/
+static int arrayslot (JitState *J, int pc) {
+  int lout;
+  aluI(J, EXTSUB, RCX, 1);
+  opM(J, 0, 0x8B, RDX, RAX, cast_int(offsetof(Table, sizearray)));
+  aluR(J, OPCMP, RCX, RDX);
+  lout = jcc(J, CC_AE);  /* (unsigned) key - 1 >= sizearray? */
+  rex(J, 1, 0, RCX); b1(J, 0xC1); modrmR(J, 4, RCX); b1(J, 4);  /* shl 4 */
+  opM(J, 1, 0x03, RCX, RAX, cast_int(offsetof(Table, array)));
+  cmptag(J, RCX, 0, LUA_TNIL);
+  jccexit(J, CC_E, pc);
+  return lout;
+}
+
+
+/*
+** Leaves in 'rdx' the typed array of table 'rax' and in 'rcx' the
+** address of its element 'key', where 'key - 1' is in 'rcx'; leaves
+** to instruction 'pc' if the table has no typed array or if 'key' is
+** not one of its elements.
+*/
+static void typedslot (JitState *J, int pc) {
+  testbyte(J, RAX, cast_int(offsetof(Table, flags)), BITTYPED);
+  jccexit(J, CC_E, pc);
+  load64(J, RDX, RAX, cast_int(offsetof(Table, array)));
+  opM(J, 0, 0x8B, R8, RDX, cast_int(offsetof(TypedArray, len)));
+  aluR(J, OPCMP, RCX, R8);
+  jccexit(J, CC_AE, pc);  /* (unsigned) key - 1 >= len? */
+  rex(J, 1, 0, RCX); b1(J, 0xC1); modrmR(J, 4, RCX); b1(J, 3);  /* shl 3 */
+  aluR(J, OPADD, RCX, RDX);
+  /* element is at 'rcx + offsetof(TypedArray, v)' */
+}
+
+
+/* R(A) := R(B)[key], with 'key' an integer */
+static void geti (JitState *J, int pc, Instruction i, int isimm) {
+  int b = GETARG_B(i); int c = GETARG_C(i);
+  int lout, lend;
+  int ra = cast_int(GETARG_A(i) * sizeof(StackValue));
+  cmptag(J, vR(b), ctb(LUA_TTABLE));
+  jccexit(J, CC_NE, pc);
+  if (isimm)
+    movI(J, RCX, c);
+  else {
+    cmptag(J, vR(c), LUA_TNUMINT);
+    jccexit(J, CC_NE, pc);
+    ldval(J, RCX, vR(c));
+  }
+  ldval(J, RAX, vR(b));
+  lout = arrayslot(J, pc);
+  copytv(J, RBASE, ra, RCX, 0);
+  lend = jmp(J);
+  here(J, lout);  /* try a typed array */
+  typedslot(J, pc);
+  load64(J, R8, RCX, cast_int(offsetof(TypedArray, v)));
+  stval(J, RBASE, ra, R8);
+  op2M(J, 0, 0, 0xB6, R8, RDX, cast_int(offsetof(TypedArray, tt)));
+  opM(J, 0, 0x88, R8, RBASE, ra + TAGOFS);  /* mov tag, r8b */
+  here(J, lend);
+}
+
+
+/* R(A)[key] := RK(C), with 'key' an integer */
+static void seti (JitState *J, int pc, Instruction i, int isimm) {
+  int a = GETARG_A(i); int b = GETARG_B(i); int c = GETARG_C(i);
+  int vb, vd;  /* value to be stored */
+  int lout, lend;
+#if !defined(LUA_USE_GCPAGES)
+  int l1;
+#endif
+  if (TESTARG_k(i)) { vb = RKST; vd = cast_int(c * sizeof(TValue)); }
+  else { vb = RBASE; vd = cast_int(c * sizeof(StackValue)); }
+  cmptag(J, vR(a), ctb(LUA_TTABLE));
+  jccexit(J, CC_NE, pc);
+  if (isimm)
+    movI(J, RCX, b);
+  else {
+    cmptag(J, vR(b), LUA_TNUMINT);
+    jccexit(J, CC_NE, pc);
+    ldval(J, RCX, vR(b));
+  }
+  ldval(J, RAX, vR(a));
+  testbyte(J, RAX, cast_int(offsetof(Table, flags)), BITCHAIN);
+  jccexit(J, CC_NE, pc);  /* table needs 'luaV_chainbarrier' */
+  lout = arrayslot(J, pc);
+  testbyte(J, vb, vd + TAGOFS, BIT_ISCOLLECTABLE);
+#if defined(LUA_USE_GCPAGES)
+  jccexit(J, CC_NE, pc);  /* color is in the page; may need a barrier */
+#else
+  l1 = jcc(J, CC_E);
+  testbyte(J, RAX, cast_int(offsetof(Table, marked)), bitmask(BLACKBIT));
+  jccexit(J, CC_NE, pc);  /* may need a barrier */
+  here(J, l1);
+#endif
+  copytv(J, RCX, 0, vb, vd);
+  lend = jmp(J);
+  here(J, lout);  /* try a typed array (numbers need no barrier) */
+  typedslot(J, pc);
+  op2M(J, 0, 0, 0xB6, R8, RDX, cast_int(offsetof(TypedArray, tt)));
+  opM(J, 0, 0x38, R8, vb, vd + TAGOFS);  /* cmp tag, r8b */
+  jccexit(J, CC_NE, pc);  /* value has another type? */
+  ldval(J, R8, vb, vd);
+  store64(J, RCX, cast_int(offsetof(TypedArray, v)), R8);
+  here(J, lend);
+}
+
+
+/*
+** Emits code for instruction 'pc'. Returns true if the instruction is
+** compiled, false if it is always interpreted.
+*/
+static int emitinst (JitState *J, int pc) {
+  Proto *p = J->p;
+  Instruction i = p->code[pc];
+  int a = GETARG_A(i);
+  switch (GET_BASEOP(i)) {
+    case OP_MOVE:
+      copytv(J, vR(a), vR(GETARG_B(i)));
+      break;
+    case OP_LOADK:
+      copytv(J, vR(a), vK(GETARG_Bx(i)));
+      break;
+    case OP_LOADI:
+      movI(J, RAX, GETARG_sBx(i));
+      setint(J, vR(a), RAX);
+      break;
+    case OP_LOADF:
+      movI(J, RAX, GETARG_sBx(i));
+      int2flt(J, 0, RAX);
+      setflt(J, vR(a), 0);
+      break;
+    case OP_LOADBOOL:
+      opM(J, 0, 0xC7, 0, vR(a) + VALOFS); b4(J, GETARG_B(i));
+      settag(J, vR(a), LUA_TBOOLEAN);
+      if (GETARG_C(i))
+        jmpinst(J, pc + 2);
+      break;
+    case OP_LOADNIL: {
+      int b = GETARG_B(i);
+      do {
+        settag(J, vR(a++), LUA_TNIL);
+      } while (b--);
+      break;
+    }
+    case OP_GETUPVAL:
+      load64(J, RAX, RCL, cast_int(offsetof(LClosure, upvals) +
+                                   GETARG_B(i) * sizeof(UpVal *)));
+      load64(J, RAX, RAX, cast_int(offsetof(UpVal, v)));
+      copytv(J, vR(a), RAX, 0);
+      break;
+    case OP_GETTABLE: geti(J, pc, i, 0); break;
+    case OP_GETI: geti(J, pc, i, 1); break;
+    case OP_SETTABLE: seti(J, pc, i, 0); break;
+    case OP_SETI: seti(J, pc, i, 1); break;
+    case OP_ADDI: arithRI(J, pc, i, OPADD, SSEADD); break;
+    case OP_SUBI: arithRI(J, pc, i, OPSUB, SSESUB); break;
+    case OP_MULI: arithRI(J, pc, i, OPIMUL, SSEMUL); break;
+    case OP_DIVI: arithRI(J, pc, i, -1, SSEDIV); break;
+    case OP_ADD: arithRR(J, pc, i, OPADD, SSEADD); break;
+    case OP_SUB: arithRR(J, pc, i, OPSUB, SSESUB); break;
+    case OP_MUL: arithRR(J, pc, i, OPIMUL, SSEMUL); break;
+    case OP_DIV: arithRR(J, pc, i, -1, SSEDIV); break;
+    case OP_BANDK: bitwise(J, pc, i, OPAND, 1); break;
+    case OP_BORK: bitwise(J, pc, i, OPOR, 1); break;
+    case OP_BXORK: bitwise(J, pc, i, OPXOR, 1); break;
+    case OP_BAND: bitwise(J, pc, i, OPAND, 0); break;
+    case OP_BOR: bitwise(J, pc, i, OPOR, 0); break;
+    case OP_BXOR: bitwise(J, pc, i, OPXOR, 0); break;
+    case OP_UNM: unm(J, pc, i); break;
+    case OP_JMP: {
+      int target = pc + 1 + GETARG_sJ(i);
+      if (target <= pc)  /* backward jump? */
+        checktrap(J, target);
+      jmpinst(J, target);
+      break;
+    }
+    case OP_EQ: case OP_LT: case OP_LE:
+    case OP_EQI: case OP_LTI: case OP_LEI: case OP_TEST: {
+      if (pc + 1 >= p->sizecode || GET_OPCODE(p->code[pc + 1]) != OP_JMP)
+        return 0;  /* not the usual pattern */
+      switch (GET_BASEOP(i)) {
+        case OP_EQ: order(J, pc, i, CC_E, -1); break;
+        case OP_LT: order(J, pc, i, CC_L, CC_A); break;
+        case OP_LE: order(J, pc, i, CC_LE, CC_AE); break;
+        case OP_EQI: orderI(J, pc, i, CC_E, -1); break;
+        case OP_LTI: orderI(J, pc, i, CC_L, CC_A); break;
+        case OP_LEI: orderI(J, pc, i, CC_LE, CC_AE); break;
+        default: test(J, pc, i); break;
+      }
+      break;
+    }
+    case OP_FORPREP1: forprep(J, pc, i, 1); break;
+    case OP_FORPREP: forprep(J, pc, i, 0); break;
+    case OP_FORLOOP1: forloop(J, pc, i, 1); break;
+    case OP_FORLOOP: forloop(J, pc, i, 0); break;
+    default:
+      return 0;
+  }
+  /* fall through to next instruction */
+  return 1;
+}
+
+/* }====================================================== */
+
+
+/*
+** Compute entry points: the start of the function and the bodies of
+** numerical loops, when all their instructions are compiled.
+*/
+static int setentries (JitCode *jc, Proto *p, const lu_byte *ok,
+                       const int *label) {
+  int pc;
+  int n = 0;
+  for (pc = 0; pc < p->sizecode; pc++)
+    jc->entry[pc] = NULL;
+  if (ok[0]) {
+    jc->entry[0] = cast(lu_byte *, jc->mcode) + label[0];
+    n++;
+  }
+  for (pc = 0; pc < p->sizecode; pc++) {
+    OpCode op = GET_BASEOP(p->code[pc]);
+    if (op == OP_FORLOOP || op == OP_FORLOOP1) {
+      int start = pc + 1 - GETARG_Bx(p->code[pc]);
+      int j;
+      for (j = start; j <= pc && ok[j]; j++) ;
+      if (j > pc) {  /* whole loop is compiled? */
+        jc->entry[start] = cast(lu_byte *, jc->mcode) + label[start];
+        n++;
+      }
+    }
+  }
+  return n;
+}
+
+
+/*
+** Translates the code of 'p' into 'J->buff'; 'ok[pc]' gets whether
+** instruction 'pc' was compiled.
+*/
+static void translate (JitState *J, lu_byte *ok) {
+  Proto *p = J->p;
+  int pc;
+  /* entry trampoline: save callee-saved registers and set arguments */
+  b1(J, 0x53);  /* push rbx */
+  b1(J, 0x41); b1(J, 0x54);  /* push r12 */
+  b1(J, 0x41); b1(J, 0x55);  /* push r13 */
+  b1(J, 0x41); b1(J, 0x56);  /* push r14 */
+  rex(J, 1, RDI, RBASE); b1(J, 0x89); modrmR(J, RDI, RBASE);
+  rex(J, 1, RSI, RKST); b1(J, 0x89); modrmR(J, RSI, RKST);
+  rex(J, 1, RDX, RCI); b1(J, 0x89); modrmR(J, RDX, RCI);
+  rex(J, 1, RCX, RCL); b1(J, 0x89); modrmR(J, RCX, RCL);
+  b1(J, 0x41); b1(J, 0xFF); b1(J, 0xE0);  /* jmp r8 */
+  J->epilogue = J->n;
+  b1(J, 0x41); b1(J, 0x5E);  /* pop r14 */
+  b1(J, 0x41); b1(J, 0x5D);  /* pop r13 */
+  b1(J, 0x41); b1(J, 0x5C);  /* pop r12 */
+  b1(J, 0x5B);  /* pop rbx */
+  b1(J, 0xC3);  /* ret */
+  for (pc = 0; pc < p->sizecode; pc++) {
+    int n = J->n;
+    int nfix = J->nfix;
+    J->label[pc] = n;
+    ok[pc] = cast_byte(emitinst(J, pc));
+    if (!ok[pc]) {  /* discard any partial code */
+      J->n = n;
+      J->nfix = nfix;
+      jmpexit(J, pc);
+    }
+    lua_assert(J->n - n <= MAXINSTSIZE && J->nfix - nfix <= MAXINSTFIX);
+  }
+  jmpexit(J, p->sizecode - 1);  /* (cannot fall off the end) */
+  /* exit stubs */
+  for (pc = 0; pc < J->nfix; pc++) {
+    Fixup *f = &J->fix[pc];
+    if (f->isexit && J->exitlabel[f->target] < 0) {
+      J->exitlabel[f->target] = J->n;
+      b1(J, 0xB8); b4(J, f->target);  /* mov eax, target */
+      patch(J, jmp(J), J->epilogue);
+    }
+  }
+  for (pc = 0; pc < J->nfix; pc++) {
+    Fixup *f = &J->fix[pc];
+    patch(J, f->pos, f->isexit ? J->exitlabel[f->target]
+                               : J->label[f->target]);
+  }
+}
+
+
+/*
+** Memory for the compiler goes directly to the allocation function,
+** without accounting or collections: a collection cannot run in the
+** middle of 'luaV_execute', where the compiler is called.
+*/
+static void *rawalloc (global_State *g, size_t size) {
+  return (*g->frealloc)(g->ud, NULL, 0, size);
+}
+
+
+static void rawfree (global_State *g, void *block, size_t size) {
+  if (block != NULL)
+    (*g->frealloc)(g->ud, block, size, 0);
+}
+
+
+#define sizejitcode(n)	(offsetof(JitCode, entry) + (n) * sizeof(void *))
+
+
+static JitCode *compile (lua_State *L, Proto *p) {
+  global_State *g = G(L);
+  int n = p->sizecode;
+  size_t buffsize = 64 + cast(size_t, n) * (MAXINSTSIZE + EXITSIZE);
+  size_t pagesize = cast(size_t, sysconf(_SC_PAGESIZE));
+  JitCode *jc = NULL;
+  JitState J;
+  lu_byte *ok;
+  if (sizeof(lua_Integer) != 8 || sizeof(lua_Number) != 8 ||
+      sizeof(TValue) != 16 || sizeof(StackValue) != sizeof(TValue) ||
+      n == 0 || buffsize / (MAXINSTSIZE + EXITSIZE) < cast(size_t, n))
+    return NULL;  /* unsupported configuration (or too large) */
+  J.p = p;
+  J.n = J.nfix = 0;
+  J.buff = cast(lu_byte *, rawalloc(g, buffsize));
+  J.label = cast(int *, rawalloc(g, n * sizeof(int)));
+  J.exitlabel = cast(int *, rawalloc(g, n * sizeof(int)));
+  J.fix = cast(Fixup *, rawalloc(g, (n * MAXINSTFIX + 1) * sizeof(Fixup)));
+  ok = cast(lu_byte *, rawalloc(g, n));
+  if (J.buff && J.label && J.exitlabel && J.fix && ok) {
+    int pc;
+    for (pc = 0; pc < n; pc++) J.exitlabel[pc] = -1;
+    translate(&J, ok);
+    jc = cast(JitCode *, rawalloc(g, sizejitcode(n)));
+    if (jc != NULL) {
+      jc->sizeentry = n;
+      jc->msize = (cast(size_t, J.n) + pagesize - 1) / pagesize * pagesize;
+      jc->mcode = mmap(NULL, jc->msize, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (jc->mcode == MAP_FAILED) {
+        rawfree(g, jc, sizejitcode(n));
+        jc = NULL;
+      }
+      else {
+        memcpy(jc->mcode, J.buff, J.n);
+        if (mprotect(jc->mcode, jc->msize, PROT_READ | PROT_EXEC) != 0 ||
+            setentries(jc, p, ok, J.label) == 0) {
+          munmap(jc->mcode, jc->msize);
+          rawfree(g, jc, sizejitcode(n));
+          jc = NULL;
+        }
+      }
+    }
+  }
+  rawfree(g, J.buff, buffsize);
+  rawfree(g, J.label, n * sizeof(int));
+  rawfree(g, J.exitlabel, n * sizeof(int));
+  rawfree(g, J.fix, (n * MAXINSTFIX + 1) * sizeof(Fixup));
+  rawfree(g, ok, n);
+  return jc;
+}
+
+
+const Instruction *luaJ_enter (lua_State *L, CallInfo *ci, LClosure *cl,
+                               const Instruction *pc) {
+  Proto *p = cl->p;
+  const void *target;
+  if (p->jit == NULL) {  /* function got hot? */
+    JitCode *jc = compile(L, p);
+    global_State *g = G(L);
+    if (jc == NULL)  /* could not compile it? */
+      return pc;  /* keep interpreting (counter wrapped around) */
+    jc->next = g->jitcode;  /* link it in 'jitcode' list */
+    if (jc->next != NULL)
+      jc->next->previous = &jc->next;
+    jc->previous = &g->jitcode;
+    g->jitcode = jc;
+    p->jit = jc;
+  }
+  target = p->jit->entry[pc - p->code];
+  if (target == NULL)
+    return pc;
+  return p->code + cast_jitf(p->jit->mcode)(ci->func + 1, p->k, ci, cl,
+                                            target);
+}
+
+
+void luaJ_free (lua_State *L, Proto *p) {
+  JitCode *jc = p->jit;
+  if (jc != NULL) {
+    *jc->previous = jc->next;  /* unlink it from 'jitcode' list */
+    if (jc->next != NULL)
+      jc->next->previous = jc->previous;
+    munmap(jc->mcode, jc->msize);
+    rawfree(G(L), jc, sizejitcode(jc->sizeentry));
+    p->jit = NULL;
+  }
+}
+
+
+/*
+** Free all machine code of a state without visiting its prototypes
+** (used when the state is being closed).
+*/
+void luaJ_freeall (lua_State *L) {
+  global_State *g = G(L);
+  JitCode *jc = g->jitcode;
+  while (jc != NULL) {
+    JitCode *next = jc->next;
+    munmap(jc->mcode, jc->msize);
+    rawfree(g, jc, sizejitcode(jc->sizeentry));
+    jc = next;
+  }
+  g->jitcode = NULL;
+}
+
+
+#endif
@@ -0,0 +1,56 @@
+/*
+** $Id: ljit.h $
+** Baseline compiler from Lua bytecode to machine code
+** See Copyright Notice in lua.h
+*/
+
+#ifndef ljit_h
+#define ljit_h
+
+
+#include "lobject.h"
+#include "lstate.h"
+
+
+#if LUA_USE_JIT
+
+/*
+** Machine code for a prototype. 'entry[pc]' is the address where the
+** code for instruction 'pc' starts, when it is worth entering the code
+** there (function start and loop bodies with only compiled
+** instructions), or NULL otherwise.
+*/
+typedef struct JitCode {
+  struct JitCode *next;  /* list of all machine code ('g->jitcode') */
+  struct JitCode **previous;  /* pointer to this one in that list */
+  void *mcode;  /* machine code (starting with the entry trampoline) */
+  size_t msize;  /* size of the mapping with 'mcode' */
+  int sizeentry;
+  const void *entry[1];
+} JitCode;
+
+
+/*
+** Try to run instructions of the function in 'ci' from 'pc' on as
+** machine code. A cold prototype only counts down to its compilation.
+*/
+#define luaJ_tryenter(L,ci,cl,pc)  \
+	{ Proto *p_ = (cl)->p;  \
+	  if (p_->jit != NULL ? p_->jit->entry[(pc) - p_->code] != NULL  \
+	                      : --p_->jithot == 0)  \
+	    (pc) = luaJ_enter(L, ci, cl, pc); }
+
+LUAI_FUNC const Instruction *luaJ_enter (lua_State *L, CallInfo *ci,
+                                         LClosure *cl, const Instruction *pc);
+LUAI_FUNC void luaJ_free (lua_State *L, Proto *p);
+LUAI_FUNC void luaJ_freeall (lua_State *L);
+
+#else
+
+#define luaJ_tryenter(L,ci,cl,pc)	((void)0)
+#define luaJ_free(L,p)		((void)0)
+#define luaJ_freeall(L)		((void)0)
+
+#endif
+
+#endif
@@ -136,9 +136,9 @@ TString *luaX_newstring (LexState *ls, const char *str, size_t l) {
     setbvalue(o, 1);  /* t[string] = true */
     luaC_checkGC(L);
   }
-  else {  /* string already present */
+  else if (ts->tt == LUA_TLNGSTR) {  /* long string already present */
     ts = keystrval(nodefromval(o));  /* re-use value previously stored */
-  }
+  }  /* (short strings are internalized, so 'ts' is already that one) */
   L->top--;  /* remove string from stack */
   return ts;
 }
@@ -194,6 +194,53 @@ typedef unsigned long Instruction;
 #endif
 
 
+/*
+** Size of cache for '__index' chains (better be a prime). (See
+** 'luaV_finishget'.)
+*/
+#if !defined(IDXCACHE_N)
+#define IDXCACHE_N		61
+#endif
+
+
+/*
+** Size of cache for the last tables of allocation sites (better be a
+** prime). (See 'luaH_presizesite'.)
+*/
+#if !defined(TABSITE_N)
+#define TABSITE_N		127
+#endif
+
+
+/*
+** Number of calls plus iterations of numerical loops of a function
+** before it is compiled to machine code. (See ljit.c.)
+*/
+#if !defined(LUAI_JITHOT)
+#define LUAI_JITHOT		1000
+#endif
+
+
+/*
+** Maximum number of short-string keys that a table keeps in "shape
+** mode" (see 'Shape' in lobject.h). Zero disables shapes. (Value must
+** fit in an unsigned char.)
+*/
+#if !defined(LUAI_MAXSHAPE)
+#define LUAI_MAXSHAPE		0
+#endif
+
+
+/*
+** Minimum size of an array part kept as a typed array, when all its
+** elements are integers or all are floats (see 'TypedArray' in
+** lobject.h). Zero disables typed arrays.
+*/
+#if !defined(LUAI_MINTYPED)
+#define LUAI_MINTYPED		16
+#endif
+
+
 /* minimum size for string buffer */
 #if !defined(LUA_MINBUFFER)
 #define LUA_MINBUFFER	32
@@ -202,8 +249,31 @@ typedef unsigned long Instruction;
 
 /*
 ** macros that are executed whenever program enters the Lua core
-** ('lua_lock') and leaves the core ('lua_unlock')
+** ('lua_lock') and leaves the core ('lua_unlock'); with LUA_USE_GIL,
+** they take and release the lock of the state (see lstate.c)
+*/
+#if LUA_USE_GIL
+#if !defined(lua_lock)
+#define lua_lock(L)	luaE_lock(L)
+#define lua_unlock(L)	luaE_unlock(L)
+#endif
+#if !defined(luai_threadyield)
+#define luai_threadyield(L)	luaE_threadyield(L)
+#endif
+#endif
+
+/*
+** macro telling whether it is time to call 'luai_threadyield'. (Without
+** the GIL, no other thread can be waiting to run the state.)
 */
+#if !defined(luai_threadwaiting)
+#if LUA_USE_GIL
+#define luai_threadwaiting(L)	luaE_gilslicedone(L)
+#else
+#define luai_threadwaiting(L)	0
+#endif
+#endif
+
 #if !defined(lua_lock)
 #define lua_lock(L)	((void) 0)
 #define lua_unlock(L)	((void) 0)
@@ -109,7 +109,8 @@ l_noret luaM_toobig (lua_State *L) {
 void luaM_free_ (lua_State *L, void *block, size_t osize) {
   global_State *g = G(L);
   lua_assert((block == 0) == (block == NULL));
-  (*g->frealloc)(g->ud, block, osize, 0);
+  if (!(g->gcdeferfree && luaC_deferfree(g, block, osize)))
+    (*g->frealloc)(g->ud, block, osize, 0);
   g->GCdebt -= osize;
 }
 
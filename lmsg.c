@@ -0,0 +1,438 @@
+/*
+** $Id: lmsg.c $
+** Messages: values moved between independent states
+** See Copyright Notice in lua.h
+*/
+
+#define lmsg_c
+#define LUA_CORE
+
+#include "lprefix.h"
+
+
+#include <string.h>
+
+#include "lua.h"
+
+#include "lapi.h"
+#include "ldebug.h"
+#include "ldo.h"
+#include "lgc.h"
+#include "lmem.h"
+#include "lobject.h"
+#include "lstate.h"
+#include "lstring.h"
+#include "ltable.h"
+
+
+/*
+** A message holds copies of values of one state to be given to another
+** one. It is built by the sending state in blocks from the allocation
+** function of the receiving state, already in the layout of the
+** receiver's objects: each string is a complete 'TString' and the
+** array part of each table is a complete vector of 'TValue's. When
+** the receiver unpacks the message, it adopts these blocks as its own
+** objects instead of copying them (only short strings already present
+** in the receiver are not adopted, as they must be unique). If the
+** receiver does not use that allocation function, or cannot link
+** foreign blocks (paged objects, arenas), it copies the contents and
+** frees the blocks.
+**
+** Messages can carry nil, booleans, numbers, strings, light userdata,
+** light C functions, and tables without metatables whose keys and
+** values are all of those types (flat tables).
+**
+** Inside a message, a string value points to its block, as in a
+** state; a table value has type LUA_TTABLE but its 'p' field points
+** to a 'MsgTable'.
+*/
+
+
+typedef struct MsgTable {
+  TValue *array;  /* array part (NULL if empty or already adopted) */
+  unsigned int sizearray;
+  int sizehash;  /* number of key-value pairs allocated in 'hash' */
+  int nhash;  /* number of key-value pairs already in 'hash' */
+  TValue hash[1];  /* key-value pairs of the other parts */
+} MsgTable;
+
+
+struct lua_Message {
+  lua_Alloc f;  /* allocation function for all blocks of the message */
+  void *ud;
+  int n;  /* number of values */
+  unsigned int nstr;  /* number of strings already unpacked */
+  TValue v[1];  /* values */
+};
+
+
+#define sizemessage(n)	(offsetof(lua_Message, v) + (n) * sizeof(TValue))
+
+#define sizemsgtable(n)	(offsetof(MsgTable, hash) + 2 * (n) * sizeof(TValue))
+
+#define msgtable(o)	cast(MsgTable *, val_(o).p)
+
+#define setmsgtable(o,mt)  \
+	{ TValue *io = (o); val_(io).p = (mt); settt_(io, ctb(LUA_TTABLE)); }
+
+
+/*
+** {======================================================
+** Packing
+** =======================================================
+*/
+
+/* can value be inside a flat table? */
+#define isflat(o)	(!iscollectable(o) || ttisstring(o))
+
+
+/*
+** Check that a table can go in a message. Leave in '*nhash' the number
+** of its entries outside its array part. Uses the two stack slots at
+** 'L->top' as scratch space.
+*/
+static void checktable (lua_State *L, Table *t, int *nhash) {
+  StkId key = L->top;
+  unsigned int i;
+  int n = 0;
+  if (t->metatable != NULL)
+    luaG_runerror(L, "cannot send a table with a metatable");
+  for (i = 0; i < t->sizearray; i++) {
+    if (!isflat(&t->array[i]))
+      luaG_runerror(L, "cannot send nested %s values",
+                       ttypename(ttnov(&t->array[i])));
+  }
+  if (t->sizearray > 0) {  /* skip array part */
+    setivalue(s2v(key), t->sizearray);
+  }
+  else
+    setnilvalue(s2v(key));
+  while (luaH_next(L, t, key)) {
+    if (!isflat(s2v(key)) || !isflat(s2v(key + 1)))
+      luaG_runerror(L, "cannot send nested %s values",
+          ttypename(ttnov(isflat(s2v(key)) ? s2v(key + 1) : s2v(key))));
+    n++;
+  }
+  *nhash = n;
+}
+
+
+/*
+** Copy string 'ts' to a new block of the message; return 0 if the
+** allocation fails
+*/
+static int packstring (lua_Message *m, TValue *o, TString *ts) {
+  size_t size = (ts->tt == LUA_TSHRSTR) ? sizelstring(ts->shrlen)
+                                        : sizelstring(ts->u.lnglen);
+  TString *b = cast(TString *, (*m->f)(m->ud, NULL, LUA_TSTRING, size));
+  if (b == NULL)
+    return 0;
+  memcpy(b, ts, size);  /* header (mostly rebuilt by the receiver) and body */
+  setsvalue(cast(lua_State *, NULL), o, b);
+  return 1;
+}
+
+
+/*
+** Copy a flat value into slot 'o' of the message; return 0 if an
+** allocation fails (leaving 'o' nil)
+*/
+static int packflat (lua_Message *m, TValue *o, const TValue *v) {
+  if (ttisstring(v))
+    return packstring(m, o, tsvalue(v));
+  setobj(cast(lua_State *, NULL), o, v);
+  return 1;
+}
+
+
+/*
+** Copy table 't' (already checked) into slot 'o' of the message;
+** return 0 if an allocation fails. 'o' receives the table before its
+** contents, which are added one by one, so that a failure leaves a
+** well-formed message to be freed.
+*/
+static int packtable (lua_State *L, lua_Message *m, TValue *o, Table *t,
+                      int nhash) {
+  StkId key = L->top;
+  unsigned int i;
+  MsgTable *mt = cast(MsgTable *, (*m->f)(m->ud, NULL, 0,
+                                          sizemsgtable(nhash)));
+  if (mt == NULL)
+    return 0;
+  mt->array = NULL;
+  mt->sizearray = 0;
+  mt->sizehash = nhash;
+  mt->nhash = 0;
+  setmsgtable(o, mt);
+  if (t->sizearray > 0) {
+    size_t size = t->sizearray * sizeof(TValue);
+    mt->array = cast(TValue *, (*m->f)(m->ud, NULL, 0, size));
+    if (mt->array == NULL)
+      return 0;
+    for (i = 0; i < t->sizearray; i++)  /* make it well formed */
+      setnilvalue(&mt->array[i]);
+    mt->sizearray = t->sizearray;
+    for (i = 0; i < t->sizearray; i++) {
+      if (!packflat(m, &mt->array[i], &t->array[i]))
+        return 0;
+    }
+    setivalue(s2v(key), t->sizearray);  /* skip array part */
+  }
+  else
+    setnilvalue(s2v(key));
+  while (luaH_next(L, t, key)) {
+    TValue *pair = &mt->hash[2 * mt->nhash];
+    lua_assert(mt->nhash < mt->sizehash);
+    setnilvalue(&pair[1]);
+    if (!packflat(m, &pair[0], s2v(key)))
+      return 0;
+    mt->nhash++;  /* key is in; value is at least nil */
+    if (!packflat(m, &pair[1], s2v(key + 1)))
+      return 0;
+  }
+  return 1;
+}
+
+
+static void freeflat (lua_Message *m, TValue *o) {
+  if (ttisstring(o)) {
+    TString *ts = tsvalue(o);
+    size_t l = (ts->tt == LUA_TSHRSTR) ? ts->shrlen : ts->u.lnglen;
+    (*m->f)(m->ud, ts, sizelstring(l), 0);
+  }
+}
+
+
+/*
+** Free the blocks of a message. Only strings numbered 'm->nstr' or
+** above (in the order of 'unpackstrings') are still blocks of the
+** message; the others were already unpacked. (Array parts are adopted
+** only after all strings are unpacked, so the numbering of the
+** remaining strings does not change.)
+*/
+static void freemessage (lua_Message *m) {
+  unsigned int nstr = 0;
+  int i, j;
+  unsigned int k;
+  for (i = 0; i < m->n; i++) {
+    TValue *o = &m->v[i];
+    if (ttistable(o)) {
+      MsgTable *mt = msgtable(o);
+      for (k = 0; k < mt->sizearray; k++) {
+        if (ttisstring(&mt->array[k]) && nstr++ >= m->nstr)
+          freeflat(m, &mt->array[k]);
+      }
+      if (mt->array != NULL)
+        (*m->f)(m->ud, mt->array, mt->sizearray * sizeof(TValue), 0);
+      for (j = 0; j < 2 * mt->nhash; j++) {
+        if (ttisstring(&mt->hash[j]) && nstr++ >= m->nstr)
+          freeflat(m, &mt->hash[j]);
+      }
+      (*m->f)(m->ud, mt, sizemsgtable(mt->sizehash), 0);
+    }
+    else if (ttisstring(o) && nstr++ >= m->nstr)
+      freeflat(m, o);
+  }
+  (*m->f)(m->ud, m, sizemessage(m->n), 0);
+}
+
+
+/*
+** Build a message with the 'n' values on the top of the stack, in
+** blocks from allocation function 'f' (with user data 'ud'), and pop
+** those values. Raises an error if some value cannot be sent.
+*/
+LUA_API lua_Message *lua_packmessage (lua_State *L, int n, lua_Alloc f,
+                                                   void *ud) {
+  lua_Message *m;
+  StkId first;
+  int i;
+  lua_lock(L);
+  api_checknelems(L, n);
+  luaD_checkstack(L, 2);  /* scratch space to traverse tables */
+  first = L->top - n;
+  for (i = 0; i < n; i++) {  /* check all values before building */
+    TValue *o = s2v(first + i);
+    if (ttistable(o)) {
+      int nhash;
+      checktable(L, hvalue(o), &nhash);
+    }
+    else if (!isflat(o))
+      luaG_runerror(L, "cannot send %s values", ttypename(ttnov(o)));
+  }
+  m = cast(lua_Message *, (*f)(ud, NULL, 0, sizemessage(n)));
+  if (m == NULL)
+    luaD_throw(L, LUA_ERRMEM);
+  m->f = f; m->ud = ud;
+  m->n = n;
+  m->nstr = 0;
+  for (i = 0; i < n; i++)
+    setnilvalue(&m->v[i]);
+  for (i = 0; i < n; i++) {
+    TValue *o = s2v(first + i);
+    int ok;
+    if (ttistable(o)) {
+      int nhash;
+      checktable(L, hvalue(o), &nhash);  /* count entries again */
+      ok = packtable(L, m, &m->v[i], hvalue(o), nhash);
+    }
+    else
+      ok = packflat(m, &m->v[i], o);
+    if (!ok) {
+      freemessage(m);
+      luaD_throw(L, LUA_ERRMEM);
+    }
+  }
+  L->top = first;
+  lua_unlock(L);
+  return m;
+}
+
+
+/*
+** Free a message that will not be unpacked
+*/
+LUA_API void lua_freemessage (lua_Message *m) {
+  freemessage(m);
+}
+
+/* }====================================================== */
+
+
+
+/*
+** {======================================================
+** Unpacking
+** =======================================================
+*/
+
+typedef struct Unpacker {
+  lua_Message *m;
+  int adopt;  /* true if receiver adopts the blocks of the message */
+} Unpacker;
+
+
+/*
+** Turn the string in slot 'o' into a string of the receiver
+*/
+static void unpackstring (lua_State *L, Unpacker *u, TValue *o) {
+  lua_Message *m = u->m;
+  TString *b = tsvalue(o);
+  TString *ts;
+  if (u->adopt)
+    ts = luaS_adopt(L, b);
+  else {
+    size_t l = (b->tt == LUA_TSHRSTR) ? b->shrlen : b->u.lnglen;
+    ts = luaS_newlstr(L, getstr(b), l);
+    freeflat(m, o);
+  }
+  setsvalue(L, o, ts);
+  m->nstr++;
+}
+
+
+static void unpackstrings (lua_State *L, Unpacker *u) {
+  lua_Message *m = u->m;
+  int i, j;
+  unsigned int k;
+  for (i = 0; i < m->n; i++) {
+    TValue *o = &m->v[i];
+    if (ttistable(o)) {
+      MsgTable *mt = msgtable(o);
+      for (k = 0; k < mt->sizearray; k++) {
+        if (ttisstring(&mt->array[k]))
+          unpackstring(L, u, &mt->array[k]);
+      }
+      for (j = 0; j < 2 * mt->nhash; j++) {
+        if (ttisstring(&mt->hash[j]))
+          unpackstring(L, u, &mt->hash[j]);
+      }
+    }
+    else if (ttisstring(o))
+      unpackstring(L, u, o);
+  }
+}
+
+
+/*
+** Build a table of the receiver with the contents of 'mt' and push it
+*/
+static void unpacktable (lua_State *L, Unpacker *u, MsgTable *mt) {
+  Table *t = luaH_new(L);
+  int j;
+  sethvalue2s(L, L->top, t);
+  api_incr_top(L);
+  luaH_presize(L, t, u->adopt ? 0 : mt->sizearray, mt->nhash);
+  if (mt->sizearray > 0) {
+    if (u->adopt) {  /* take the array part as it is */
+      t->array = mt->array;
+      t->sizearray = mt->sizearray;
+      G(L)->GCdebt += mt->sizearray * sizeof(TValue);
+      mt->array = NULL;
+      mt->sizearray = 0;
+    }
+    else {
+      unsigned int k;
+      for (k = 0; k < mt->sizearray; k++)
+        setobj2t(L, &t->array[k], &mt->array[k]);
+    }
+  }
+  for (j = 0; j < mt->nhash; j++) {
+    TValue *pair = &mt->hash[2 * j];
+    TValue *slot = luaH_set(L, t, &pair[0]);
+    setobj2t(L, slot, &pair[1]);
+  }
+  invalidateTMcache(t);
+}
+
+
+static void f_unpack (lua_State *L, void *ud) {
+  Unpacker *u = cast(Unpacker *, ud);
+  lua_Message *m = u->m;
+  int i;
+  luaD_checkstack(L, m->n);
+  unpackstrings(L, u);
+  for (i = 0; i < m->n; i++) {
+    TValue *o = &m->v[i];
+    if (ttistable(o))
+      unpacktable(L, u, msgtable(o));
+    else {
+      setobj2s(L, L->top, o);
+      api_incr_top(L);
+    }
+  }
+}
+
+
+/*
+** Push the values of message 'm' and free it (whether it succeeds or
+** raises an error). Returns the number of values pushed.
+*/
+LUA_API int lua_unpackmessage (lua_State *L, lua_Message *m) {
+  global_State *g;
+  Unpacker u;
+  const lua_Number *version;
+  int status;
+  int n = m->n;
+  lua_lock(L);
+  g = G(L);
+  u.m = m;
+  u.adopt = (m->f == g->frealloc && m->ud == g->ud && !g->gcarena);
+#if defined(LUA_USE_GCPAGES)
+  u.adopt = 0;  /* short strings and tables live in pages */
+#endif
+  /* no collections (not even emergency ones) while unpacking, as
+     unpacked strings are not anchored until their values are pushed */
+  version = g->version;
+  g->version = NULL;
+  status = luaD_rawrunprotected(L, f_unpack, &u);
+  g->version = version;
+  freemessage(m);
+  if (status != LUA_OK)
+    luaD_throw(L, status);
+  lua_unlock(L);
+  return n;
+}
+
+/* }====================================================== */
+
@@ -462,6 +462,10 @@ typedef struct Proto {
   TValue *k;  /* constants used by the function */
   struct LClosure *cache;  /* last-created closure with this prototype */
   Instruction *code;  /* opcodes */
+  int *icache;  /* inline caches and table profiles (one per instruction) */
+  struct JitCode *jit;  /* machine code for the function (or NULL) */
+  struct SharedProto *shared;  /* shared code and line information (or NULL) */
+  unsigned int jithot;  /* countdown for compiling the function */
   struct Proto **p;  /* functions defined inside the function */
   Upvaldesc *upvalues;  /* upvalue information */
   ls_byte *lineinfo;  /* information about source lines (debug information) */
@@ -528,17 +532,17 @@ typedef union Closure {
 
 
 /*
-** Nodes for Hash tables. A pack of two TValue's (key-value pairs)
-** plus a 'next' field to link colliding entries. The distribution
-** of the key's fields ('key_tt' and 'key_val') not forming a proper
-** 'TValue' allows for a smaller size for 'Node' both in 4-byte
-** and 8-byte alignments.
+** Nodes for Hash tables. A pack of two TValue's (key-value pairs).
+** The distribution of the key's fields ('key_tt' and 'key_val') not
+** forming a proper 'TValue' allows for a smaller size for 'Node' both
+** in 4-byte and 8-byte alignments. (The hash part keeps the other
+** information about its nodes in a separate vector of control bytes;
+** see ltable.c.)
 */
 typedef union Node {
   struct NodeKey {
     TValuefields;  /* fields for value */
     lu_byte key_tt;  /* key type */
-    int next;  /* for chaining */
     Value key_val;  /* key value */
   } u;
   TValue i_val;  /* direct access to node's value as a proper 'TValue' */
@@ -559,14 +563,65 @@ typedef union Node {
 	  (void)L; checkliveness(L,io_); }
 
 
+/*
+** Shapes (aka hidden classes). A shape is an ordered list of short-string
+** keys; a table in "shape mode" keeps the values for those keys in a
+** dense vector of slots ('Fields'), in the same order. Shapes form a
+** transition tree: the children of a shape are the shapes with one more
+** key, so that tables that get the same keys in the same order end up
+** sharing the same shape. Shapes are not collectable objects; they are
+** reference counted (by the tables using them and by their children).
+** The strings in 'keys' are kept alive by those tables. Large shapes
+** also have a small hash ('idx') from keys to (slot + 1).
+*/
+typedef struct Shape {
+  struct Shape *parent;
+  struct Shape *child;  /* first child */
+  struct Shape *sibling;  /* next child of the same parent */
+  int nkeys;  /* number of keys */
+  int nref;  /* number of tables and children using this shape */
+  lu_byte lsizeidx;  /* log2 of size of 'idx' */
+  lu_byte *idx;  /* hash part (NULL for small shapes) */
+  TString *keys[1];  /* keys in slot order */
+} Shape;
+
+
+typedef struct Fields {
+  Shape *shape;
+  int size;  /* number of slots in 'v' */
+  TValue v[1];  /* values for the keys in 'shape' */
+} Fields;
+
+
+/*
+** Array part of a table whose elements are all integers or all floats
+** (a typed array), kept without their tags. Its first 'len' slots hold
+** the elements; the others are empty.
+*/
+typedef union TypedValue {
+  lua_Integer i;
+  lua_Number n;
+} TypedValue;
+
+typedef struct TypedArray {
+  TValue box;  /* copy of the last element read through a slot */
+  unsigned int size;  /* number of slots in 'v' */
+  unsigned int len;  /* number of elements */
+  lu_byte tt;  /* tag of all elements (LUA_TNUMINT or LUA_TNUMFLT) */
+  TypedValue v[1];
+} TypedArray;
+
+
 typedef struct Table {
   CommonHeader;
   lu_byte flags;  /* 1<<p means tagmethod(p) is not present */
   lu_byte lsizenode;  /* log2 of size of 'node' array */
   unsigned int sizearray;  /* size of 'array' array */
-  TValue *array;  /* array part */
-  Node *node;
-  Node *lastfree;  /* any free position is before this position */
+  TValue *array;  /* array part (or a 'TypedArray', see 'istyped') */
+  Node *node;  /* hash part (followed by its control bytes) */
+  int hfree;  /* number of free nodes (-1 when using the dummy node) */
+  unsigned int border;  /* last border found by 'luaH_getn' (a hint) */
+  Fields *fields;  /* short-string keys in shape mode (or NULL) */
   struct Table *metatable;
   GCObject *gclist;
 } Table;
@@ -595,7 +650,7 @@ typedef struct Table {
 /*
 ** Use a "nil table" to mark dead keys in a table. Those keys serve
 ** only to keep space for removed entries, which may still be part of
-** chains. Note that the 'keytt' does not have the BIT_ISCOLLECTABLE
+** probe sequences. Note that the 'keytt' does not have the BIT_ISCOLLECTABLE
 ** set, so these values are considered not collectable and are different
 ** from any valid value.
 */
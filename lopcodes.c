@@ -92,6 +92,22 @@ LUAI_DDEF const char *const luaP_opnames[NUM_OPCODES+1] = {
   "CLOSURE",
   "VARARG",
   "EXTRAARG",
+  "MOVECALL",
+  "SELFCALL",
+  "TABUPFIELD",
+  "FIELDFIELD",
+  "FIELDCALL",
+  "FIELDEQK",
+  "ADDII",
+  "ADDFF",
+  "SUBII",
+  "SUBFF",
+  "MULII",
+  "MULFF",
+  "LTII",
+  "LTFF",
+  "LEII",
+  "LEFF",
   NULL
 };
 
@@ -172,5 +188,28 @@ LUAI_DDEF const lu_byte luaP_opmodes[NUM_OPCODES] = {
  ,opmode(0, 0, 0, 1, iABx)		/* OP_CLOSURE */
  ,opmode(1, 0, 0, 1, iABC)		/* OP_VARARG */
  ,opmode(0, 0, 0, 0, iAx)		/* OP_EXTRAARG */
+ ,opmode(0, 0, 0, 1, iABC)		/* OP_MOVECALL */
+ ,opmode(0, 0, 0, 1, iABC)		/* OP_SELFCALL */
+ ,opmode(0, 0, 0, 1, iABC)		/* OP_TABUPFIELD */
+ ,opmode(0, 0, 0, 1, iABC)		/* OP_FIELDFIELD */
+ ,opmode(0, 0, 0, 1, iABC)		/* OP_FIELDCALL */
+ ,opmode(0, 0, 0, 1, iABC)		/* OP_FIELDEQK */
+ ,opmode(0, 0, 0, 1, iABC)		/* OP_ADDII */
+ ,opmode(0, 0, 0, 1, iABC)		/* OP_ADDFF */
+ ,opmode(0, 0, 0, 1, iABC)		/* OP_SUBII */
+ ,opmode(0, 0, 0, 1, iABC)		/* OP_SUBFF */
+ ,opmode(0, 0, 0, 1, iABC)		/* OP_MULII */
+ ,opmode(0, 0, 0, 1, iABC)		/* OP_MULFF */
+ ,opmode(0, 0, 1, 0, iABC)		/* OP_LTII */
+ ,opmode(0, 0, 1, 0, iABC)		/* OP_LTFF */
+ ,opmode(0, 0, 1, 0, iABC)		/* OP_LEII */
+ ,opmode(0, 0, 1, 0, iABC)		/* OP_LEFF */
+};
+
+
+LUAI_DDEF const lu_byte luaP_baseops[NUM_OPCODES - NUM_BASICOPS] = {
+  OP_MOVE, OP_SELF, OP_GETTABUP, OP_GETFIELD, OP_GETFIELD, OP_GETFIELD,
+  OP_ADD, OP_ADD, OP_SUB, OP_SUB, OP_MUL, OP_MUL,
+  OP_LT, OP_LT, OP_LE, OP_LE
 };
 
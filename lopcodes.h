@@ -284,11 +284,37 @@ OP_CLOSURE,/*	A Bx	R(A) := closure(KPROTO[Bx])			*/
 
 OP_VARARG,/*	A B C	R(A), R(A+1), ..., R(A+C-2) = vararg(B)		*/
 
-OP_EXTRAARG/*	Ax	extra (larger) argument for previous opcode	*/
+OP_EXTRAARG,/*	Ax	extra (larger) argument for previous opcode	*/
+
+/* superinstructions: an instruction fused with the next one */
+OP_MOVECALL,/*	A B	OP_MOVE, then the next OP_CALL			*/
+OP_SELFCALL,/*	A B C	OP_SELF, then the next OP_CALL			*/
+OP_TABUPFIELD,/* A B C	OP_GETTABUP, then the next OP_GETFIELD		*/
+OP_FIELDFIELD,/* A B C	OP_GETFIELD, then the next OP_GETFIELD		*/
+OP_FIELDCALL,/*	A B C	OP_GETFIELD, then the next OP_CALL		*/
+OP_FIELDEQK,/*	A B C	OP_GETFIELD, then the next OP_EQK		*/
+
+/* specialized forms of generic opcodes; see "quickening" in lvm.c */
+OP_ADDII,/*	A B C	R(A) := R(B) + R(C)		(integers)	*/
+OP_ADDFF,/*	A B C	R(A) := R(B) + R(C)		(floats)	*/
+OP_SUBII,/*	A B C	R(A) := R(B) - R(C)		(integers)	*/
+OP_SUBFF,/*	A B C	R(A) := R(B) - R(C)		(floats)	*/
+OP_MULII,/*	A B C	R(A) := R(B) * R(C)		(integers)	*/
+OP_MULFF,/*	A B C	R(A) := R(B) * R(C)		(floats)	*/
+OP_LTII,/*	A B	if ((R(A) <  R(B)) ~= k) then pc++	(integers)	*/
+OP_LTFF,/*	A B	if ((R(A) <  R(B)) ~= k) then pc++	(floats)	*/
+OP_LEII,/*	A B	if ((R(A) <= R(B)) ~= k) then pc++	(integers)	*/
+OP_LEFF/*	A B	if ((R(A) <= R(B)) ~= k) then pc++	(floats)	*/
 } OpCode;
 
 
-#define NUM_OPCODES	(cast(int, OP_EXTRAARG) + 1)
+#define NUM_OPCODES	(cast(int, OP_LEFF) + 1)
+
+/* number of basic opcodes (each one does a single operation) */
+#define NUM_BASICOPS	(cast(int, OP_EXTRAARG) + 1)
+
+/* number of generic opcodes (the ones that the compiler generates) */
+#define NUM_GENERICOPS	(cast(int, OP_FIELDEQK) + 1)
 
 
 
@@ -322,6 +348,16 @@ OP_EXTRAARG/*	Ax	extra (larger) argument for previous opcode	*/
   specifies that the function builds upvalues, which may need to be
   closed.
 
+  (*) A superinstruction has the arguments of its first part; its
+  second part is the next instruction, which stays in the code (and
+  so can still be the target of jumps). The compiler creates them in
+  a final pass over the code.
+
+  (*) Specialized opcodes (after the superinstructions) never come from
+  the compiler or from binary chunks: the interpreter rewrites generic
+  instructions into them, and back, while running. They have the same
+  arguments as their generic forms.
+
 ===========================================================================*/
 
 
@@ -354,6 +390,23 @@ LUAI_DDEC const lu_byte luaP_opmodes[NUM_OPCODES];
 LUAI_DDEC const char *const luaP_opnames[NUM_OPCODES+1];  /* opcode names */
 
 
+/*
+** Basic operation done by each opcode: the generic form of specialized
+** opcodes and the first part of superinstructions. Everything that
+** inspects code, except the interpreter itself, should use basic opcodes.
+*/
+LUAI_DDEC const lu_byte luaP_baseops[NUM_OPCODES - NUM_BASICOPS];
+
+#define baseop(o)  \
+	(cast_int(o) < NUM_BASICOPS ? (o)  \
+	       : cast(OpCode, luaP_baseops[cast_int(o) - NUM_BASICOPS]))
+
+#define GET_BASEOP(i)	baseop(GET_OPCODE(i))
+
+/* whether opcode 'o' is a specialized one (see "quickening" in lvm.c) */
+#define isspecialized(o)	(cast_int(o) >= NUM_GENERICOPS)
+
+
 /* number of list items to accumulate before a SETLIST instruction */
 #define LFIELDS_PER_FLUSH	50
 
@@ -115,6 +115,100 @@ void luaE_incCcalls (lua_State *L) {
 }
 
 
+#if defined(LUA_USE_OPSTATS)
+void luaE_resetopstats (global_State *g) {
+  OpStats *os = &g->opstats;
+  os->lastop = -1;
+  memset(os->count, 0, sizeof(os->count));
+  memset(os->pair, 0, sizeof(os->pair));
+}
+#endif
+
+
+#if LUA_USE_GIL
+/*
+** {======================================================
+** Global lock ('lua_lock' in states built with LUA_USE_GIL)
+** =======================================================
+*/
+
+static void initgil (global_State *g) {
+  GIL *gil = &g->gil;
+  pthread_mutex_init(&gil->mutex, NULL);
+  pthread_cond_init(&gil->switched, NULL);
+  gil->turns = 0;
+  gil->waiting = gil->yielding = 0;
+  gil->slice = LUAI_GILSLICE;
+}
+
+
+static void freegil (global_State *g) {
+  GIL *gil = &g->gil;
+  pthread_mutex_trylock(&gil->mutex);  /* 'lua_close' holds it; others not */
+  pthread_mutex_unlock(&gil->mutex);
+  pthread_cond_destroy(&gil->switched);
+  pthread_mutex_destroy(&gil->mutex);
+}
+
+
+/*
+** Bookkeeping of a thread that has just taken 'mutex'
+*/
+static void newturn (GIL *gil) {
+  gil->turns++;
+  gil->slice = LUAI_GILSLICE;
+  if (gil->yielding > 0)  /* some thread waiting for this switch? */
+    pthread_cond_broadcast(&gil->switched);
+}
+
+
+void luaE_lock (lua_State *L) {
+  GIL *gil = &G(L)->gil;
+  if (pthread_mutex_trylock(&gil->mutex) != 0) {  /* lock is busy? */
+    __atomic_add_fetch(&gil->waiting, 1, __ATOMIC_RELAXED);
+    pthread_mutex_lock(&gil->mutex);
+    __atomic_sub_fetch(&gil->waiting, 1, __ATOMIC_RELAXED);
+  }
+  newturn(gil);
+}
+
+
+void luaE_unlock (lua_State *L) {
+  pthread_mutex_unlock(&G(L)->gil.mutex);
+}
+
+
+/*
+** Called by the holder of the lock at the end of its slice: if other
+** threads want the lock, let one of them take it before going on.
+** Every thread in 'waiting' takes the lock once it is free (yielding
+** threads are woken by any new turn), so 'turns' must change.
+*/
+void luaE_threadyield (lua_State *L) {
+  GIL *gil = &G(L)->gil;
+  if (__atomic_load_n(&gil->waiting, __ATOMIC_RELAXED) > 0) {
+    unsigned long turns = gil->turns;
+    __atomic_add_fetch(&gil->waiting, 1, __ATOMIC_RELAXED);
+    gil->yielding++;
+    do {  /* release the lock until another thread has taken it */
+      pthread_cond_wait(&gil->switched, &gil->mutex);
+    } while (gil->turns == turns);
+    gil->yielding--;
+    __atomic_sub_fetch(&gil->waiting, 1, __ATOMIC_RELAXED);
+    newturn(gil);
+  }
+  else
+    gil->slice = LUAI_GILSLICE;
+}
+
+/* }====================================================== */
+
+#else
+#define initgil(g)	((void)0)
+#define freegil(g)	((void)0)
+#endif
+
+
 CallInfo *luaE_extendCI (lua_State *L) {
   CallInfo *ci;
   luaE_incCcalls(L);
@@ -261,12 +355,17 @@ static void preinit_thread (lua_State *L, global_State *g) {
 static void close_state (lua_State *L) {
   global_State *g = G(L);
   luaF_close(L, L->stack);  /* close all upvalues for this thread */
+  luaG_freeprofiler(L);
   luaC_freeallobjects(L);  /* collect all objects */
   if (g->version)  /* closing a fully built state? */
     luai_userstateclose(L);
-  luaM_freearray(L, G(L)->strt.hash, G(L)->strt.size);
-  freestack(L);
-  lua_assert(gettotalbytes(g) == sizeof(LG));
+  if (!g->gcarena) {  /* must free each block? */
+    lua_assert(g->shaperoot.child == NULL);  /* all shapes were released */
+    luaM_freearray(L, G(L)->strt.hash, G(L)->strt.size);
+    freestack(L);
+    lua_assert(gettotalbytes(g) == sizeof(LG));
+  }
+  freegil(g);  /* no other thread may be using the state now */
   (*g->frealloc)(g->ud, fromstate(L), sizeof(LG), 0);  /* free main block */
 }
 
@@ -341,6 +440,11 @@ LUA_API lua_State *lua_newstate (lua_Alloc f, void *ud) {
   g->survival = g->old = g->reallyold = NULL;
   g->finobjsur = g->finobjold = g->finobjrold = NULL;
   g->sweepgc = NULL;
+#if defined(LUA_USE_GCPAGES)
+  g->pages = NULL;
+  g->sweeppage = NULL;
+  for (i=0; i < NPAGECLASSES; i++) g->freepages[i] = NULL;
+#endif
   g->gray = g->grayagain = NULL;
   g->weak = g->ephemeron = g->allweak = g->protogray = NULL;
   g->twups = NULL;
@@ -349,9 +453,35 @@ LUA_API lua_State *lua_newstate (lua_Alloc f, void *ud) {
   setgcparam(g->gcpause, LUAI_GCPAUSE);
   setgcparam(g->gcstepmul, LUAI_GCMUL);
   g->gcstepsize = LUAI_GCSTEPSIZE;
+  g->pacer.steptime = 0;  /* work-based pacing */
+  g->pacer.growth = LUAI_GCGROWTH;
+  g->pacer.trigger = LUAI_GCTRIGGER;
+  g->pacer.goal = g->pacer.peak = 0;
+  g->pacer.rate[0] = g->pacer.rate[1] = LUAI_GCRATE;
+  g->pacer.work = g->pacer.lastwork = 0;
+  memset(&g->gcstats, 0, sizeof(g->gcstats));
+  memset(g->gccurtime, 0, sizeof(g->gccurtime));
   setgcparam(g->genmajormul, LUAI_GENMAJORMUL);
   g->genminormul = LUAI_GENMINORMUL;
   for (i=0; i < LUA_NUMTAGS; i++) g->mt[i] = NULL;
+  for (i=0; i < IDXCACHE_N; i++) g->idxcache[i].mt = NULL;
+  g->idxepoch = 0;
+  for (i=0; i < TABSITE_N; i++) g->tabsite[i].t = NULL;
+  g->shaperoot.parent = g->shaperoot.child = g->shaperoot.sibling = NULL;
+  g->shaperoot.nkeys = 0;
+  g->shaperoot.nref = 1;  /* never released */
+  g->shaperoot.lsizeidx = 0;
+  g->shaperoot.idx = NULL;
+  g->prof = NULL;
+  g->parmark = NULL;
+  g->sweeper = NULL;
+  g->gcdeferfree = 0;
+  g->gcarena = 0;
+  g->jitcode = NULL;
+  initgil(g);
+#if defined(LUA_USE_OPSTATS)
+  luaE_resetopstats(g);
+#endif
   if (luaD_rawrunprotected(L, f_luaopen, NULL) != LUA_OK) {
     /* memory allocation error: free partial state */
     close_state(L);
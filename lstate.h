@@ -13,6 +13,10 @@
 #include "ltm.h"
 #include "lzio.h"
 
+#if defined(LUA_USE_OPSTATS)
+#include "lopcodes.h"
+#endif
+
 
 /*
 
@@ -74,6 +78,10 @@ struct lua_longjmp;  /* defined in ldo.c */
 #define KGC_GEN		1	/* generational gc */
 
 
+/* number of size classes of objects living in pages (see lgc.h) */
+#define NPAGECLASSES	3
+
+
 typedef struct stringtable {
   TString **hash;
   int nuse;  /* number of elements */
@@ -131,6 +139,89 @@ typedef struct CallInfo {
 #define getoah(st)	((st) & CIST_OAH)
 
 
+/*
+** Entry in the cache for '__index' chains. (See 'luaV_finishget'.)
+*/
+typedef struct IdxCache {
+  struct Table *mt;  /* metatable of the indexed table */
+  TString *key;  /* key being searched */
+  const TValue *slot;  /* where key is defined ('luaO_nilobject' if nowhere) */
+  unsigned int epoch;  /* entry is valid only in this epoch */
+} IdxCache;
+
+
+/*
+** Entry in the cache with the last table created by each 'OP_NEWTABLE'.
+** (See 'luaH_presizesite'.)
+*/
+typedef struct TabSite {
+  struct Table *t;  /* last table created by the site (or NULL) */
+  struct Proto *p;  /* prototype with the site */
+  int *site;  /* profile of the site (in 'p->icache') */
+} TabSite;
+
+
+#if defined(LUA_USE_OPSTATS)
+/*
+** Execution counts of opcodes, and of pairs of opcodes executed one
+** right after the other, for all threads of a state
+*/
+typedef struct OpStats {
+  int lastop;  /* last opcode executed (-1 if none) */
+  lu_mem count[NUM_OPCODES];
+  lu_mem pair[NUM_OPCODES][NUM_OPCODES];  /* pair[previous][next] */
+} OpStats;
+#endif
+
+
+/*
+** State of the time-based pacer of the incremental collector (see
+** 'pacedstep' in lgc.c)
+*/
+typedef struct GCPacer {
+  int steptime;  /* target duration of a step, in microseconds (0: off) */
+  int growth;  /* target heap size, as a percentage of live data */
+  int trigger;  /* where cycles start, as % of the way up to 'goal' */
+  lu_mem goal;  /* target heap size for current cycle (0 if unknown) */
+  lu_mem peak;  /* largest heap size seen in current cycle */
+  lu_mem rate[2];  /* work per millisecond when marking/sweeping */
+  lu_mem work;  /* work done in current cycle */
+  lu_mem lastwork;  /* work done in previous cycle */
+} GCPacer;
+
+
+#if LUA_USE_GIL
+#include <pthread.h>
+
+/*
+** Number of chances to switch threads (see 'luai_threadyield') that
+** a thread lets pass before giving the lock to waiting threads
+*/
+#if !defined(LUAI_GILSLICE)
+#define LUAI_GILSLICE	1000
+#endif
+
+/*
+** Lock of a state built with LUA_USE_GIL. Threads that want 'mutex'
+** count themselves in 'waiting'. When the holder ends its slice and
+** there are waiting threads, it releases 'mutex' and waits on
+** 'switched' until some other thread has taken it ('turns' changes),
+** so that it cannot take the lock back right away.
+*/
+typedef struct GIL {
+  pthread_mutex_t mutex;  /* the lock itself */
+  pthread_cond_t switched;  /* signals that a new thread took the lock */
+  unsigned long turns;  /* number of times the lock was taken */
+  int waiting;  /* number of threads waiting for 'mutex' */
+  int yielding;  /* number of threads waiting on 'switched' */
+  int slice;  /* chances to switch left to the holder */
+} GIL;
+
+/* true if the holder of the lock has used its slice (only for it) */
+#define luaE_gilslicedone(L)	(--G(L)->gil.slice <= 0)
+#endif
+
+
 /*
 ** 'global state', shared by all threads of this state
 */
@@ -150,9 +241,14 @@ typedef struct global_State {
   lu_byte genmajormul;  /* control for major generational collections */
   lu_byte gcrunning;  /* true if GC is running */
   lu_byte gcemergency;  /* true if this is an emergency collection */
+  lu_byte gcdeferfree;  /* true if frees go to 'sweeper' */
+  lu_byte gcarena;  /* true if freeing main block frees all memory */
   lu_byte gcpause;  /* size of pause between successive GCs */
   lu_byte gcstepmul;  /* GC "speed" */
   lu_byte gcstepsize;  /* (log2 of) GC granularity */
+  GCPacer pacer;  /* time-based pacing of the incremental collector */
+  lua_GCStats gcstats;  /* statistics of the collector */
+  lu_mem gccurtime[LUA_GCNPHASES];  /* time in each phase in current cycle */
   GCObject *allgc;  /* list of all collectable objects */
   GCObject **sweepgc;  /* current position of sweep in list */
   GCObject *finobj;  /* list of collectable objects with finalizers */
@@ -179,6 +275,25 @@ typedef struct global_State {
   TString *tmname[TM_N];  /* array with tag-method names */
   struct Table *mt[LUA_NUMTAGS];  /* metatables for basic types */
   TString *strcache[STRCACHE_N][STRCACHE_M];  /* cache for strings in API */
+  IdxCache idxcache[IDXCACHE_N];  /* cache for '__index' chains */
+  unsigned int idxepoch;  /* current epoch for 'idxcache' */
+  TabSite tabsite[TABSITE_N];  /* last tables of allocation sites */
+  Shape shaperoot;  /* empty shape (root of the tree of shapes) */
+  struct Profiler *prof;  /* samples of the sampling profiler (or NULL) */
+  struct ParMark *parmark;  /* helper threads for marking (or NULL) */
+  struct Sweeper *sweeper;  /* thread for background frees (or NULL) */
+  struct JitCode *jitcode;  /* list of all machine code */
+#if defined(LUA_USE_GCPAGES)
+  struct GCPage *pages;  /* list of all pages of objects */
+  struct GCPage **sweeppage;  /* current position of sweep in 'pages' */
+  struct GCPage *freepages[NPAGECLASSES];  /* pages with free slots */
+#endif
+#if defined(LUA_USE_OPSTATS)
+  OpStats opstats;
+#endif
+#if LUA_USE_GIL
+  GIL gil;  /* lock for threads running this state */
+#endif
 } global_State;
 
 
@@ -259,6 +374,14 @@ LUAI_FUNC CallInfo *luaE_extendCI (lua_State *L);
 LUAI_FUNC void luaE_freeCI (lua_State *L);
 LUAI_FUNC void luaE_shrinkCI (lua_State *L);
 LUAI_FUNC void luaE_incCcalls (lua_State *L);
+#if defined(LUA_USE_OPSTATS)
+LUAI_FUNC void luaE_resetopstats (global_State *g);
+#endif
+#if LUA_USE_GIL
+LUAI_FUNC void luaE_lock (lua_State *L);
+LUAI_FUNC void luaE_unlock (lua_State *L);
+LUAI_FUNC void luaE_threadyield (lua_State *L);
+#endif
 
 
 #endif
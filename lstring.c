@@ -245,6 +245,47 @@ TString *luaS_newlstr (lua_State *L, const char *str, size_t l) {
 }
 
 
+/*
+** Make 'ts', a string built outside the state in a block from its
+** allocation function (see lmsg.c), a string of the state. A short
+** string equal to an existing one is freed and the existing one is
+** returned instead. (If there is an error, 'ts' is left untouched.)
+*/
+TString *luaS_adopt (lua_State *L, TString *ts) {
+  global_State *g = G(L);
+  if (ts->tt == LUA_TSHRSTR) {
+    size_t l = ts->shrlen;
+    stringtable *tb = &g->strt;
+    unsigned int h = luaS_hash(getstr(ts), l, g->seed);
+    TString **list = &tb->hash[lmod(h, tb->size)];
+    TString *ts1;
+    for (ts1 = *list; ts1 != NULL; ts1 = ts1->u.hnext) {
+      if (l == ts1->shrlen && (memcmp(getstr(ts), getstr(ts1), l) == 0)) {
+        if (isdead(g, ts1))  /* dead (but not collected yet)? */
+          changewhite(ts1);  /* resurrect it */
+        (*g->frealloc)(g->ud, ts, sizelstring(l), 0);
+        return ts1;
+      }
+    }
+    if (tb->nuse >= tb->size) {  /* need to grow string table? */
+      growstrtab(L, tb);
+      list = &tb->hash[lmod(h, tb->size)];  /* rehash with new size */
+    }
+    ts->hash = h;
+    ts->u.hnext = *list;
+    *list = ts;
+    tb->nuse++;
+    luaC_adoptobj(L, obj2gco(ts), sizelstring(l));
+  }
+  else {
+    ts->hash = g->seed;
+    luaC_adoptobj(L, obj2gco(ts), sizelstring(ts->u.lnglen));
+  }
+  ts->extra = 0;
+  return ts;
+}
+
+
 /*
 ** Create or reuse a zero-terminated string, first checking in the
 ** cache (using the string address as a key). The cache can contain
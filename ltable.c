@@ -16,15 +16,23 @@
 ** Non-negative integer keys are all candidates to be kept in the array
 ** part. The actual size of the array is the largest 'n' such that
 ** more than half the slots between 1 and n are in use.
-** Hash uses a mix of chained scatter table with Brent's variation.
-** A main invariant of these tables is that, if an element is not
-** in its main position (i.e. the 'original' position that its hash gives
-** to it), then the colliding element is in its own main position.
-** Hence even when the load factor reaches 100%, performance remains good.
+** Hash uses open addressing in the style of "Swiss tables": besides its
+** vector of nodes, the hash part has a vector of control bytes, one per
+** node, that tells whether the node is empty or, if not, holds 7 bits
+** of the hash of its key. Searches probe whole groups of GROUPSIZE
+** nodes, comparing all their control bytes at once (with SSE2, when
+** available); they only touch the nodes whose control bytes match and
+** stop at the first group with an empty node. Keys are never removed
+** from the hash part (entries with nil values keep their keys), so
+** there are no tombstones; a rehash reclaims the nodes of dead entries.
+** Optionally (see LUAI_MAXSHAPE), tables with few short-string keys keep
+** those keys in a third part, a vector of slots described by a shared
+** shape ("hidden class"); all other keys still use the two parts above.
 */
 
 #include <math.h>
 #include <limits.h>
+#include <string.h>
 
 #include "lua.h"
 
@@ -53,6 +61,9 @@
 */
 #define MAXASIZE	luaM_limitN(1u << MAXABITS, TValue)
 
+/* size of the array part of 't', typed or not (see 'trytype') */
+#define arraysize(t)	(istyped(t) ? tarray(t)->size : (t)->sizearray)
+
 /*
 ** MAXHBITS is the largest integer such that 2^MAXHBITS fits in a
 ** signed int.
@@ -60,38 +71,153 @@
 #define MAXHBITS	(MAXABITS - 1)
 
 
+/* a node plus its control byte (for size computations) */
+typedef struct CNode {
+  Node n;
+  lu_byte ctrl;
+} CNode;
+
+
 /*
 ** MAXHSIZE is the maximum size of the hash part. It is the minimum
 ** between 2^MAXHBITS and the maximum size such that, measured in bytes,
 ** it fits in a 'size_t'.
 */
-#define MAXHSIZE	luaM_limitN(1u << MAXHBITS, Node)
+#define MAXHSIZE	luaM_limitN(1u << MAXHBITS, CNode)
+
+
+/*
+** {=============================================================
+** Control bytes
+** ==============================================================
+*/
+
+/* number of nodes probed together */
+#define GROUPSIZE	16
+
+/* control byte of an empty node (the others are all below 0x80) */
+#define CTRLEMPTY	0x80
+
+
+/*
+** The control bytes of a hash part follow its nodes, in the same block.
+** Small hash parts (with less than GROUPSIZE nodes) have one full group
+** of control bytes; the extra ones are always empty.
+*/
+#define ctrlbytes(t)	cast(lu_byte *, gnode(t, sizenode(t)))
+
+#define sizectrl(n)	((n) < GROUPSIZE ? GROUPSIZE : (n))
+
+#define sizehash(n)	((n) * sizeof(Node) + sizectrl(n))
+
 
+/*
+** Maximum number of keys in a hash part with 'n' nodes. A hash part
+** with several groups keeps at least 1/8 of its nodes empty, so that
+** probes for absent keys stop early; a small one (a single group that
+** always has empty control bytes at its end) can be full.
+*/
+#define maxload(n)	((n) < GROUPSIZE ? (n) : (n) - (n) / 8)
 
-#define hashpow2(t,n)		(gnode(t, lmod((n), sizenode(t))))
 
-#define hashstr(t,str)		hashpow2(t, (str)->hash)
-#define hashboolean(t,p)	hashpow2(t, p)
-#define hashint(t,i)		hashpow2(t, i)
+/* mask for the indices of the groups of a hash part */
+#define groupmask(t)	(cast(unsigned int, sizenode(t) - 1) / GROUPSIZE)
 
 
 /*
-** for some types, it is better to avoid modulus by power of 2, as
-** they tend to have many 2 factors.
+** Scrambles the hash of a key. The highest 7 bits of the result go to
+** the control byte of the key's node; the other bits choose the first
+** group probed for the key.
 */
-#define hashmod(t,n)	(gnode(t, ((n) % ((sizenode(t)-1)|1))))
+#define mixhash(h)	(cast(unsigned int, (h)) * 0x9E3779B9u)
+
+#define hash7(m)	cast_byte(((m) >> 25) & 0x7F)
+
+#define firstgroup(t,m)	(((m) >> 7) & groupmask(t))
+
+
+#if LUA_USE_SSE2
+
+#include <emmintrin.h>
+
+#define loadgroup(c)	_mm_loadu_si128(cast(const __m128i *, (c)))
+
+/* bit mask of the control bytes in group 'c' equal to 'b' */
+static unsigned int matchbyte (const lu_byte *c, lu_byte b) {
+  __m128i eq = _mm_cmpeq_epi8(loadgroup(c), _mm_set1_epi8(cast(char, b)));
+  return cast(unsigned int, _mm_movemask_epi8(eq));
+}
 
+/* bit mask of the empty nodes in group 'c' (the only high bits set) */
+static unsigned int matchempty (const lu_byte *c) {
+  return cast(unsigned int, _mm_movemask_epi8(loadgroup(c)));
+}
 
-#define hashpointer(t,p)	hashmod(t, point2uint(p))
+#else
 
+static unsigned int matchbyte (const lu_byte *c, lu_byte b) {
+  unsigned int mask = 0;
+  int i;
+  for (i = 0; i < GROUPSIZE; i++)
+    mask |= cast(unsigned int, c[i] == b) << i;
+  return mask;
+}
 
-#define dummynode		(&dummynode_)
+#define matchempty(c)	matchbyte(c, CTRLEMPTY)
 
-static const Node dummynode_ = {
-  {{NULL}, LUA_TNIL,  /* value's value and type */
-   LUA_TNIL, 0, {NULL}}  /* key type, next, and key value */
+#endif
+
+
+/* index of the lowest bit set in a (non-zero) mask */
+#if defined(__GNUC__)
+#define lowbit(m)	__builtin_ctz(m)
+#else
+static int lowbit (unsigned int m) {
+  int i = 0;
+  while (!(m & 1u)) {
+    m >>= 1;
+    i++;
+  }
+  return i;
+}
+#endif
+
+
+/*
+** Loop over the groups in the probe sequence of mixed hash 'm', with 'g'
+** being the index of the first node of each group. Successive groups
+** are 1, 2, 3, ... groups apart, which, as the number of groups is a
+** power of 2, visits all of them. Loops stop (with 'break'/'return')
+** at the first group with an empty node, as there is always one.
+*/
+#define forprobe(t,m,g,step)  \
+	for (step = 0, g = firstgroup(t, m); ;  \
+	     g = (g + ++step) & groupmask(t))
+
+#define groupctrl(t,g)	(ctrlbytes(t) + (g) * GROUPSIZE)
+
+#define groupnode(t,g,mask)	gnode(t, (g) * GROUPSIZE + lowbit(mask))
+
+
+/*
+** The dummy node (used by all tables with empty hash parts) followed
+** by a group of empty control bytes
+*/
+static const struct {
+  Node node;
+  lu_byte ctrl[GROUPSIZE];
+} dummy_ = {
+  {{{NULL}, LUA_TNIL,  /* value's value and type */
+    LUA_TNIL, {NULL}}},  /* key type and key value */
+  {CTRLEMPTY, CTRLEMPTY, CTRLEMPTY, CTRLEMPTY, CTRLEMPTY, CTRLEMPTY,
+   CTRLEMPTY, CTRLEMPTY, CTRLEMPTY, CTRLEMPTY, CTRLEMPTY, CTRLEMPTY,
+   CTRLEMPTY, CTRLEMPTY, CTRLEMPTY, CTRLEMPTY}
 };
 
+#define dummynode		(&dummy_.node)
+
+/* }============================================================= */
+
 
 /*
 ** Hash for floating-point numbers.
@@ -123,39 +249,39 @@ static int l_hashfloat (lua_Number n) {
 #endif
 
 
+/* hash for integers: fold both halves of a 64-bit value */
+static unsigned int hashint (lua_Integer i) {
+  lua_Unsigned ui = l_castS2U(i);
+  return cast(unsigned int, ui ^ ((ui >> 31) >> 1));
+}
+
+
 /*
-** returns the 'main' position of an element in a table (that is,
-** the index of its hash value). The key comes broken (tag in 'ktt'
-** and value in 'vkl') so that we can call it on keys inserted into
-** nodes.
+** returns the mixed hash of a key (see 'mixhash'), which gives the
+** sequence of groups where it is searched and its control byte
 */
-static Node *mainposition (const Table *t, int ktt, const Value *kvl) {
-  switch (ttyperaw(ktt)) {
+static unsigned int hashkey (const TValue *key) {
+  switch (ttype(key)) {
     case LUA_TNUMINT:
-      return hashint(t, ivalueraw(*kvl));
+      return mixhash(hashint(ivalue(key)));
     case LUA_TNUMFLT:
-      return hashmod(t, l_hashfloat(fltvalueraw(*kvl)));
+      return mixhash(l_hashfloat(fltvalue(key)));
     case LUA_TSHRSTR:
-      return hashstr(t, tsvalueraw(*kvl));
+      return mixhash(tsvalue(key)->hash);
     case LUA_TLNGSTR:
-      return hashpow2(t, luaS_hashlongstr(tsvalueraw(*kvl)));
+      return mixhash(luaS_hashlongstr(tsvalue(key)));
     case LUA_TBOOLEAN:
-      return hashboolean(t, bvalueraw(*kvl));
+      return mixhash(bvalue(key));
     case LUA_TLIGHTUSERDATA:
-      return hashpointer(t, pvalueraw(*kvl));
+      return mixhash(point2uint(pvalue(key)));
     case LUA_TLCF:
-      return hashpointer(t, fvalueraw(*kvl));
+      return mixhash(point2uint(fvalue(key)));
     default:
-      return hashpointer(t, gcvalueraw(*kvl));
+      return mixhash(point2uint(gcvalue(key)));
   }
 }
 
 
-static Node *mainpositionTV (const Table *t, const TValue *key) {
-  return mainposition(t, rttype(key), valraw(key));
-}
-
-
 /*
 ** Check whether key 'k1' is equal to the key in node 'n2'.
 ** This equality is raw, so there are no metamethods. Floats
@@ -193,20 +319,225 @@ static int equalkey (const TValue *k1, const Node *n2) {
 ** which may be in array part, nor for floats with integral values.)
 */
 static const TValue *getgeneric (Table *t, const TValue *key) {
-  Node *n = mainpositionTV(t, key);
-  for (;;) {  /* check whether 'key' is somewhere in the chain */
-    if (equalkey(key, n))
-      return gval(n);  /* that's it */
-    else {
-      int nx = gnext(n);
-      if (nx == 0)
-        return luaO_nilobject;  /* not found */
-      n += nx;
+  unsigned int m = hashkey(key);
+  unsigned int g, step;
+  forprobe(t, m, g, step) {
+    const lu_byte *c = groupctrl(t, g);
+    unsigned int match = matchbyte(c, hash7(m));
+    for (; match != 0; match &= match - 1) {
+      Node *n = groupnode(t, g, match);
+      if (equalkey(key, n))
+        return gval(n);  /* that's it */
     }
+    if (matchempty(c))
+      return luaO_nilobject;  /* not found */
   }
 }
 
 
+/*
+** {=============================================================
+** Shapes
+** ==============================================================
+*/
+
+/* shapes with up to this number of keys are searched linearly */
+#define MAXSMALLSHAPE	8
+
+#define sizeshape(n)	(offsetof(Shape, keys) + cast(size_t, n) * sizeof(TString *))
+#define sizefields(n)	(offsetof(Fields, v) + cast(size_t, n) * sizeof(TValue))
+
+/* total size of a shape, including its hash part */
+#define shapesize(s)  \
+	(sizeshape((s)->nkeys) + ((s)->idx ? twoto((s)->lsizeidx) : 0))
+
+
+#if LUAI_MAXSHAPE > UCHAR_MAX
+#error "invalid value for LUAI_MAXSHAPE"
+#endif
+
+
+/*
+** Returns the slot of 'key' in shape 's', or -1 if absent.
+*/
+static int shapeslot (const Shape *s, const TString *key) {
+  if (s->idx == NULL) {  /* small shape? */
+    int i;
+    for (i = 0; i < s->nkeys; i++) {
+      if (eqshrstr(s->keys[i], key))
+        return i;
+    }
+  }
+  else {
+    unsigned int mask = twoto(s->lsizeidx) - 1;
+    unsigned int h = key->hash & mask;
+    int j;
+    while ((j = s->idx[h]) != 0) {  /* linear probing */
+      if (eqshrstr(s->keys[j - 1], key))
+        return j - 1;
+      h = (h + 1) & mask;
+    }
+  }
+  return -1;
+}
+
+
+/*
+** Creates a new shape with the keys of 'parent' plus 'key', and links
+** it as a child of 'parent'. Its hash part (if any) goes in the same
+** block, after the keys.
+*/
+static Shape *newshape (lua_State *L, Shape *parent, TString *key) {
+  int n = parent->nkeys + 1;
+  int lsize = (n > MAXSMALLSHAPE) ? luaO_ceillog2(2 * n) : 0;
+  size_t size = sizeshape(n) + ((n > MAXSMALLSHAPE) ? twoto(lsize) : 0);
+  Shape *s = cast(Shape *, luaM_malloc_(L, size, 0));
+  int i;
+  s->parent = parent;
+  s->child = NULL;
+  s->sibling = parent->child;
+  parent->child = s;
+  parent->nref++;
+  s->nkeys = n;
+  s->nref = 0;
+  s->lsizeidx = cast_byte(lsize);
+  for (i = 0; i < n - 1; i++)
+    s->keys[i] = parent->keys[i];
+  s->keys[n - 1] = key;
+  if (n <= MAXSMALLSHAPE)
+    s->idx = NULL;
+  else {
+    unsigned int mask = twoto(lsize) - 1;
+    s->idx = cast(lu_byte *, s) + sizeshape(n);
+    memset(s->idx, 0, twoto(lsize));
+    for (i = 0; i < n; i++) {
+      unsigned int h = s->keys[i]->hash & mask;
+      while (s->idx[h] != 0)
+        h = (h + 1) & mask;
+      s->idx[h] = cast_byte(i + 1);
+    }
+  }
+  return s;
+}
+
+
+/*
+** Returns the child of 's' that adds 'key' to it, creating it if needed.
+*/
+static Shape *getchild (lua_State *L, Shape *s, TString *key) {
+  Shape *c;
+  for (c = s->child; c != NULL; c = c->sibling) {
+    if (eqshrstr(c->keys[c->nkeys - 1], key))
+      return c;
+  }
+  return newshape(L, s, key);
+}
+
+
+/*
+** Drops a reference to shape 's', freeing it (and, in cascade, its
+** ancestors) when not used anymore. The root is never freed, as its
+** count never reaches zero.
+*/
+static void releaseshape (lua_State *L, Shape *s) {
+  while (--s->nref == 0) {
+    Shape *parent = s->parent;
+    Shape **c = &parent->child;
+    while (*c != s)  /* find 's' in the list of its siblings */
+      c = &(*c)->sibling;
+    *c = s->sibling;  /* unlink it */
+    luaM_freemem(L, s, shapesize(s));
+    s = parent;
+  }
+}
+
+
+/*
+** Puts table 't' in shape mode, with the empty shape and room for
+** 'size' slots.
+*/
+static void setfields (lua_State *L, Table *t, int size) {
+  Fields *f = cast(Fields *, luaM_malloc_(L, sizefields(size), 0));
+  f->shape = &G(L)->shaperoot;
+  f->shape->nref++;
+  f->size = size;
+  t->fields = f;
+}
+
+
+static void freefields (lua_State *L, Table *t) {
+  Fields *f = t->fields;
+  if (f != NULL) {
+    t->fields = NULL;
+    releaseshape(L, f->shape);
+    luaM_freemem(L, f, sizefields(f->size));
+  }
+}
+
+
+/*
+** Inserts the new short-string key 'key' into the shape part of table
+** 't' (putting the table in shape mode, if needed) and returns its slot.
+*/
+static TValue *newfield (lua_State *L, Table *t, TString *key) {
+  Fields *f;
+  Shape *s;
+  int n;
+  if (t->fields == NULL)  /* not in shape mode yet? */
+    setfields(L, t, 1);
+  f = t->fields;
+  n = f->shape->nkeys;
+  if (n == f->size) {  /* no more free slots? */
+    int size = (2 * n <= LUAI_MAXSHAPE) ? 2 * n : LUAI_MAXSHAPE;
+    luaV_chainbarrier(L, t);  /* slots in 't' will move */
+    f = cast(Fields *, luaM_saferealloc_(L, f, sizefields(n),
+                                               sizefields(size)));
+    f->size = size;
+    t->fields = f;
+  }
+  s = getchild(L, f->shape, key);
+  s->nref++;
+  releaseshape(L, f->shape);
+  f->shape = s;
+  setnilvalue(&f->v[n]);
+  return &f->v[n];
+}
+
+
+/*
+** Takes table 't' out of shape mode, moving its fields to the hash part
+** (with room for one more key).
+*/
+static void unshape (lua_State *L, Table *t) {
+  Fields *f = t->fields;
+  Shape *s = f->shape;
+  unsigned int size = 1;  /* one more key to be inserted */
+  int i;
+  for (i = 0; i < s->nkeys; i++) {
+    if (!ttisnil(&f->v[i]))
+      size++;
+  }
+  for (i = 0; i < sizenode(t); i++) {
+    if (!ttisnil(gval(gnode(t, i))))
+      size++;
+  }
+  luaH_resize(L, t, arraysize(t), size);
+  t->fields = NULL;  /* from now on, 'f' is detached from the table */
+  for (i = 0; i < s->nkeys; i++) {
+    if (!ttisnil(&f->v[i])) {
+      /* enough room in the hash part; these cannot raise errors */
+      TValue k;
+      setsvalue(L, &k, s->keys[i]);
+      setobjt2t(L, luaH_newkey(L, t, &k), &f->v[i]);
+    }
+  }
+  t->fields = f;
+  freefields(L, t);
+}
+
+/* }============================================================= */
+
+
 /*
 ** returns the index for 'k' if 'k' is an appropriate key to live in
 ** the array part of a table, 0 otherwise.
@@ -221,28 +552,48 @@ static unsigned int arrayindex (lua_Integer k) {
 
 /*
 ** returns the index of a 'key' for table traversals. First goes all
-** elements in the array part, then elements in the hash part. The
-** beginning of a traversal is signaled by 0.
+** elements in the array part, then elements in the shape part, then
+** elements in the hash part. The beginning of a traversal is signaled
+** by 0.
 */
-static unsigned int findindex (lua_State *L, Table *t, TValue *key) {
+static unsigned int findindex (lua_State *L, Table *t, TValue *key,
+                               unsigned int asize) {
   unsigned int i;
   if (ttisnil(key)) return 0;  /* first iteration */
   i = ttisinteger(key) ? arrayindex(ivalue(key)) : 0;
-  if (i != 0 && i <= t->sizearray)  /* is 'key' inside array part? */
+  if (i != 0 && i <= asize)  /* is 'key' inside array part? */
     return i;  /* yes; that's the index */
+  else if (t->fields != NULL && ttisshrstring(key)) {  /* in shape part? */
+    int j = shapeslot(t->fields->shape, tsvalue(key));
+    if (j < 0)
+      luaG_runerror(L, "invalid key to 'next'");  /* key not found */
+    /* fields are numbered after array elements */
+    return (j + 1) + asize;
+  }
   else {
     const TValue *n = getgeneric(t, key);
     if (n == luaO_nilobject)
       luaG_runerror(L, "invalid key to 'next'");  /* key not found */
     i = cast_int(nodefromval(n) - gnode(t, 0));  /* key index in hash table */
-    /* hash elements are numbered after array ones */
-    return (i + 1) + t->sizearray;
+    /* hash elements are numbered after array and shape ones */
+    return (i + 1) + asize + nfields(t);
   }
 }
 
 
 int luaH_next (lua_State *L, Table *t, StkId key) {
-  unsigned int i = findindex(L, t, s2v(key));  /* find original element */
+  unsigned int asize = arraysize(t);
+  unsigned int i = findindex(L, t, s2v(key), asize);  /* original element */
+  unsigned int nf = nfields(t);
+  if (istyped(t)) {  /* array part is a typed array? */
+    TypedArray *ta = tarray(t);
+    if (i < ta->len) {  /* elements are all at its beginning */
+      setivalue(s2v(key), i + 1);
+      gettyped(s2v(key + 1), ta, i);
+      return 1;
+    }
+    if (i < asize) i = asize;  /* skip the free slots */
+  }
   for (; i < t->sizearray; i++) {  /* try first array part */
     if (!ttisnil(&t->array[i])) {  /* a non-nil value? */
       setivalue(s2v(key), i + 1);
@@ -250,7 +601,14 @@ int luaH_next (lua_State *L, Table *t, StkId key) {
       return 1;
     }
   }
-  for (i -= t->sizearray; cast_int(i) < sizenode(t); i++) {  /* hash part */
+  for (i -= asize; i < nf; i++) {  /* then shape part */
+    if (!ttisnil(&t->fields->v[i])) {  /* a non-nil value? */
+      setsvalue2s(L, key, t->fields->shape->keys[i]);
+      setobj2s(L, key + 1, &t->fields->v[i]);
+      return 1;
+    }
+  }
+  for (i -= nf; cast_int(i) < sizenode(t); i++) {  /* hash part */
     if (!ttisnil(gval(gnode(t, i)))) {  /* a non-nil value? */
       Node *n = gnode(t, i);
       getnodekey(L, s2v(key), n);
@@ -264,10 +622,128 @@ int luaH_next (lua_State *L, Table *t, StkId key) {
 
 static void freehash (lua_State *L, Table *t) {
   if (!isdummy(t))
-    luaM_freearray(L, t->node, cast(size_t, sizenode(t)));
+    luaM_freemem(L, t->node, sizehash(cast(size_t, sizenode(t))));
 }
 
 
+/*
+** {=============================================================
+** Typed arrays
+** ==============================================================
+*/
+
+/*
+** An array part with at least LUAI_MINTYPED slots whose elements are
+** all integers or all floats, with no holes among them, can be kept
+** as a typed array. An array part is checked for that only when it
+** grows (see 'luaH_finishset'), which amortizes the check. It goes
+** back to a regular one on the first assignment it cannot represent,
+** and also before any resize of the table. Elements of a typed array
+** have no slots of their own: 'luaH_getint' gives them through a copy
+** in 'box', and only 'luaH_finishset' can store them.
+*/
+
+#define sizetarray(n)	(offsetof(TypedArray, v) + (n) * sizeof(TypedValue))
+
+/* store number 'o' (with the tag of the elements) as element 'x' */
+#define settyped(ta,x,o)  \
+  { if ((ta)->tt == LUA_TNUMINT) (ta)->v[x].i = ivalue(o);  \
+    else (ta)->v[x].n = fltvalue(o); }
+
+
+/*
+** Turns the array part of 't' into a typed array, if it is big enough
+** and its elements allow it.
+*/
+static void trytype (lua_State *L, Table *t) {
+  unsigned int size = t->sizearray;
+  unsigned int len, i;
+  lu_byte tt;
+  TypedArray *ta;
+  if (LUAI_MINTYPED == 0 || size < LUAI_MINTYPED)
+    return;
+  tt = rttype(&t->array[0]);
+  if (tt != LUA_TNUMINT && tt != LUA_TNUMFLT)
+    return;
+  for (len = 1; len < size && rttype(&t->array[len]) == tt; len++) ;
+  for (i = len; i < size; i++) {
+    if (!ttisnil(&t->array[i]))
+      return;  /* other types of values or holes */
+  }
+  ta = cast(TypedArray *, luaM_malloc_(L, sizetarray(size), 0));
+  setnilvalue(&ta->box);
+  ta->size = size;
+  ta->len = len;
+  ta->tt = tt;
+  for (i = 0; i < len; i++)
+    settyped(ta, i, &t->array[i]);
+  luaM_freearray(L, t->array, size);
+  t->array = cast(TValue *, ta);
+  t->sizearray = 0;
+  t->flags |= BITTYPED;
+}
+
+
+/*
+** Turns the typed array of 't' back into a regular array part (with
+** the same size).
+*/
+void luaH_untype (lua_State *L, Table *t) {
+  TypedArray *ta = tarray(t);
+  unsigned int size = ta->size;
+  unsigned int i;
+  TValue *array = luaM_newvector(L, size, TValue);
+  for (i = 0; i < ta->len; i++)
+    gettyped(&array[i], ta, i);
+  for (; i < size; i++)
+    setnilvalue(&array[i]);
+  luaM_freemem(L, ta, sizetarray(size));
+  t->array = array;
+  t->sizearray = size;
+  t->flags &= cast_byte(~BITTYPED);
+}
+
+
+/*
+** Tries to do 't[k + 1] = val' in the typed array of 't', where 'k'
+** is at most its size. Returns false if the typed array cannot do it.
+** An element can be appended to a full array only when the hash part
+** is empty (as it could hold the keys that the array would cover).
+*/
+static int typedset (lua_State *L, Table *t, lua_Unsigned k,
+                     const TValue *val) {
+  TypedArray *ta = tarray(t);
+  if (rttype(val) == ta->tt) {
+    if (k > ta->len)
+      return 0;  /* would leave a hole */
+    else if (k == ta->len) {  /* appending? */
+      if (k == ta->size) {  /* array is full? */
+        if (!isdummy(t) || ta->size > MAXASIZE / 2)
+          return 0;
+        ta = cast(TypedArray *, luaM_realloc_(L, ta, sizetarray(ta->size),
+                                             sizetarray(2 * ta->size)));
+        ta->size *= 2;
+        t->array = cast(TValue *, ta);
+      }
+      ta->len++;
+    }
+    settyped(ta, k, val);
+    return 1;
+  }
+  else if (ttisnil(val) && k < ta->size) {
+    if (k + 1 == ta->len)  /* removing the last element? */
+      ta->len--;
+    else if (k < ta->len)
+      return 0;  /* would leave a hole */
+    return 1;
+  }
+  else
+    return 0;  /* another type of value */
+}
+
+/* }============================================================= */
+
+
 /*
 ** {=============================================================
 ** Rehash
@@ -364,8 +840,8 @@ static int numusehash (const Table *t, unsigned int *nums, unsigned int *pna) {
 
 
 /*
-** Creates an array for the hash part of a table with the given
-** size, or reuses the dummy node if size is zero.
+** Creates the hash part of a table with room for at least the given
+** number of keys, or reuses the dummy node if size is zero.
 ** The computation for size overflow is in two steps: the first
 ** comparison ensures that the shift in the second one does not
 ** overflow.
@@ -374,23 +850,25 @@ static void setnodevector (lua_State *L, Table *t, unsigned int size) {
   if (size == 0) {  /* no elements to hash part? */
     t->node = cast(Node *, dummynode);  /* use common 'dummynode' */
     t->lsizenode = 0;
-    t->lastfree = NULL;  /* signal that it is using dummy node */
+    t->hfree = -1;  /* signal that it is using dummy node */
   }
   else {
     int i;
     int lsize = luaO_ceillog2(size);
+    if (lsize < MAXHBITS && size > cast(unsigned int, maxload(twoto(lsize))))
+      lsize++;  /* keep some empty nodes */
     if (lsize > MAXHBITS || (1u << lsize) > MAXHSIZE)
       luaG_runerror(L, "table overflow");
     size = twoto(lsize);
-    t->node = luaM_newvector(L, size, Node);
+    t->node = cast(Node *, luaM_malloc_(L, sizehash(cast(size_t, size)), 0));
     for (i = 0; i < (int)size; i++) {
       Node *n = gnode(t, i);
-      gnext(n) = 0;
       setnilkey(n);
       setnilvalue(gval(n));
     }
     t->lsizenode = cast_byte(lsize);
-    t->lastfree = gnode(t, size);  /* all positions are free */
+    memset(ctrlbytes(t), CTRLEMPTY, sizectrl(size));  /* all nodes empty */
+    t->hfree = cast_int(maxload(size));
   }
 }
 
@@ -420,13 +898,13 @@ static void reinsert (lua_State *L, Table *ot, Table *t) {
 static void exchangehashpart (Table *t1, Table *t2) {
   lu_byte lsizenode = t1->lsizenode;
   Node *node = t1->node;
-  Node *lastfree = t1->lastfree;
+  int hfree = t1->hfree;
   t1->lsizenode = t2->lsizenode;
   t1->node = t2->node;
-  t1->lastfree = t2->lastfree;
+  t1->hfree = t2->hfree;
   t2->lsizenode = lsizenode;
   t2->node = node;
-  t2->lastfree = lastfree;
+  t2->hfree = hfree;
 }
 
 
@@ -447,8 +925,12 @@ void luaH_resize (lua_State *L, Table *t, unsigned int newasize,
                                           unsigned int nhsize) {
   unsigned int i;
   Table newt;  /* to keep the new hash part */
-  unsigned int oldasize = t->sizearray;
+  unsigned int oldasize;
   TValue *newarray;
+  luaV_chainbarrier(L, t);  /* slots in 't' will move */
+  if (istyped(t))
+    luaH_untype(L, t);
+  oldasize = t->sizearray;
   /* create new hash part with appropriate size into 'newt' */
   setnodevector(L, &newt, nhsize);
   if (newasize < oldasize) {  /* will array shrink? */
@@ -494,6 +976,8 @@ static void rehash (lua_State *L, Table *t, const TValue *ek) {
   unsigned int nums[MAXABITS + 1];
   int i;
   int totaluse;
+  if (istyped(t))
+    luaH_untype(L, t);  /* to count its elements as any others */
   for (i = 0; i <= MAXABITS; i++) nums[i] = 0;  /* reset counts */
   na = numusearray(t, nums);  /* count keys in array part */
   totaluse = na;  /* all those keys are integer keys */
@@ -519,43 +1003,181 @@ Table *luaH_new (lua_State *L) {
   GCObject *o = luaC_newobj(L, LUA_TTABLE, sizeof(Table));
   Table *t = gco2t(o);
   t->metatable = NULL;
-  t->flags = cast_byte(~0);
+  t->flags = cast_byte(~(BITCHAIN | BITTYPED));
   t->array = NULL;
   t->sizearray = 0;
+  t->border = 0;
+  t->fields = NULL;
   setnodevector(L, t, 0);
   return t;
 }
 
 
+/*
+** Sets the initial sizes of a new table. When shapes are enabled, a
+** small hash size is taken as the number of fields of a record, which
+** go to the shape part.
+*/
+void luaH_presize (lua_State *L, Table *t, unsigned int nasize,
+                                           unsigned int nhsize) {
+  lua_assert(t->fields == NULL && isdummy(t) && t->sizearray == 0);
+  if (0 < nhsize && nhsize <= LUAI_MAXSHAPE) {
+    setfields(L, t, cast_int(nhsize));
+    nhsize = 0;
+  }
+  if (nasize > 0 || nhsize > 0)
+    luaH_resize(L, t, nasize, nhsize);
+}
+
+
+/*
+** {=============================================================
+** Allocation sites
+** ==============================================================
+*/
+
+/*
+** Each 'OP_NEWTABLE' instruction (an allocation site) keeps in its
+** entry of the prototype's 'icache' array a profile of the sizes its
+** tables reached: the low byte holds 1 + log2 of the size of the array
+** part and the next byte 1 + log2 of the number of other keys (0 means
+** none). New tables from the site are presized after that profile. To
+** learn the final sizes of tables, 'g->tabsite' keeps the last table
+** created by each site (modulo collisions); its sizes go into the
+** profile when the site creates its next table or when the collector
+** finds the table dead. A profile follows larger sizes at once and
+** smaller ones by halving, so one odd table does not disturb it much.
+*/
+
+/* maximum log2 of the sizes given by a profile */
+#define MAXSITEBITS	10
+
+/* size given by a (non-zero) log from a profile */
+#define sitesize(l)	(1u << ((l) - 1))
+
+#define siteentry(g,site)	(&(g)->tabsite[point2uint(site) % TABSITE_N])
+
+
+static int sitelog (unsigned int n) {
+  if (n == 0)
+    return 0;
+  else {
+    int l = luaO_ceillog2(n) + 1;
+    return (l <= MAXSITEBITS + 1) ? l : MAXSITEBITS + 1;
+  }
+}
+
+
+/*
+** Update profile 'prof' with the sizes used by table 't': the border
+** of its array part (its size, if full) and its number of other keys.
+** (These include removed keys, which still use their nodes.)
+*/
+static int foldsite (int prof, Table *t) {
+  unsigned int na = t->sizearray;
+  unsigned int nh = nfields(t);
+  int a, h;
+  if (istyped(t))
+    na = tarray(t)->len;
+  else if (na > 0 && ttisnil(&t->array[na - 1]))  /* array not full? */
+    na = cast(unsigned int, luaH_getn(t));  /* border is inside it */
+  if (!isdummy(t))
+    nh += cast(unsigned int, maxload(sizenode(t)) - t->hfree);
+  a = sitelog(na);
+  h = sitelog(nh);
+  if (a < (prof & 0xFF) - 1) a = (prof & 0xFF) - 1;
+  if (h < ((prof >> 8) & 0xFF) - 1) h = ((prof >> 8) & 0xFF) - 1;
+  return a | (h << 8);
+}
+
+
+/*
+** Sets the initial sizes of table 't', created by the 'OP_NEWTABLE' of
+** prototype 'p' whose profile is in 'site'; 'nasize' and 'nhsize' are
+** the sizes given by the constructor. The table must already be
+** anchored, as the presizing can raise errors.
+*/
+void luaH_presizesite (lua_State *L, Table *t, Proto *p, int *site,
+                       unsigned int nasize, unsigned int nhsize) {
+  TabSite *e = siteentry(G(L), site);
+  int prof;
+  if (e->t != NULL && e->site == site)  /* previous table from the site? */
+    *site = foldsite(*site, e->t);
+  e->t = t;
+  e->p = p;
+  e->site = site;
+  prof = *site;
+  if ((prof & 0xFF) != 0 && nasize < sitesize(prof & 0xFF))
+    nasize = sitesize(prof & 0xFF);
+  if ((prof >> 8) != 0 && nhsize < sitesize(prof >> 8))
+    nhsize = sitesize(prof >> 8);
+  luaH_presize(L, t, nasize, nhsize);
+}
+
+
+/*
+** Called by the collector after marking: tables in 'g->tabsite' that
+** will be collected have reached their final sizes. (The entries are
+** weak references to both the table and its prototype.)
+*/
+void luaH_clearsites (global_State *g) {
+  int i;
+  for (i = 0; i < TABSITE_N; i++) {
+    TabSite *e = &g->tabsite[i];
+    if (e->t != NULL) {
+      if (iswhite(e->p))  /* site will be collected? */
+        e->t = NULL;
+      else if (iswhite(e->t)) {  /* table will be collected? */
+        *e->site = foldsite(*e->site, e->t);
+        e->t = NULL;
+      }
+    }
+  }
+}
+
+/* }============================================================= */
+
+
 void luaH_free (lua_State *L, Table *t) {
+  freefields(L, t);
   freehash(L, t);
-  luaM_freearray(L, t->array, t->sizearray);
-  luaM_free(L, t);
+  if (istyped(t))
+    luaM_freemem(L, t->array, sizetarray(tarray(t)->size));
+  else
+    luaM_freearray(L, t->array, t->sizearray);
+  luaC_freeobj(L, t);
 }
 
 
-static Node *getfreepos (Table *t) {
-  if (!isdummy(t)) {
-    while (t->lastfree > t->node) {
-      t->lastfree--;
-      if (keyisnil(t->lastfree))
-        return t->lastfree;
+/*
+** Takes the first empty node in the probe sequence of mixed hash 'm'
+** (which must have free nodes), marking it with the hash of its key.
+** In small hash parts, only the first 'sizenode' control bytes of the
+** group are real nodes.
+*/
+static Node *getfreepos (Table *t, unsigned int m) {
+  unsigned int valid = (sizenode(t) < GROUPSIZE)
+                     ? (1u << sizenode(t)) - 1 : ~0u;
+  unsigned int g, step;
+  lua_assert(t->hfree > 0);
+  forprobe(t, m, g, step) {
+    lu_byte *c = groupctrl(t, g);
+    unsigned int empty = matchempty(c) & valid;
+    if (empty != 0) {
+      c[lowbit(empty)] = hash7(m);
+      t->hfree--;
+      return groupnode(t, g, empty);
     }
   }
-  return NULL;  /* could not find a free place */
 }
 
 
-
 /*
-** inserts a new key into a hash table; first, check whether key's main
-** position is free. If not, check whether colliding node is in its main
-** position or not: if it is not, move colliding node to an empty place and
-** put new key in its main position; otherwise (colliding node is in its main
-** position), new key goes to an empty position.
+** inserts a new key into a hash table, in the first empty node of its
+** probe sequence. If there are no free nodes, grows the table.
 */
 TValue *luaH_newkey (lua_State *L, Table *t, const TValue *key) {
-  Node *mp;
+  Node *f;
   TValue aux;
   if (ttisnil(key)) luaG_runerror(L, "table index is nil");
   else if (ttisfloat(key)) {
@@ -567,42 +1189,32 @@ TValue *luaH_newkey (lua_State *L, Table *t, const TValue *key) {
     else if (luai_numisnan(fltvalue(key)))
       luaG_runerror(L, "table index is NaN");
   }
-  mp = mainpositionTV(t, key);
-  if (!ttisnil(gval(mp)) || isdummy(t)) {  /* main position is taken? */
-    Node *othern;
-    Node *f = getfreepos(t);  /* get a free place */
-    if (f == NULL) {  /* cannot find a free place? */
-      rehash(L, t, key);  /* grow table */
-      /* whatever called 'newkey' takes care of TM cache */
-      return luaH_set(L, t, key);  /* insert key into grown table */
-    }
-    lua_assert(!isdummy(t));
-    othern = mainposition(t, keytt(mp), &keyval(mp));
-    if (othern != mp) {  /* is colliding node out of its main position? */
-      /* yes; move colliding node into free position */
-      while (othern + gnext(othern) != mp)  /* find previous */
-        othern += gnext(othern);
-      gnext(othern) = cast_int(f - othern);  /* rechain to point to 'f' */
-      *f = *mp;  /* copy colliding node into free pos. (mp->next also goes) */
-      if (gnext(mp) != 0) {
-        gnext(f) += cast_int(mp - f);  /* correct 'next' */
-        gnext(mp) = 0;  /* now 'mp' is free */
-      }
-      setnilvalue(gval(mp));
-    }
-    else {  /* colliding node is in its own main position */
-      /* new node will go into free position */
-      if (gnext(mp) != 0)
-        gnext(f) = cast_int((mp + gnext(mp)) - f);  /* chain new position */
-      else lua_assert(gnext(f) == 0);
-      gnext(mp) = cast_int(f - mp);
-      mp = f;
+  if (ttisinteger(key) && istyped(t) &&
+      l_castS2U(ivalue(key)) - 1u < tarray(t)->size) {  /* typed slot? */
+    lua_Integer k = ivalue(key);
+    luaH_untype(L, t);  /* caller will write in the slot */
+    return &t->array[k - 1];
+  }
+  else if (ttisshrstring(key) && LUAI_MAXSHAPE > 0) {
+    if (t->fields != NULL ? t->fields->shape->nkeys < LUAI_MAXSHAPE
+                          : isdummy(t)) {  /* key can go to shape part? */
+      TValue *slot = newfield(L, t, tsvalue(key));
+      luaC_barrierback(L, t, key);
+      return slot;
     }
+    else if (t->fields != NULL)  /* shape part is full? */
+      unshape(L, t);  /* move all string keys to the hash part */
+  }
+  if (t->hfree <= 0) {  /* no free nodes (or dummy node)? */
+    rehash(L, t, key);  /* grow table */
+    /* whatever called 'newkey' takes care of TM cache */
+    return luaH_set(L, t, key);  /* insert key into grown table */
   }
-  setnodekey(L, mp, key);
+  f = getfreepos(t, hashkey(key));
+  setnodekey(L, f, key);
   luaC_barrierback(L, t, key);
-  lua_assert(ttisnil(gval(mp)));
-  return gval(mp);
+  lua_assert(ttisnil(gval(f)));
+  return gval(f);
 }
 
 
@@ -613,18 +1225,27 @@ const TValue *luaH_getint (Table *t, lua_Integer key) {
   /* (1 <= key && key <= t->sizearray) */
   if (l_castS2U(key) - 1u < t->sizearray)
     return &t->array[key - 1];
+  else if (istyped(t) && l_castS2U(key) - 1u < tarray(t)->size) {
+    TypedArray *ta = tarray(t);
+    if (l_castS2U(key) > ta->len)
+      return luaO_nilobject;  /* a free slot */
+    gettyped(&ta->box, ta, key - 1);
+    return &ta->box;
+  }
   else {
-    Node *n = hashint(t, key);
-    for (;;) {  /* check whether 'key' is somewhere in the chain */
-      if (keyisinteger(n) && keyival(n) == key)
-        return gval(n);  /* that's it */
-      else {
-        int nx = gnext(n);
-        if (nx == 0) break;
-        n += nx;
+    unsigned int m = mixhash(hashint(key));
+    unsigned int g, step;
+    forprobe(t, m, g, step) {
+      const lu_byte *c = groupctrl(t, g);
+      unsigned int match = matchbyte(c, hash7(m));
+      for (; match != 0; match &= match - 1) {
+        Node *n = groupnode(t, g, match);
+        if (keyisinteger(n) && keyival(n) == key)
+          return gval(n);  /* that's it */
       }
+      if (matchempty(c))
+        return luaO_nilobject;  /* not found */
     }
-    return luaO_nilobject;
   }
 }
 
@@ -633,17 +1254,23 @@ const TValue *luaH_getint (Table *t, lua_Integer key) {
 ** search function for short strings
 */
 const TValue *luaH_getshortstr (Table *t, TString *key) {
-  Node *n = hashstr(t, key);
+  unsigned int m, g, step;
   lua_assert(key->tt == LUA_TSHRSTR);
-  for (;;) {  /* check whether 'key' is somewhere in the chain */
-    if (keyisshrstr(n) && eqshrstr(keystrval(n), key))
-      return gval(n);  /* that's it */
-    else {
-      int nx = gnext(n);
-      if (nx == 0)
-        return luaO_nilobject;  /* not found */
-      n += nx;
+  if (t->fields != NULL) {  /* shape mode? */
+    int i = shapeslot(t->fields->shape, key);
+    return (i >= 0) ? &t->fields->v[i] : luaO_nilobject;
+  }
+  m = mixhash(key->hash);
+  forprobe(t, m, g, step) {
+    const lu_byte *c = groupctrl(t, g);
+    unsigned int match = matchbyte(c, hash7(m));
+    for (; match != 0; match &= match - 1) {
+      Node *n = groupnode(t, g, match);
+      if (keyisshrstr(n) && eqshrstr(keystrval(n), key))
+        return gval(n);  /* that's it */
     }
+    if (matchempty(c))
+      return luaO_nilobject;  /* not found */
   }
 }
 
@@ -685,23 +1312,65 @@ const TValue *luaH_get (Table *t, const TValue *key) {
 */
 TValue *luaH_set (lua_State *L, Table *t, const TValue *key) {
   const TValue *p = luaH_get(t, key);
+  if (isboxslot(t, p)) {  /* element of a typed array? */
+    luaH_untype(L, t);  /* caller will write in its slot */
+    p = luaH_get(t, key);
+  }
   if (p != luaO_nilobject)
     return cast(TValue *, p);
   else return luaH_newkey(L, t, key);
 }
 
 
-void luaH_setint (lua_State *L, Table *t, lua_Integer key, TValue *value) {
-  const TValue *p = luaH_getint(t, key);
-  TValue *cell;
-  if (p != luaO_nilobject)
-    cell = cast(TValue *, p);
-  else {
-    TValue k;
-    setivalue(&k, key);
-    cell = luaH_newkey(L, t, &k);
+/*
+** Converts a numeric 'key' to an integer, if it has an integral value.
+*/
+static int intkey (const TValue *key, lua_Integer *k) {
+  if (ttisinteger(key)) {
+    *k = ivalue(key);
+    return 1;
+  }
+  else
+    return (ttisfloat(key) && luaV_flttointeger(key, k, 0));
+}
+
+
+/*
+** Does 't[key] = value', where 'slot' is the result of a previous
+** get of 'key' in 't'. This is the only way to store elements of a
+** typed array; if the table has no typed array, or if it cannot hold
+** the new value, it works as 'luaH_set'. An assignment that grows the
+** array part gives the table a chance to become typed.
+** (Beware: this function does not check GC barriers nor invalidate
+** the TM cache.)
+*/
+void luaH_finishset (lua_State *L, Table *t, const TValue *key,
+                     const TValue *slot, TValue *value) {
+  lua_Integer k;
+  if (istyped(t) && intkey(key, &k) &&
+      l_castS2U(k) - 1u <= tarray(t)->size) {  /* in (or just after) it? */
+    if (typedset(L, t, l_castS2U(k) - 1u, value))
+      return;  /* done */
+    else if (l_castS2U(k) - 1u < tarray(t)->size) {  /* inside it? */
+      luaH_untype(L, t);
+      slot = &t->array[k - 1];
+    }
   }
-  setobj2t(L, cell, value);
+  if (slot == luaO_nilobject) {  /* no previous entry? */
+    unsigned int oldasize = t->sizearray;
+    setobj2t(L, luaH_newkey(L, t, key), value);
+    if (t->sizearray > oldasize)  /* array part grew? */
+      trytype(L, t);
+  }
+  else
+    setobj2t(L, cast(TValue *, slot), value);
+}
+
+
+void luaH_setint (lua_State *L, Table *t, lua_Integer key, TValue *value) {
+  TValue k;
+  setivalue(&k, key);
+  luaH_finishset(L, t, &k, luaH_getint(t, key), value);
 }
 
 
@@ -744,16 +1413,13 @@ static lua_Unsigned hash_search (Table *t, lua_Unsigned j) {
 
 
 /*
-** Try to find a boundary in table 't'. (A 'boundary' is an integer index
-** such that t[i] is non-nil and t[i+1] is nil, plus 0 if t[1] is nil
-** and 'maxinteger' if t[maxinteger] is not nil.)
-** First, try the array part: if there is an array part and its last
-** element is nil, there must be a boundary there; a binary search
-** finds that boundary. Otherwise, if the hash part is empty or does not
-** contain 'j + 1', 'j' is a boundary. Otherwize, call 'hash_search'
-** to find a boundary in the hash part.
+** Search a boundary in table 't'. First, try the array part: if there
+** is an array part and its last element is nil, there must be a
+** boundary there; a binary search finds that boundary. Otherwise, if
+** the hash part is empty or does not contain 'j + 1', 'j' is a boundary.
+** Otherwize, call 'hash_search' to find a boundary in the hash part.
 */
-lua_Unsigned luaH_getn (Table *t) {
+static lua_Unsigned searchborder (Table *t) {
   unsigned int j = t->sizearray;
   if (j > 0 && ttisnil(&t->array[j - 1])) {
     unsigned int i = 0;
@@ -773,11 +1439,60 @@ lua_Unsigned luaH_getn (Table *t) {
 }
 
 
+/* check whether 'j' (which cannot be 'maxinteger') is a boundary */
+static int isborder (Table *t, lua_Unsigned j) {
+  return (j == 0 || !ttisnil(luaH_getint(t, l_castU2S(j)))) &&
+         ttisnil(luaH_getint(t, l_castU2S(j + 1)));
+}
+
+
+/*
+** Try to find a boundary in table 't'. (A 'boundary' is an integer index
+** such that t[i] is non-nil and t[i+1] is nil, plus 0 if t[1] is nil
+** and 'maxinteger' if t[maxinteger] is not nil.)
+** The last boundary found is kept in 't->border'; as tables usually
+** grow or shrink at their ends (e.g., 't[#t + 1] = v' and
+** 't[#t] = nil'), the next one is often that same index or one of its
+** neighbors, which are checked before a full search. The hint needs no
+** maintenance by writes to the table, as it is always checked.
+*/
+lua_Unsigned luaH_getn (Table *t) {
+  lua_Unsigned j = t->border;
+  if (istyped(t)) {  /* border of a typed array is its length */
+    TypedArray *ta = tarray(t);
+    if (ta->len < ta->size || ttisnil(luaH_getint(t, ta->size + 1)))
+      return ta->len;
+    else  /* full typed array and 'size + 1' is present */
+      return hash_search(t, ta->size);
+  }
+  else if (isborder(t, j))
+    return j;
+  else if (isborder(t, j + 1))  /* element appended? */
+    j = j + 1;
+  else if (j > 0 && isborder(t, j - 1))  /* element removed? */
+    j = j - 1;
+  else {
+    j = searchborder(t);
+    if (j > MAXASIZE)  /* too large for the hint? */
+      return j;  /* (so, 'j + 1' in the checks above cannot overflow) */
+  }
+  t->border = cast(unsigned int, j);
+  return j;
+}
+
+
 
 #if defined(LUA_DEBUG)
 
+/* first node of the first group probed for 'key' */
 Node *luaH_mainposition (const Table *t, const TValue *key) {
-  return mainpositionTV(t, key);
+  return gnode(t, firstgroup(t, hashkey(key)) * GROUPSIZE);
+}
+
+
+/* control byte of node 'i' */
+int luaH_ctrlbyte (const Table *t, int i) {
+  return ctrlbytes(t)[i];
 }
 
 int luaH_isdummy (const Table *t) { return isdummy(t); }
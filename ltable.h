@@ -8,24 +8,53 @@
 #define ltable_h
 
 #include "lobject.h"
+#include "lstate.h"
 
 
 #define gnode(t,i)	(&(t)->node[i])
 #define gval(n)		(&(n)->i_val)
-#define gnext(n)	((n)->u.next)
 
 
-#define invalidateTMcache(t)	((t)->flags = 0)
+/*
+** Bit BITCHAIN in 'flags' marks tables that are part of some cached
+** '__index' chain (see 'luaV_finishget'); bit BITTYPED marks tables
+** whose 'array' is a typed array (and whose 'sizearray' is 0); the
+** other bits cache the absence of tag methods.
+*/
+#define BITCHAIN		(1u << 7)
+#define inchain(t)		((t)->flags & BITCHAIN)
+
+#define BITTYPED		(1u << 6)
+#define istyped(t)		((t)->flags & BITTYPED)
+#define tarray(t)		cast(TypedArray *, (t)->array)
+
+/* copy element 'x' of typed array 'ta' to 'o' */
+#define gettyped(o,ta,x)  \
+  { if ((ta)->tt == LUA_TNUMINT) { setivalue(o, (ta)->v[x].i); }  \
+    else { setfltvalue(o, (ta)->v[x].n); } }
+
+#define invalidateTMcache(t)	((t)->flags &= cast_byte(BITCHAIN | BITTYPED))
+
+
+/*
+** true when 'slot' (got from 't') is the copy of an element of a
+** typed array, which cannot be written directly (see 'luaH_finishset')
+*/
+#define isboxslot(t,slot)	(istyped(t) && (slot) == &tarray(t)->box)
 
 
 /* true when 't' is using 'dummynode' as its hash part */
-#define isdummy(t)		((t)->lastfree == NULL)
+#define isdummy(t)		((t)->hfree < 0)
 
 
 /* allocated size for hash nodes */
 #define allocsizenode(t)	(isdummy(t) ? 0 : sizenode(t))
 
 
+/* number of keys in the shape part of 't' */
+#define nfields(t)	((t)->fields ? (t)->fields->shape->nkeys : 0)
+
+
 /* returns the Node, given the value of a table entry */
 #define nodefromval(v) 	cast(Node *, (v))
 
@@ -38,10 +67,18 @@ LUAI_FUNC const TValue *luaH_getstr (Table *t, TString *key);
 LUAI_FUNC const TValue *luaH_get (Table *t, const TValue *key);
 LUAI_FUNC TValue *luaH_newkey (lua_State *L, Table *t, const TValue *key);
 LUAI_FUNC TValue *luaH_set (lua_State *L, Table *t, const TValue *key);
+LUAI_FUNC void luaH_finishset (lua_State *L, Table *t, const TValue *key,
+                               const TValue *slot, TValue *value);
 LUAI_FUNC Table *luaH_new (lua_State *L);
+LUAI_FUNC void luaH_presize (lua_State *L, Table *t, unsigned int nasize,
+                                                     unsigned int nhsize);
+LUAI_FUNC void luaH_presizesite (lua_State *L, Table *t, Proto *p, int *site,
+                                 unsigned int nasize, unsigned int nhsize);
+LUAI_FUNC void luaH_clearsites (global_State *g);
 LUAI_FUNC void luaH_resize (lua_State *L, Table *t, unsigned int nasize,
                                                     unsigned int nhsize);
 LUAI_FUNC void luaH_resizearray (lua_State *L, Table *t, unsigned int nasize);
+LUAI_FUNC void luaH_untype (lua_State *L, Table *t);
 LUAI_FUNC void luaH_free (lua_State *L, Table *t);
 LUAI_FUNC int luaH_next (lua_State *L, Table *t, StkId key);
 LUAI_FUNC lua_Unsigned luaH_getn (Table *t);
@@ -50,6 +87,7 @@ LUAI_FUNC lua_Unsigned luaH_getn (Table *t);
 #if defined(LUA_DEBUG)
 LUAI_FUNC Node *luaH_mainposition (const Table *t, const TValue *key);
 LUAI_FUNC int luaH_isdummy (const Table *t);
+LUAI_FUNC int luaH_ctrlbyte (const Table *t, int i);
 #endif
 
 
@@ -120,7 +120,7 @@ static void freeblock (Memcontrol *mc, Header *block) {
 }
 
 
-void *debug_realloc (void *ud, void *b, size_t oldsize, size_t size) {
+static void *auxrealloc (void *ud, void *b, size_t oldsize, size_t size) {
   Memcontrol *mc = cast(Memcontrol *, ud);
   Header *block = cast(Header *, b);
   int type;
@@ -177,6 +177,33 @@ void *debug_realloc (void *ud, void *b, size_t oldsize, size_t size) {
 }
 
 
+
+#if LUA_USE_BGSWEEP || LUA_USE_ACTORS
+#include <pthread.h>
+
+/*
+** 'l_memcontrol' is used by other threads: the background sweeper
+** (see 'luaC_bgsweep') frees blocks while the state runs, and states
+** of different actors share it.
+*/
+static pthread_mutex_t memlock = PTHREAD_MUTEX_INITIALIZER;
+
+void *debug_realloc (void *ud, void *b, size_t oldsize, size_t size) {
+  void *res;
+  pthread_mutex_lock(&memlock);
+  res = auxrealloc(ud, b, oldsize, size);
+  pthread_mutex_unlock(&memlock);
+  return res;
+}
+
+#else
+
+void *debug_realloc (void *ud, void *b, size_t oldsize, size_t size) {
+  return auxrealloc(ud, b, oldsize, size);
+}
+
+#endif
+
 /* }====================================================================== */
 
 
@@ -218,7 +245,7 @@ static void printobj (global_State *g, GCObject *o) {
   printf("||%s(%p)-%c%c(%02X)||",
            ttypename(novariant(o->tt)), (void *)o,
            isdead(g,o) ? 'd' : isblack(o) ? 'b' : iswhite(o) ? 'w' : 'g',
-           "ns01oTt"[getage(o)], o->marked);
+           "ns01oTt"[getage(o)], gcmarked(o));
   if (o->tt == LUA_TSHRSTR || o->tt == LUA_TLNGSTR)
     printf(" '%s'", getstr(gco2ts(o)));
 }
@@ -253,11 +280,20 @@ static void checktable (global_State *g, Table *h) {
   checkobjref(g, hgc, h->metatable);
   for (i = 0; i < h->sizearray; i++)
     checkvalref(g, hgc, &h->array[i]);
+  if (h->fields != NULL) {
+    Shape *s = h->fields->shape;
+    lua_assert(s->nkeys <= h->fields->size && s->nref > 0);
+    for (i = 0; i < cast(unsigned int, s->nkeys); i++) {
+      checkobjref(g, hgc, s->keys[i]);
+      checkvalref(g, hgc, &h->fields->v[i]);
+    }
+  }
   for (n = gnode(h, 0); n < limit; n++) {
     if (!ttisnil(gval(n))) {
       TValue k;
       getnodekey(g->mainthread, &k, n);
       lua_assert(!keyisnil(n));
+      lua_assert(h->fields == NULL || !keyisshrstr(n));
       checkvalref(g, hgc, &k);
       checkvalref(g, hgc, gval(n));
     }
@@ -424,8 +460,8 @@ static void checkgraylist (global_State *g, GCObject *o) {
   ((void)g);  /* better to keep it available if we need to print an object */
   while (o) {
     lua_assert(isgray(o) || getage(o) == G_TOUCHED2);
-    lua_assert(!testbit(o->marked, TESTGRAYBIT));
-    l_setbit(o->marked, TESTGRAYBIT);
+    lua_assert(!testbit(gcmarked(o), TESTGRAYBIT));
+    l_setbit(gcmarked(o), TESTGRAYBIT);
     switch (o->tt) {
       case LUA_TTABLE: o = gco2t(o)->gclist; break;
       case LUA_TLCL: o = gco2lcl(o)->gclist; break;
@@ -452,14 +488,18 @@ static void markgrays (global_State *g) {
 }
 
 
-static void checkgray (global_State *g, GCObject *o) {
-  for (; o != NULL; o = o->next) {
-    if ((isgray(o) && o->tt != LUA_TUPVAL) || getage(o) == G_TOUCHED2) {
-      lua_assert(!keepinvariant(g) || testbit(o->marked, TESTGRAYBIT));
-      resetbit(o->marked, TESTGRAYBIT);
-    }
-    lua_assert(!testbit(o->marked, TESTGRAYBIT));
+static void checkgrayobj (global_State *g, GCObject *o) {
+  if ((isgray(o) && o->tt != LUA_TUPVAL) || getage(o) == G_TOUCHED2) {
+    lua_assert(!keepinvariant(g) || testbit(gcmarked(o), TESTGRAYBIT));
+    resetbit(gcmarked(o), TESTGRAYBIT);
   }
+  lua_assert(!testbit(gcmarked(o), TESTGRAYBIT));
+}
+
+
+static void checkgray (global_State *g, GCObject *o) {
+  for (; o != NULL; o = o->next)
+    checkgrayobj(g, o);
 }
 
 
@@ -485,6 +525,39 @@ static void checklist (global_State *g, int maybedead, int tof,
 }
 
 
+#if defined(LUA_USE_GCPAGES)
+
+/*
+** Check objects living in pages, except those with finalizers (which
+** are checked with their lists). Each page must be consistent with
+** its count of free slots and its place in the lists of free slots.
+*/
+static void checkpages (global_State *g, int maybedead) {
+  GCPage *pg;
+  for (pg = g->pages; pg != NULL; pg = pg->next) {
+    int i, nfree = 0;
+    for (i = 0; i < GCPAGESLOTS; i++) {
+      GCObject *o = gcpageobj(pg, i);
+      if (pg->marks[i] == FREESLOT)
+        nfree++;
+      else {
+        lua_assert(o->marked == i && gcpageof(o) == pg);
+        lua_assert(pageclass(o->tt) == pg->cls);
+        if (!tofinalize(o)) {
+          checkgrayobj(g, o);
+          checkobject(g, o, maybedead, G_NEW);
+        }
+      }
+    }
+    lua_assert(nfree == pg->nfree);
+    lua_assert((nfree == 0) ==
+      (pg->prevfree == NULL && g->freepages[pg->cls] != pg));
+  }
+}
+
+#endif
+
+
 int lua_checkmemory (lua_State *L) {
   global_State *g = G(L);
   GCObject *o;
@@ -506,6 +579,9 @@ int lua_checkmemory (lua_State *L) {
   checkgray(g, g->allgc);
   maybedead = (GCSatomic < g->gcstate && g->gcstate <= GCSswpallgc);
   checklist(g, maybedead, 0, g->allgc, g->survival, g->old, g->reallyold);
+#if defined(LUA_USE_GCPAGES)
+  checkpages(g, maybedead);
+#endif
 
   /* check 'finobj' list */
   checkgray(g, g->finobj);
@@ -826,9 +902,13 @@ static int table_query (lua_State *L) {
   luaL_checktype(L, 1, LUA_TTABLE);
   t = hvalue(obj_at(L, 1));
   if (i == -1) {
-    lua_pushinteger(L, t->sizearray);
+    lua_pushinteger(L, istyped(t) ? tarray(t)->size : t->sizearray);
     lua_pushinteger(L, allocsizenode(t));
-    lua_pushinteger(L, isdummy(t) ? 0 : t->lastfree - t->node);
+    lua_pushinteger(L, isdummy(t) ? 0 : t->hfree);
+    if (istyped(t)) {  /* also give the length of its typed array */
+      lua_pushinteger(L, tarray(t)->len);
+      return 4;
+    }
   }
   else if ((unsigned int)i < t->sizearray) {
     lua_pushinteger(L, i);
@@ -846,10 +926,7 @@ static int table_query (lua_State *L) {
     else
       lua_pushliteral(L, "<undef>");
     pushobject(L, gval(gnode(t, i)));
-    if (gnext(&t->node[i]) != 0)
-      lua_pushinteger(L, gnext(&t->node[i]));
-    else
-      lua_pushnil(L);
+    lua_pushinteger(L, luaH_ctrlbyte(t, i));
   }
   return 3;
 }
@@ -1670,6 +1747,92 @@ static int coresume (lua_State *L) {
 
 
 
+#if LUA_USE_GIL
+/*
+** {======================================================
+** Threads: several OS threads running coroutines of one state
+** =======================================================
+*/
+
+#define MAXTHREADS	64
+
+typedef struct OSThread {
+  lua_State *co;  /* coroutine run by this thread */
+  int status;  /* its final status */
+} OSThread;
+
+
+/*
+** Resume a coroutine until it ends, discarding what it yields. Other
+** threads run while this one waits for the lock, so each yield (and
+** each allocation inside the coroutine) is a chance for interleaving.
+*/
+static void *runthread (void *ud) {
+  OSThread *t = cast(OSThread *, ud);
+  int narg = 1;  /* thread index, on the first resume */
+  int nres;
+  do {
+    t->status = lua_resume(t->co, NULL, narg, &nres);
+    if (t->status == LUA_YIELD)
+      lua_pop(t->co, nres);
+    narg = 0;
+  } while (t->status == LUA_YIELD);
+  return NULL;
+}
+
+
+/*
+** runthreads(n, code): run 'code' in 'n' coroutines of this state,
+** each one resumed by its own OS thread, all at the same time. Each
+** chunk gets its thread index (1..n) as argument. Return a table with
+** the first result of each chunk, or raise the error of the first
+** thread (in index order) that failed.
+*/
+static int runthreads (lua_State *L) {
+  OSThread th[MAXTHREADS];
+  pthread_t id[MAXTHREADS];
+  int n = cast_int(luaL_checkinteger(L, 1));
+  const char *code = luaL_checkstring(L, 2);
+  int i, nstarted;
+  luaL_argcheck(L, 1 <= n && n <= MAXTHREADS, 1, "invalid number of threads");
+  luaL_checkstack(L, n + 1, "too many threads");
+  lua_settop(L, 2);
+  for (i = 0; i < n; i++) {
+    th[i].co = lua_newthread(L);  /* anchored in the stack of 'L' */
+    if (luaL_loadstring(th[i].co, code) != LUA_OK) {
+      lua_xmove(th[i].co, L, 1);
+      return lua_error(L);
+    }
+    lua_pushinteger(th[i].co, i + 1);
+  }
+  for (nstarted = 0; nstarted < n; nstarted++) {
+    if (pthread_create(&id[nstarted], NULL, runthread, &th[nstarted]) != 0)
+      break;
+  }
+  for (i = 0; i < nstarted; i++)
+    pthread_join(id[i], NULL);
+  if (nstarted < n)
+    return luaL_error(L, "cannot create OS thread");
+  for (i = 0; i < n; i++) {
+    if (th[i].status != LUA_OK) {
+      lua_xmove(th[i].co, L, 1);  /* error message */
+      return lua_error(L);
+    }
+  }
+  lua_createtable(L, n, 0);
+  for (i = 0; i < n; i++) {
+    lua_settop(th[i].co, 1);  /* first result (or nil) */
+    lua_xmove(th[i].co, L, 1);
+    lua_rawseti(L, -2, i + 1);
+  }
+  return 1;
+}
+
+/* }====================================================== */
+#endif
+
+
+
 static const struct luaL_Reg tests_funcs[] = {
   {"checkmemory", lua_checkmemory},
   {"closestate", closestate},
@@ -1699,6 +1862,9 @@ static const struct luaL_Reg tests_funcs[] = {
   {"querytab", table_query},
   {"ref", tref},
   {"resume", coresume},
+#if LUA_USE_GIL
+  {"runthreads", runthreads},
+#endif
   {"s2d", s2d},
   {"sethook", sethook},
   {"stacklevel", stacklevel},
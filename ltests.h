@@ -91,8 +91,19 @@ struct L_EXTRA { int lock; int *plock; };
   lua_assert(getlock(l1)->plock == getlock(l)->plock)
 #define luai_userstatefree(l,l1) \
   lua_assert(getlock(l)->plock == getlock(l1)->plock)
+#if LUA_USE_GIL
+/* take the real lock and check that it excludes other threads */
+#define lua_lock(l)  \
+	(luaE_lock(l), lua_assert((*getlock(l)->plock)++ == 0))
+#define lua_unlock(l)  \
+	(lua_assert(--(*getlock(l)->plock) == 0), luaE_unlock(l))
+#define luai_threadyield(l)  \
+	{ lua_assert(--(*getlock(l)->plock) == 0); luaE_threadyield(l); \
+	  lua_assert((*getlock(l)->plock)++ == 0); }
+#else
 #define lua_lock(l)     lua_assert((*getlock(l)->plock)++ == 0)
 #define lua_unlock(l)   lua_assert(--(*getlock(l)->plock) == 0)
+#endif
 
 
 
@@ -132,5 +143,12 @@ LUA_API void *debug_realloc (void *ud, void *block,
 #define STRCACHE_N	23
 #define STRCACHE_M	5
 
+#define LUAI_MAXSHAPE	12
+
+#define LUAI_MINTYPED	4
+
+/* compile almost everything, to test the compiler */
+#define LUAI_JITHOT	2
+
 #endif
 
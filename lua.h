@@ -124,6 +124,18 @@ typedef int (*lua_Writer) (lua_State *L, const void *p, size_t sz, void *ud);
 typedef void * (*lua_Alloc) (void *ud, void *ptr, size_t osize, size_t nsize);
 
 
+/*
+** Type for compiled chunks shared by several states
+*/
+typedef struct lua_SharedChunk lua_SharedChunk;
+
+
+/*
+** Type for messages of values moved between states
+*/
+typedef struct lua_Message lua_Message;
+
+
 
 /*
 ** generic extra include file
@@ -145,6 +157,7 @@ extern const char lua_ident[];
 LUA_API lua_State *(lua_newstate) (lua_Alloc f, void *ud);
 LUA_API void       (lua_close) (lua_State *L);
 LUA_API lua_State *(lua_newthread) (lua_State *L);
+LUA_API lua_State *(lua_clonestate) (lua_State *L, lua_Alloc f, void *ud);
 
 LUA_API lua_CFunction (lua_atpanic) (lua_State *L, lua_CFunction panicf);
 
@@ -282,6 +295,15 @@ LUA_API int   (lua_load) (lua_State *L, lua_Reader reader, void *dt,
 
 LUA_API int (lua_dump) (lua_State *L, lua_Writer writer, void *data, int strip);
 
+LUA_API lua_SharedChunk *(lua_sharechunk) (lua_State *L, lua_Alloc f, void *ud);
+LUA_API void  (lua_loadchunk) (lua_State *L, lua_SharedChunk *c);
+LUA_API void  (lua_releasechunk) (lua_SharedChunk *c);
+
+LUA_API lua_Message *(lua_packmessage) (lua_State *L, int n, lua_Alloc f,
+                                                    void *ud);
+LUA_API int   (lua_unpackmessage) (lua_State *L, lua_Message *m);
+LUA_API void  (lua_freemessage) (lua_Message *m);
+
 
 /*
 ** coroutine functions
@@ -311,10 +333,36 @@ LUA_API int (lua_isyieldable) (lua_State *L);
 #define LUA_GCISRUNNING		9
 #define LUA_GCGEN		10
 #define LUA_GCINC		11
+#define LUA_GCPARALLEL		12
+#define LUA_GCBGSWEEP		13
+#define LUA_GCPACE		14
+#define LUA_GCSTATS		15
+#define LUA_GCARENA		16
 
 LUA_API int (lua_gc) (lua_State *L, int what, ...);
 
 
+/*
+** Statistics of the garbage collector (see LUA_GCSTATS). Times are in
+** microseconds of processor time; each collector phase has one entry.
+*/
+#define LUA_GCPPROPAGATE	0
+#define LUA_GCPATOMIC		1
+#define LUA_GCPSWEEP		2
+#define LUA_GCPFINALIZE		3
+
+#define LUA_GCNPHASES		4
+
+typedef struct lua_GCStats {
+  lua_Unsigned cycles;  /* complete cycles in incremental mode */
+  lua_Unsigned minor;  /* minor collections in generational mode */
+  lua_Unsigned major;  /* major collections in generational mode */
+  lua_Unsigned promoted;  /* bytes promoted to old in minor collections */
+  lua_Unsigned time[LUA_GCNPHASES];  /* total time in each phase */
+  lua_Unsigned lasttime[LUA_GCNPHASES];  /* time in last cycle/collection */
+} lua_GCStats;
+
+
 /*
 ** miscellaneous functions
 */
@@ -440,6 +488,15 @@ LUA_API lua_Hook (lua_gethook) (lua_State *L);
 LUA_API int (lua_gethookmask) (lua_State *L);
 LUA_API int (lua_gethookcount) (lua_State *L);
 
+LUA_API const char *(lua_opname) (lua_State *L, int op);
+LUA_API int (lua_opcount) (lua_State *L, int op, int next, lua_Unsigned *n);
+LUA_API void (lua_resetopcounts) (lua_State *L);
+
+LUA_API void (lua_profstart) (lua_State *L, int size);
+LUA_API void (lua_profsample) (lua_State *L);
+LUA_API int (lua_profsamples) (lua_State *L);
+LUA_API void (lua_profstop) (lua_State *L);
+
 
 struct lua_Debug {
   int event;
@@ -671,6 +671,135 @@
 #endif
 
 
+/*
+@@ LUA_USE_JUMPTABLE controls whether the main interpreter loop in
+** 'luaV_execute' dispatches through a table of label addresses
+** ("computed goto", a GNU extension) instead of a 'switch'. With a
+** jump table, each opcode ends with its own indirect jump, which is
+** much friendlier to branch predictors. By default it is used in gcc
+** and compatible compilers; define it as 0 to force the 'switch'.
+*/
+#if !defined(LUA_USE_JUMPTABLE)
+#if defined(__GNUC__) && !defined(LUA_USE_C89)
+#define LUA_USE_JUMPTABLE	1
+#else
+#define LUA_USE_JUMPTABLE	0
+#endif
+#endif
+
+
+/*
+@@ LUA_USE_SSE2 makes table searches compare the control bytes of 16
+** hash nodes at once with SSE2 instructions (see ltable.c). By default
+** it is used when the compiler targets SSE2; define it as 0 to use
+** plain C loops.
+*/
+#if !defined(LUA_USE_SSE2)
+#if defined(__SSE2__) && !defined(LUA_USE_C89)
+#define LUA_USE_SSE2	1
+#else
+#define LUA_USE_SSE2	0
+#endif
+#endif
+
+
+/*
+@@ LUA_USE_OPSTATS makes the interpreter count how many times it executes
+** each opcode and each pair of consecutive opcodes (see 'lua_opcount'
+** and 'debug.opstats'). Define it to study workloads; it slows down the
+** interpreter a little, and it turns off LUA_USE_JIT by default (code
+** running as machine code is not counted).
+*/
+/* #define LUA_USE_OPSTATS */
+
+
+/*
+@@ LUA_USE_GCPAGES makes the collector allocate tables, upvalues, and
+** prototypes in pages segregated by size, with their mark bits kept
+** in side arrays in the page headers (see lgc.h). Sweeping these
+** objects then scans only the side arrays. Define it for heaps with
+** many of these objects; it makes each mark test a little slower.
+*/
+/* #define LUA_USE_GCPAGES */
+
+
+/*
+@@ LUA_USE_JIT controls the baseline compiler that translates hot Lua
+** functions to x86-64 machine code (see ljit.c). It needs gcc or a
+** compatible compiler, a POSIX system (to allocate executable memory),
+** and the System V ABI. Define it as 0 to always interpret.
+*/
+#if !defined(LUA_USE_JIT)
+#if defined(__x86_64__) && defined(__GNUC__) && defined(LUA_USE_POSIX) && \
+    !defined(LUA_USE_C89) && !defined(_WIN32) && !defined(LUA_USE_OPSTATS)
+#define LUA_USE_JIT	1
+#else
+#define LUA_USE_JIT	0
+#endif
+#endif
+
+
+/*
+@@ LUA_USE_PARMARK allows the collector to propagate marks with helper
+** threads, when a program asks for them (see 'collectgarbage'). It
+** needs POSIX threads and the atomic builtins of gcc. Define it as 0
+** to leave parallel marking out.
+*/
+#if !defined(LUA_USE_PARMARK)
+#if defined(LUA_USE_LINUX) && defined(__GNUC__) && !defined(LUA_USE_C89)
+#define LUA_USE_PARMARK	1
+#else
+#define LUA_USE_PARMARK	0
+#endif
+#endif
+
+
+/*
+@@ LUA_USE_BGSWEEP allows the incremental collector to release the
+** memory of dead objects in a background thread, when the host asks
+** for it with LUA_GCBGSWEEP (see 'lua_gc'). The allocation function
+** must then accept frees from that thread concurrently with other
+** calls, which only the host can know; so scripts can query and stop
+** the sweeper, but not start it. Define it as 0 to leave background
+** sweeping out.
+*/
+#if !defined(LUA_USE_BGSWEEP)
+#if defined(LUA_USE_LINUX) && !defined(LUA_USE_C89)
+#define LUA_USE_BGSWEEP	1
+#else
+#define LUA_USE_BGSWEEP	0
+#endif
+#endif
+
+
+/*
+@@ LUA_USE_ACTORS adds the 'actor' library, which runs independent
+** states in their own OS threads, talking through messages. It needs
+** POSIX threads and the atomic builtins of gcc. Define it as 0 to
+** leave the library out.
+*/
+#if !defined(LUA_USE_ACTORS)
+#if defined(LUA_USE_LINUX) && defined(__GNUC__) && !defined(LUA_USE_C89)
+#define LUA_USE_ACTORS	1
+#else
+#define LUA_USE_ACTORS	0
+#endif
+#endif
+
+
+/*
+@@ LUA_USE_GIL makes 'lua_lock' a real lock, so that several OS threads
+** can run coroutines of the same state. Only one thread runs Lua code
+** at a time; a running thread lets waiting ones go, every so often
+** (LUAI_GILSLICE), at points where it may collect garbage. It needs
+** POSIX threads and the atomic builtins of gcc. It is off by default,
+** as it adds a lock round trip to each call to the API.
+*/
+#if !defined(LUA_USE_GIL)
+#define LUA_USE_GIL	0
+#endif
+
+
 /*
 @@ lua_getlocaledecpoint gets the locale "radix character" (decimal point).
 ** Change that if you do not want to use C locales. (Code using this
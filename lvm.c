@@ -22,6 +22,7 @@
 #include "ldo.h"
 #include "lfunc.h"
 #include "lgc.h"
+#include "ljit.h"
 #include "lobject.h"
 #include "lopcodes.h"
 #include "lstate.h"
@@ -160,15 +161,76 @@ static int forlimit (const TValue *obj, lua_Integer *p, lua_Integer step,
 }
 
 
+/*
+** {==================================================================
+** Cache for '__index' chains
+** ===================================================================
+*/
+
+/*
+** Searching a short-string key absent from a table through a chain of
+** '__index' tables (e.g., a method call on an object of a class
+** hierarchy) costs one hash lookup for each level of the chain. To
+** avoid that, a global cache maps pairs (metatable, key) to the slot
+** where the key is defined (or to 'luaO_nilobject' if no table in the
+** chain defines it), so that the result for any table with that
+** metatable comes in one step. All tables visited while filling an
+** entry (metatables, even without '__index', and '__index' tables) get
+** marked with BITCHAIN;
+** any change to a marked table (including its metatable and the
+** placement of its slots) and every collection (as cached slots may
+** belong to dead objects) start a new epoch, which invalidates all
+** entries. The indexed table itself is not marked, as its own keys
+** are checked before the cache.
+*/
+
+#define idxcachepos(g,mt,key)  \
+	(&(g)->idxcache[(point2uint(mt) ^ (key)->hash) % IDXCACHE_N])
+
+
+void luaV_clearidxcache (global_State *g) {
+  if (++g->idxepoch == 0) {  /* overflow? */
+    int i;
+    for (i = 0; i < IDXCACHE_N; i++)  /* clear old entries */
+      g->idxcache[i].mt = NULL;
+  }
+}
+
+
+static void fillidxcache (global_State *g, IdxCache *e, Table *mt,
+                          TString *key, const TValue *slot) {
+  e->mt = mt;
+  e->key = key;
+  e->slot = slot;
+  e->epoch = g->idxepoch;
+}
+
+/* }================================================================== */
+
+
 /*
 ** Finish the table access 'val = t[key]'.
 ** if 'slot' is NULL, 't' is not a table; otherwise, 'slot' points to
 ** t[k] entry (which must be nil).
+** For a table indexed by a short string, first try the cache for
+** '__index' chains; while the chain goes only through tables, 'e' keeps
+** the cache entry to be filled with the final result.
 */
 void luaV_finishget (lua_State *L, const TValue *t, TValue *key, StkId val,
                       const TValue *slot) {
   int loop;  /* counter to avoid infinite loops */
   const TValue *tm;  /* metamethod */
+  global_State *g = G(L);
+  IdxCache *e = NULL;  /* cache entry for this access */
+  Table *mt = NULL;  /* metatable of the original table */
+  if (slot != NULL && ttisshrstring(key) &&
+      (mt = hvalue(t)->metatable) != NULL) {
+    e = idxcachepos(g, mt, tsvalue(key));
+    if (e->mt == mt && e->key == tsvalue(key) && e->epoch == g->idxepoch) {
+      setobj2s(L, val, e->slot);  /* cache hit */
+      return;
+    }
+  }
   for (loop = 0; loop < MAXTAGLOOP; loop++) {
     if (slot == NULL) {  /* 't' is not a table? */
       lua_assert(!ttistable(t));
@@ -178,10 +240,15 @@ void luaV_finishget (lua_State *L, const TValue *t, TValue *key, StkId val,
       /* else will try the metamethod */
     }
     else {  /* 't' is a table */
+      Table *h = hvalue(t);
       lua_assert(ttisnil(slot));
-      tm = fasttm(L, hvalue(t)->metatable, TM_INDEX);  /* table's metamethod */
+      if (e != NULL && h->metatable != NULL)  /* result depends on it? */
+        h->metatable->flags |= BITCHAIN;  /* (even if it has no '__index') */
+      tm = fasttm(L, h->metatable, TM_INDEX);  /* table's metamethod */
       if (tm == NULL) {  /* no metamethod? */
         setnilvalue(s2v(val));  /* result is nil */
+        if (e != NULL)  /* chain made only of tables? */
+          fillidxcache(g, e, mt, tsvalue(key), luaO_nilobject);
         return;
       }
       /* else will try the metamethod */
@@ -191,8 +258,14 @@ void luaV_finishget (lua_State *L, const TValue *t, TValue *key, StkId val,
       return;
     }
     t = tm;  /* else try to access 'tm[key]' */
+    if (!ttistable(t))
+      e = NULL;  /* chain is not cacheable */
+    else if (e != NULL)
+      hvalue(t)->flags |= BITCHAIN;
     if (luaV_fastget(L, t, key, slot, luaH_get)) {  /* fast track? */
       setobj2s(L, val, slot);  /* done */
+      if (e != NULL)
+        fillidxcache(g, e, mt, tsvalue(key), slot);
       return;
     }
     /* else repeat (tail call 'luaV_finishget') */
@@ -205,8 +278,9 @@ void luaV_finishget (lua_State *L, const TValue *t, TValue *key, StkId val,
 ** Finish a table assignment 't[key] = val'.
 ** If 'slot' is NULL, 't' is not a table.  Otherwise, 'slot' points
 ** to the entry 't[key]', or to 'luaO_nilobject' if there is no such
-** entry.  (The value at 'slot' must be nil, otherwise 'luaV_fastget'
-** would have done the job.)
+** entry.  (The value at 'slot' must be nil, otherwise 'luaV_fastset'
+** would have done the job, unless it is the copy of an element of a
+** typed array.)
 */
 void luaV_finishset (lua_State *L, const TValue *t, TValue *key,
                      TValue *val, const TValue *slot) {
@@ -215,15 +289,17 @@ void luaV_finishset (lua_State *L, const TValue *t, TValue *key,
     const TValue *tm;  /* '__newindex' metamethod */
     if (slot != NULL) {  /* is 't' a table? */
       Table *h = hvalue(t);  /* save 't' table */
-      lua_assert(ttisnil(slot));  /* old value must be nil */
-      tm = fasttm(L, h->metatable, TM_NEWINDEX);  /* get metamethod */
+      if (isboxslot(h, slot))  /* key is present? */
+        tm = NULL;  /* no need for the metamethod */
+      else {
+        lua_assert(ttisnil(slot));  /* old value must be nil */
+        tm = fasttm(L, h->metatable, TM_NEWINDEX);  /* get metamethod */
+      }
       if (tm == NULL) {  /* no metamethod? */
-        if (slot == luaO_nilobject)  /* no previous entry? */
-          slot = luaH_newkey(L, h, key);  /* create one */
-        /* no metamethod and (now) there is an entry with given key */
-        setobj2t(L, cast(TValue *, slot), val);  /* set its new value */
+        luaH_finishset(L, h, key, slot, val);
         invalidateTMcache(h);
         luaC_barrierback(L, h, val);
+        luaV_chainbarrier(L, h);
         return;
       }
       /* else will try the metamethod */
@@ -238,7 +314,7 @@ void luaV_finishset (lua_State *L, const TValue *t, TValue *key,
       return;
     }
     t = tm;  /* else repeat assignment over 'tm' */
-    if (luaV_fastget(L, t, key, slot, luaH_get)) {
+    if (luaV_fastset(L, t, key, slot, luaH_get)) {
       luaV_finishfastset(L, t, slot, val);
       return;  /* done */
     }
@@ -673,6 +749,75 @@ static void pushclosure (lua_State *L, Proto *p, UpVal **encup, StkId base,
 }
 
 
+/*
+** {==================================================================
+** Inline caches
+** ===================================================================
+*/
+
+/*
+** Each instruction that indexes a table with a constant short string
+** ('OP_GETTABUP', 'OP_GETFIELD', 'OP_SELF', 'OP_SETTABUP', and
+** 'OP_SETFIELD') has an entry in its prototype's 'icache' array with
+** the index of the node where it last found its key. As a key can
+** live in only one node of a hash part, a hit only needs to check
+** that the node at that index still holds the key; so, a cache never
+** needs to be invalidated (e.g., when 'luaH_resize' reallocates the
+** node vector) and tables with the same layout (such as those built
+** by the same constructor) share hits. A dummy node never holds a
+** key, so it always gives a miss. For tables in shape mode, the index
+** is that of the key's slot in the shape part, checked in the same way
+** against the table's shape.
+*/
+#define nodehit(t,key,ic)  \
+  (l_castS2U(*(ic)) < l_castS2U(sizenode(t)) &&  \
+   keyisshrstr(gnode(t, *(ic))) && eqshrstr(keystrval(gnode(t, *(ic))), key))
+
+#define fieldhit(f,key,ic)  \
+  (l_castS2U(*(ic)) < l_castS2U((f)->shape->nkeys) &&  \
+   eqshrstr((f)->shape->keys[*(ic)], key))
+
+
+/*
+** Handle a miss in an inline cache: do a regular search and, if the
+** key is present, update the cache with the index of its node (or of
+** its slot in the shape part).
+*/
+static const TValue *getshortstrIC (Table *t, TString *key, int *ic) {
+  const TValue *slot = luaH_getshortstr(t, key);
+  if (slot != luaO_nilobject) {  /* key is present? */
+    if (t->fields != NULL)
+      *ic = cast_int(slot - t->fields->v);
+    else
+      *ic = cast_int(nodefromval(slot) - gnode(t, 0));
+  }
+  return slot;
+}
+
+
+static const TValue *lookupIC (Table *t, TString *key, int *ic) {
+  if (t->fields != NULL)
+    return fieldhit(t->fields, key, ic) ? &t->fields->v[*ic]
+                                        : getshortstrIC(t, key, ic);
+  else
+    return nodehit(t, key, ic) ? gval(gnode(t, *ic))
+                               : getshortstrIC(t, key, ic);
+}
+
+
+/*
+** Variant of 'luaV_fastget' for short-string keys that goes through
+** the inline cache 'ic'.
+*/
+#define fastgetIC(t,k,slot,ic)  \
+  (!ttistable(t)  \
+   ? (slot = NULL, 0)  /* not a table; 'slot' is NULL and result is 0 */  \
+   : (slot = lookupIC(hvalue(t), k, ic),  \
+      !ttisnil(slot)))  /* result not nil? */
+
+/* }================================================================== */
+
+
 /*
 ** finish execution of an opcode interrupted by a yield
 */
@@ -680,7 +825,7 @@ void luaV_finishOp (lua_State *L) {
   CallInfo *ci = L->ci;
   StkId base = ci->func + 1;
   Instruction inst = *(ci->u.l.savedpc - 1);  /* interrupted instruction */
-  OpCode op = GET_OPCODE(inst);
+  OpCode op = GET_BASEOP(inst);
   switch (op) {  /* finish its execution */
     case OP_ADDI: case OP_SUBI:
     case OP_MULI: case OP_DIVI: case OP_IDIVI:
@@ -760,6 +905,21 @@ void luaV_finishOp (lua_State *L) {
 #define KC(i)	(k+GETARG_C(i))
 #define RKC(i)	((TESTARG_k(i)) ? k + GETARG_C(i) : s2v(base + GETARG_C(i)))
 
+/* inline cache for current instruction ('pc' already points to next one) */
+#define ICACHE	(cl->p->icache + (pc - 1 - cl->p->code))
+
+
+
+#if defined(LUA_USE_OPSTATS)
+/* count the execution of instruction 'i' (see 'OpStats') */
+#define countop(i)  \
+  { OpStats *os_ = &G(L)->opstats; int o_ = GET_OPCODE(i);  \
+    os_->count[o_]++;  \
+    if (os_->lastop >= 0) os_->pair[os_->lastop][o_]++;  \
+    os_->lastop = o_; }
+#else
+#define countop(i)	((void)0)
+#endif
 
 
 #define updatetrap(ci)  (trap = ci->u.l.trap)
@@ -805,15 +965,25 @@ void luaV_finishOp (lua_State *L) {
 #define halfProtect(exp)  (savepc(L), (exp))
 
 
+/*
+** 'c' is computed before the collection, which can reallocate the
+** stack (and correct 'L->top'), so it must not be used after it.
+** While the thread yields, other threads may traverse its stack (up to
+** 'L->top'), so the yield needs the same care as a collection.
+*/
 #define checkGC(L,c)  \
-	{ luaC_condGC(L, L->top = (c),  /* limit of live values */ \
-                         updatetrap(ci)); \
-           luai_threadyield(L); }
+	{ L->top = (c);  /* limit of live values */ \
+	  luaC_condGC(L, (void)0, updatetrap(ci)); \
+	  if (luai_threadwaiting(L)) { \
+	    savepc(L); \
+	    luai_threadyield(L); \
+	    updatetrap(ci); } }
 
 
 /* fetch an instruction and prepare its execution */
 #define vmfetch()	{ \
   i = *(pc++); \
+  countop(i); \
   if (trap) { \
     if (!(L->hookmask & (LUA_MASKLINE | LUA_MASKCOUNT))) \
       trap = ci->u.l.trap = 0;  /* no need to stop again */ \
@@ -824,6 +994,106 @@ void luaV_finishOp (lua_State *L) {
   vra = s2v(ra); \
 }
 
+/*
+** Backward jump of a numerical loop: a chance to run the loop body as
+** machine code (see ljit.c), if there is no trap.
+*/
+#define jitbackedge(ci)  { if (!updatetrap(ci)) luaJ_tryenter(L, ci, cl, pc); }
+
+
+/*
+** {==================================================================
+** Superinstructions (see 'fusedop' in lcode.c): the handler of a fused
+** instruction does its first part and then goes directly to the code
+** of its second part (the next instruction), skipping a dispatch. A
+** trap (e.g., a hook) makes it take the regular path, so that the
+** second part is fetched as a separate instruction.
+** ===================================================================
+*/
+
+#define vmfused(o,l)  \
+  { if (trap) { vmbreak; }  \
+    i = *(pc++); ra = RA(i); vra = s2v(ra);  \
+    lua_assert(GET_OPCODE(i) == o);  \
+    countop(i);  \
+    goto l; }
+
+/* R(A) := t[K(C):string] */
+#define op_getfield(t) {  \
+  const TValue *slot;  \
+  TValue *rb = t;  \
+  TValue *rc = KC(i);  \
+  TString *key = tsvalue(rc);  /* key must be a string */  \
+  if (fastgetIC(rb, key, slot, ICACHE)) {  \
+    setobj2s(L, ra, slot);  \
+  }  \
+  else  \
+    Protect(luaV_finishget(L, rb, rc, ra, slot)); }
+
+#define op_self() {  \
+  const TValue *slot;  \
+  TValue *rb = vRB(i);  \
+  TValue *rc = RKC(i);  \
+  TString *key = tsvalue(rc);  /* key must be a string */  \
+  setobj2s(L, ra + 1, rb);  \
+  if (ttisshrstring(rc)  \
+      ? fastgetIC(rb, key, slot, ICACHE)  \
+      : luaV_fastget(L, rb, key, slot, luaH_getstr)) {  \
+    setobj2s(L, ra, slot);  \
+  }  \
+  else  \
+    Protect(luaV_finishget(L, rb, rc, ra, slot)); }
+
+/* }================================================================== */
+
+
+/*
+** {==================================================================
+** Quickening: when a generic arithmetic or order instruction finds two
+** integers or two floats, it rewrites itself into a form specialized
+** for those types. A specialized instruction only checks that its
+** operands still have the expected types; otherwise, it turns itself
+** back into its generic form and goes on as such (from label 'gl').
+** ===================================================================
+*/
+
+/*
+** rewrite the instruction being executed into opcode 'o' (unless the
+** code is shared with other states, which only read it)
+*/
+#define quicken(o)  \
+  ((void)(cl->p->shared != NULL ||  \
+          (SET_OPCODE(*cast(Instruction *, pc - 1), o), 0)))
+
+#define op_arithII(op,gop,gl) {  \
+  TValue *rb = vRB(i); TValue *rc = vRC(i);  \
+  if (ttisinteger(rb) && ttisinteger(rc)) {  \
+    setivalue(vra, intop(op, ivalue(rb), ivalue(rc)));  \
+  }  \
+  else { quicken(gop); goto gl; } }
+
+#define op_arithFF(fop,gop,gl) {  \
+  TValue *rb = vRB(i); TValue *rc = vRC(i);  \
+  if (ttisfloat(rb) && ttisfloat(rc)) {  \
+    setfltvalue(vra, fop(L, fltvalue(rb), fltvalue(rc)));  \
+  }  \
+  else { quicken(gop); goto gl; } }
+
+#define op_orderII(op,gop,gl) {  \
+  TValue *rb = vRB(i);  \
+  if (ttisinteger(vra) && ttisinteger(rb))  \
+    cond = (ivalue(vra) op ivalue(rb));  \
+  else { quicken(gop); goto gl; } }
+
+#define op_orderFF(fop,gop,gl) {  \
+  TValue *rb = vRB(i);  \
+  if (ttisfloat(vra) && ttisfloat(rb))  \
+    cond = fop(fltvalue(vra), fltvalue(rb));  \
+  else { quicken(gop); goto gl; } }
+
+/* }================================================================== */
+
+
 #define vmdispatch(o)	switch(o)
 #define vmcase(l)	case l:
 #define vmbreak		break
@@ -835,11 +1105,18 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
   StkId base;
   const Instruction *pc;
   int trap = ci->u.l.trap;
+#if LUA_USE_JUMPTABLE
+#include "ljumptab.h"
+#endif
  tailcall:
   cl = clLvalue(s2v(ci->func));
+  if (cl->p->icache == NULL)  /* shared prototype running for the 1st time? */
+    luaF_initcaches(L, cl->p);
   k = cl->p->k;
   base = ci->func + 1;
   pc = ci->u.l.savedpc;
+  if (!trap)
+    luaJ_tryenter(L, ci, cl, pc);
   /* main loop of interpreter */
   for (;;) {
     int cond;  /* flag for conditional jumps */
@@ -900,15 +1177,7 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         vmbreak;
       }
       vmcase(OP_GETTABUP) {
-        const TValue *slot;
-        TValue *upval = cl->upvals[GETARG_B(i)]->v;
-        TValue *rc = KC(i);
-        TString *key = tsvalue(rc);  /* key must be a string */
-        if (luaV_fastget(L, upval, key, slot, luaH_getshortstr)) {
-          setobj2s(L, ra, slot);
-        }
-        else
-          Protect(luaV_finishget(L, upval, rc, ra, slot));
+        op_getfield(cl->upvals[GETARG_B(i)]->v);
         vmbreak;
       }
       vmcase(OP_GETTABLE) {
@@ -939,16 +1208,8 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         }
         vmbreak;
       }
-      vmcase(OP_GETFIELD) {
-        const TValue *slot;
-        TValue *rb = vRB(i);
-        TValue *rc = KC(i);
-        TString *key = tsvalue(rc);  /* key must be a string */
-        if (luaV_fastget(L, rb, key, slot, luaH_getshortstr)) {
-          setobj2s(L, ra, slot);
-        }
-        else
-          Protect(luaV_finishget(L, rb, rc, ra, slot));
+      vmcase(OP_GETFIELD) l_getfield: {
+        op_getfield(vRB(i));
         vmbreak;
       }
       vmcase(OP_SETTABUP) {
@@ -957,7 +1218,7 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         TValue *rb = KB(i);
         TValue *rc = RKC(i);
         TString *key = tsvalue(rb);  /* key must be a string */
-        if (luaV_fastget(L, upval, key, slot, luaH_getshortstr)) {
+        if (fastgetIC(upval, key, slot, ICACHE)) {
           luaV_finishfastset(L, upval, slot, rc);
         }
         else
@@ -970,8 +1231,8 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         TValue *rc = RKC(i);  /* value */
         lua_Unsigned n;
         if (ttisinteger(rb)  /* fast track for integers? */
-            ? (n = ivalue(rb), luaV_fastgeti(L, vra, n, slot))
-            : luaV_fastget(L, vra, rb, slot, luaH_get)) {
+            ? (n = ivalue(rb), luaV_fastseti(L, vra, n, slot))
+            : luaV_fastset(L, vra, rb, slot, luaH_get)) {
           luaV_finishfastset(L, vra, slot, rc);
         }
         else
@@ -982,7 +1243,7 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         const TValue *slot;
         int c = GETARG_B(i);
         TValue *rc = RKC(i);
-        if (luaV_fastgeti(L, vra, c, slot)) {
+        if (luaV_fastseti(L, vra, c, slot)) {
           luaV_finishfastset(L, vra, slot, rc);
         }
         else {
@@ -997,7 +1258,7 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         TValue *rb = KB(i);
         TValue *rc = RKC(i);
         TString *key = tsvalue(rb);  /* key must be a string */
-        if (luaV_fastget(L, vra, key, slot, luaH_getshortstr)) {
+        if (fastgetIC(vra, key, slot, ICACHE)) {
           luaV_finishfastset(L, vra, slot, rc);
         }
         else
@@ -1011,22 +1272,13 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         L->top = ci->top;  /* correct top in case of GC */
         t = luaH_new(L);  /* memory allocation */
         sethvalue2s(L, ra, t);
-        if (b != 0 || c != 0)
-          luaH_resize(L, t, luaO_fb2int(b), luaO_fb2int(c));  /* idem */
+        luaH_presizesite(L, t, cl->p, ICACHE,
+                         luaO_fb2int(b), luaO_fb2int(c));  /* idem */
         checkGC(L, ra + 1);
         vmbreak;
       }
       vmcase(OP_SELF) {
-        const TValue *slot;
-        TValue *rb = vRB(i);
-        TValue *rc = RKC(i);
-        TString *key = tsvalue(rc);  /* key must be a string */
-        setobj2s(L, ra + 1, rb);
-        if (luaV_fastget(L, rb, key, slot, luaH_getstr)) {
-          setobj2s(L, ra, slot);
-        }
-        else
-          Protect(luaV_finishget(L, rb, rc, ra, slot));
+        op_self();
         vmbreak;
       }
       vmcase(OP_ADDI) {
@@ -1127,45 +1379,54 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
           Protect(luaT_trybiniTM(L, rb, ic, 0, ra, TM_IDIV));
         vmbreak;
       }
-      vmcase(OP_ADD) {
+      vmcase(OP_ADD) l_add: {
         TValue *rb = vRB(i);
         TValue *rc = vRC(i);
         lua_Number nb; lua_Number nc;
         if (ttisinteger(rb) && ttisinteger(rc)) {
           lua_Integer ib = ivalue(rb); lua_Integer ic = ivalue(rc);
+          quicken(OP_ADDII);
           setivalue(vra, intop(+, ib, ic));
         }
         else if (tonumberns(rb, nb) && tonumberns(rc, nc)) {
+          if (ttisfloat(rb) && ttisfloat(rc))
+            quicken(OP_ADDFF);
           setfltvalue(vra, luai_numadd(L, nb, nc));
         }
         else
           Protect(luaT_trybinTM(L, rb, rc, ra, TM_ADD));
         vmbreak;
       }
-      vmcase(OP_SUB) {
+      vmcase(OP_SUB) l_sub: {
         TValue *rb = vRB(i);
         TValue *rc = vRC(i);
         lua_Number nb; lua_Number nc;
         if (ttisinteger(rb) && ttisinteger(rc)) {
           lua_Integer ib = ivalue(rb); lua_Integer ic = ivalue(rc);
+          quicken(OP_SUBII);
           setivalue(vra, intop(-, ib, ic));
         }
         else if (tonumberns(rb, nb) && tonumberns(rc, nc)) {
+          if (ttisfloat(rb) && ttisfloat(rc))
+            quicken(OP_SUBFF);
           setfltvalue(vra, luai_numsub(L, nb, nc));
         }
         else
           Protect(luaT_trybinTM(L, rb, rc, ra, TM_SUB));
         vmbreak;
       }
-      vmcase(OP_MUL) {
+      vmcase(OP_MUL) l_mul: {
         TValue *rb = vRB(i);
         TValue *rc = vRC(i);
         lua_Number nb; lua_Number nc;
         if (ttisinteger(rb) && ttisinteger(rc)) {
           lua_Integer ib = ivalue(rb); lua_Integer ic = ivalue(rc);
+          quicken(OP_MULII);
           setivalue(vra, intop(*, ib, ic));
         }
         else if (tonumberns(rb, nb) && tonumberns(rc, nc)) {
+          if (ttisfloat(rb) && ttisfloat(rc))
+            quicken(OP_MULFF);
           setfltvalue(vra, luai_nummul(L, nb, nc));
         }
         else
@@ -1408,27 +1669,37 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
           donextjump(ci);
         vmbreak;
       }
-      vmcase(OP_LT) {
+      vmcase(OP_LT) l_lt: {
         TValue *rb = vRB(i);
-        if (ttisinteger(vra) && ttisinteger(rb))
+        if (ttisinteger(vra) && ttisinteger(rb)) {
+          quicken(OP_LTII);
           cond = (ivalue(vra) < ivalue(rb));
-        else if (ttisnumber(vra) && ttisnumber(rb))
+        }
+        else if (ttisnumber(vra) && ttisnumber(rb)) {
+          if (ttisfloat(vra) && ttisfloat(rb))
+            quicken(OP_LTFF);
           cond = LTnum(vra, rb);
+        }
         else
           Protect(cond = lessthanothers(L, vra, rb));
         goto condjump;
       }
-      vmcase(OP_LE) {
+      vmcase(OP_LE) l_le: {
         TValue *rb = vRB(i);
-        if (ttisinteger(vra) && ttisinteger(rb))
+        if (ttisinteger(vra) && ttisinteger(rb)) {
+          quicken(OP_LEII);
           cond = (ivalue(vra) <= ivalue(rb));
-        else if (ttisnumber(vra) && ttisnumber(rb))
+        }
+        else if (ttisnumber(vra) && ttisnumber(rb)) {
+          if (ttisfloat(vra) && ttisfloat(rb))
+            quicken(OP_LEFF);
           cond = LEnum(vra, rb);
+        }
         else
           Protect(cond = lessequalothers(L, vra, rb));
         goto condjump;
       }
-      vmcase(OP_EQK) {
+      vmcase(OP_EQK) l_eqk: {
         TValue *rb = KB(i);
         /* basic types do not use '__eq'; we can use raw equality */
         cond = luaV_equalobj(NULL, vra, rb);
@@ -1484,7 +1755,7 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         }
         vmbreak;
       }
-      vmcase(OP_CALL) {
+      vmcase(OP_CALL) l_call: {
         int b = GETARG_B(i);
         int nresults = GETARG_C(i) - 1;
         if (b != 0)  /* fixed number of arguments? */
@@ -1567,6 +1838,7 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
           pc -= GETARG_Bx(i);  /* jump back */
           chgivalue(vra, idx);  /* update internal index... */
           setivalue(s2v(ra + 3), idx);  /* ...and external index */
+          jitbackedge(ci);
         }
         updatetrap(ci);
         vmbreak;
@@ -1595,6 +1867,7 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
             pc -= GETARG_Bx(i);  /* jump back */
             chgivalue(vra, idx);  /* update internal index... */
             setivalue(s2v(ra + 3), idx);  /* ...and external index */
+            jitbackedge(ci);
           }
         }
         else {  /* floating loop */
@@ -1709,6 +1982,70 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         lua_assert(0);
         vmbreak;
       }
+      vmcase(OP_MOVECALL) {
+        setobjs2s(L, ra, RB(i));
+        vmfused(OP_CALL, l_call);
+      }
+      vmcase(OP_SELFCALL) {
+        op_self();
+        vmfused(OP_CALL, l_call);
+      }
+      vmcase(OP_TABUPFIELD) {
+        op_getfield(cl->upvals[GETARG_B(i)]->v);
+        vmfused(OP_GETFIELD, l_getfield);
+      }
+      vmcase(OP_FIELDFIELD) {
+        op_getfield(vRB(i));
+        vmfused(OP_GETFIELD, l_getfield);
+      }
+      vmcase(OP_FIELDCALL) {
+        op_getfield(vRB(i));
+        vmfused(OP_CALL, l_call);
+      }
+      vmcase(OP_FIELDEQK) {
+        op_getfield(vRB(i));
+        vmfused(OP_EQK, l_eqk);
+      }
+      vmcase(OP_ADDII) {
+        op_arithII(+, OP_ADD, l_add);
+        vmbreak;
+      }
+      vmcase(OP_ADDFF) {
+        op_arithFF(luai_numadd, OP_ADD, l_add);
+        vmbreak;
+      }
+      vmcase(OP_SUBII) {
+        op_arithII(-, OP_SUB, l_sub);
+        vmbreak;
+      }
+      vmcase(OP_SUBFF) {
+        op_arithFF(luai_numsub, OP_SUB, l_sub);
+        vmbreak;
+      }
+      vmcase(OP_MULII) {
+        op_arithII(*, OP_MUL, l_mul);
+        vmbreak;
+      }
+      vmcase(OP_MULFF) {
+        op_arithFF(luai_nummul, OP_MUL, l_mul);
+        vmbreak;
+      }
+      vmcase(OP_LTII) {
+        op_orderII(<, OP_LT, l_lt);
+        goto condjump;
+      }
+      vmcase(OP_LTFF) {
+        op_orderFF(luai_numlt, OP_LT, l_lt);
+        goto condjump;
+      }
+      vmcase(OP_LEII) {
+        op_orderII(<=, OP_LE, l_le);
+        goto condjump;
+      }
+      vmcase(OP_LEFF) {
+        op_orderFF(luai_numle, OP_LE, l_le);
+        goto condjump;
+      }
     }
   }
 }
@@ -91,12 +91,33 @@
 
 
 /*
-** Finish a fast set operation (when fast get succeeds). In that case,
+** fast track for 'settable': like 'luaV_fastget', but also fails when
+** 'slot' is the copy of an element of a typed array (which cannot be
+** written in place), leaving the job to 'luaV_finishset'.
+*/
+#define luaV_fastset(L,t,k,slot,f) \
+  (luaV_fastget(L,t,k,slot,f) && !isboxslot(hvalue(t), slot))
+
+#define luaV_fastseti(L,t,k,slot) \
+  (luaV_fastgeti(L,t,k,slot) && !isboxslot(hvalue(t), slot))
+
+
+/*
+** Finish a fast set operation (when fast set succeeds). In that case,
 ** 'slot' points to the place to put the value.
 */
 #define luaV_finishfastset(L,t,slot,v) \
     { setobj2t(L, cast(TValue *,slot), v); \
-      luaC_barrierback(L, hvalue(t), v); }
+      luaC_barrierback(L, hvalue(t), v); \
+      luaV_chainbarrier(L, hvalue(t)); }
+
+
+/*
+** Any change to a table that is part of a cached '__index' chain
+** invalidates the whole cache. (See 'luaV_finishget'.)
+*/
+#define luaV_chainbarrier(L,t)  \
+	{ if (inchain(t)) luaV_clearidxcache(G(L)); }
 
 
 
@@ -107,6 +128,7 @@ LUAI_FUNC int luaV_lessequal (lua_State *L, const TValue *l, const TValue *r);
 LUAI_FUNC int luaV_tonumber_ (const TValue *obj, lua_Number *n);
 LUAI_FUNC int luaV_tointeger (const TValue *obj, lua_Integer *p, int mode);
 LUAI_FUNC int luaV_flttointeger (const TValue *obj, lua_Integer *p, int mode);
+LUAI_FUNC void luaV_clearidxcache (global_State *g);
 LUAI_FUNC void luaV_finishget (lua_State *L, const TValue *t, TValue *key,
                                StkId val, const TValue *slot);
 LUAI_FUNC void luaV_finishset (lua_State *L, const TValue *t, TValue *key,